@@ -0,0 +1,255 @@
+#include "qfind.h"
+#include <errno.h>
+#include <immintrin.h>
+
+#define TEDDY_MAX_LITERALS 64        // Past this the nibble masks let nearly every byte through
+#define TEDDY_BUCKETS 8
+#define TEDDY_MAX_FP 3               // Fingerprint bytes per literal
+#define AC_PARALLEL_BYTES (1 << 20)  // Smaller arenas are scanned on one thread
+
+/*
+ * Multi-literal matcher: an Aho-Corasick automaton compiled to a full DFA
+ * over byte classes (bytes that occur in no literal share class 0), so
+ * each input byte is one table load. For small literal sets a Teddy-style
+ * AVX2 prefilter runs first: every literal's first bytes set its bucket
+ * bit in per-nibble masks, and shuffles test 32 positions at once, so
+ * names with no candidate position never reach the automaton.
+ */
+
+struct ac_automaton {
+    uint32_t num_literals;
+    uint32_t num_states;
+    uint32_t num_classes;
+    uint16_t cls[256];               // Byte to class; both ASCII cases share one when folding
+    int32_t *trans;                  // num_states * num_classes, complete
+    uint32_t *out_start;             // Literals ending at each state: out[out_start[s] ..]
+    uint32_t *out_count;
+    uint32_t *out;
+    int32_t *dict;                   // Nearest proper suffix state with output, 0 if none
+    bool teddy;
+    uint32_t fp_len;
+    uint8_t lo[TEDDY_MAX_FP][32];    // Bucket bits by low nibble, duplicated for both lanes
+    uint8_t hi[TEDDY_MAX_FP][32];    // Bucket bits by high nibble
+};
+
+void ac_free(ac_automaton_t *ac) {
+    if (!ac) return;
+    free(ac->trans);
+    free(ac->out_start);
+    free(ac->out_count);
+    free(ac->out);
+    free(ac->dict);
+    free(ac);
+}
+
+static void teddy_build(ac_automaton_t *ac, const char **literals, uint32_t n, bool case_sensitive) {
+    size_t shortest = SIZE_MAX;
+    for (uint32_t i = 0; i < n; i++) shortest = MIN(shortest, strlen(literals[i]));
+    ac->fp_len = MIN((size_t)TEDDY_MAX_FP, shortest);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint8_t bucket = 1 << (i % TEDDY_BUCKETS);
+        for (uint32_t k = 0; k < ac->fp_len; k++) {
+            unsigned char c = literals[i][k];
+            unsigned char variants[2] = { c, c };
+            if (!case_sensitive) {
+                variants[0] = fold_ascii(c);
+                variants[1] = upper_ascii(c);
+            }
+            for (int v = 0; v < 2; v++) {
+                ac->lo[k][variants[v] & 0xF] |= bucket;
+                ac->lo[k][16 + (variants[v] & 0xF)] |= bucket;
+                ac->hi[k][variants[v] >> 4] |= bucket;
+                ac->hi[k][16 + (variants[v] >> 4)] |= bucket;
+            }
+        }
+    }
+    ac->teddy = true;
+}
+
+/*
+ * Compile the literals (none may be empty). When !case_sensitive they
+ * match ASCII case-insensitively.
+ */
+ac_automaton_t *ac_build(const char **literals, uint32_t n, bool case_sensitive) {
+    ac_automaton_t *ac = calloc(1, sizeof(ac_automaton_t));
+    if (!ac) return NULL;
+    ac->num_literals = n;
+
+    size_t total = 1;
+    for (uint32_t i = 0; i < n; i++) {
+        const unsigned char *p = (const unsigned char*)literals[i];
+        if (!*p) goto fail;
+        for (; *p; p++) {
+            unsigned char c = case_sensitive ? *p : fold_ascii(*p);
+            if (!ac->cls[c]) ac->cls[c] = ++ac->num_classes;
+            total++;
+        }
+    }
+    ac->num_classes++;
+    if (!case_sensitive) {
+        for (int c = 'a'; c <= 'z'; c++) ac->cls[upper_ascii(c)] = ac->cls[c];
+    }
+
+    // Trie over classes; -1 marks a missing edge until the DFA is completed
+    uint32_t nc = ac->num_classes;
+    ac->trans = malloc(total * nc * sizeof(int32_t));
+    ac->out_count = calloc(total, sizeof(uint32_t));
+    ac->out_start = calloc(total, sizeof(uint32_t));
+    ac->dict = calloc(total, sizeof(int32_t));
+    int32_t *fail = calloc(total, sizeof(int32_t));
+    int32_t *queue = malloc(total * sizeof(int32_t));
+    int32_t *terminal = malloc((n ? n : 1) * sizeof(int32_t));
+    ac->out = malloc((n ? n : 1) * sizeof(uint32_t));
+    if (!ac->trans || !ac->out_count || !ac->out_start || !ac->dict || !fail || !queue || !terminal || !ac->out) {
+        free(fail);
+        free(queue);
+        free(terminal);
+        goto fail;
+    }
+    memset(ac->trans, 0xFF, total * nc * sizeof(int32_t));
+    ac->num_states = 1;
+
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t state = 0;
+        for (const unsigned char *p = (const unsigned char*)literals[i]; *p; p++) {
+            int32_t *edge = &ac->trans[state * nc + ac->cls[*p]];
+            if (*edge < 0) *edge = ac->num_states++;
+            state = *edge;
+        }
+        terminal[i] = state;
+        ac->out_count[state]++;
+    }
+
+    // Group literal ids by their terminal state
+    uint32_t off = 0;
+    for (uint32_t s = 0; s < ac->num_states; s++) {
+        ac->out_start[s] = off;
+        off += ac->out_count[s];
+        ac->out_count[s] = 0;
+    }
+    for (uint32_t i = 0; i < n; i++) ac->out[ac->out_start[terminal[i]] + ac->out_count[terminal[i]]++] = i;
+
+    // Breadth-first: failure links, dictionary links, then the missing DFA edges
+    uint32_t head = 0, tail = 0;
+    for (uint32_t c = 0; c < nc; c++) {
+        int32_t next = ac->trans[c];
+        if (next < 0) ac->trans[c] = 0;
+        else {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail) {
+        int32_t s = queue[head++];
+        int32_t f = fail[s];
+        ac->dict[s] = ac->out_count[f] ? f : ac->dict[f];
+        for (uint32_t c = 0; c < nc; c++) {
+            int32_t *edge = &ac->trans[s * nc + c];
+            if (*edge < 0) *edge = ac->trans[f * nc + c];
+            else {
+                fail[*edge] = ac->trans[f * nc + c];
+                queue[tail++] = *edge;
+            }
+        }
+    }
+    free(fail);
+    free(queue);
+    free(terminal);
+
+    if (n <= TEDDY_MAX_LITERALS) teddy_build(ac, literals, n, case_sensitive);
+    return ac;
+
+fail:
+    ac_free(ac);
+    return NULL;
+}
+
+/* Run the automaton over one NUL-terminated name, setting seen[] bits of every literal found */
+static void ac_run(const ac_automaton_t *ac, const unsigned char *p, uint64_t *seen) {
+    const int32_t *trans = ac->trans;
+    uint32_t nc = ac->num_classes;
+    int32_t state = 0;
+    for (; *p; p++) {
+        state = trans[state * nc + ac->cls[*p]];
+        for (int32_t s = ac->out_count[state] ? state : ac->dict[state]; s > 0; s = ac->dict[s]) {
+            for (uint32_t i = 0; i < ac->out_count[s]; i++) {
+                uint32_t lit = ac->out[ac->out_start[s] + i];
+                seen[lit / 64] |= 1ULL << (lit % 64);
+            }
+        }
+    }
+}
+
+/* Does the literal set select this name; see ac_select_t */
+bool ac_select(const ac_select_t *sel, const char *name) {
+    const ac_automaton_t *ac = sel->ac;
+    uint64_t seen[(ac->num_literals + 63) / 64 + 1];
+    memset(seen, 0, sizeof(seen));
+    ac_run(ac, (const unsigned char*)name, seen);
+
+    uint32_t positives = 0;
+    for (uint32_t i = 0; i < ac->num_literals; i++) {
+        if (!((seen[i / 64] >> (i % 64)) & 1)) continue;
+        if (i >= sel->num_positive) return false;  // An excluded literal
+        positives++;
+    }
+    return sel->match_all ? positives == sel->num_positive : positives > 0;
+}
+
+#ifdef __AVX2__
+/* Bucket bits of the literals that may start at each of the 32 positions from p */
+static inline __m256i teddy_block(const ac_automaton_t *ac, const unsigned char *p) {
+    const __m256i low = _mm256_set1_epi8(0x0F);
+    __m256i res = _mm256_set1_epi8((char)0xFF);
+    for (uint32_t k = 0; k < ac->fp_len; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + k));
+        __m256i lo = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)ac->lo[k]), _mm256_and_si256(v, low));
+        __m256i hi = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)ac->hi[k]),
+                                         _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+        res = _mm256_and_si256(res, _mm256_and_si256(lo, hi));
+    }
+    return res;
+}
+#endif
+
+static int ac_range(const short_index_t *s, uint32_t first, uint32_t end_id, void *arg, id_list_t *hits) {
+    const ac_select_t *sel = arg;
+    const ac_automaton_t *ac = sel->ac;
+    const char *names = s->names;
+    uint32_t id = first;
+
+#ifdef __AVX2__
+    // Names without a candidate position match no positive literal; skip them unseen
+    if (ac->teddy) {
+        size_t end = s->name_offsets[end_id];
+        size_t i = s->name_offsets[id];
+        const __m256i zero = _mm256_setzero_si256();
+        while (id < end_id && i + ac->fp_len - 1 + 32 <= end) {
+            __m256i buckets = teddy_block(ac, (const unsigned char*)names + i);
+            uint32_t mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(buckets, zero));
+            if (!mask) {
+                i += 32;
+                continue;
+            }
+            size_t pos = i + __builtin_ctz(mask);
+            while (s->name_offsets[id + 1] <= pos) id++;
+            if (ac_select(sel, names + s->name_offsets[id]) && id_list_push(hits, id) != 0) return -ENOMEM;
+            i = s->name_offsets[++id];
+        }
+        while (id < end_id && s->name_offsets[id + 1] <= i) id++;
+    }
+#endif
+
+    // Tail, large literal sets and non-AVX2 builds: the automaton alone
+    for (; id < end_id; id++) {
+        if (ac_select(sel, names + s->name_offsets[id]) && id_list_push(hits, id) != 0) return -ENOMEM;
+    }
+    return 0;
+}
+
+/* Ids, ascending, of indexed names in range the literal set selects */
+int ac_scan_names(const short_index_t *s, id_range_t range, const ac_select_t *sel,
+                  file_id_t **ids, uint32_t *num_ids) {
+    return scan_parallel(s, range, AC_PARALLEL_BYTES, ac_range, (void*)sel, ids, num_ids);
+}
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+#include "qfind.h"
+#include <errno.h>
+#include <ctype.h>
+
+#define ANCHOR_MAGIC 0x0000524F48434E41ULL  // "ANCHOR"
+#define EXT_MAX 15                          // Longer "extensions" go unmapped
+
+/*
+ * Anchored queries: paths that start or end with a literal. Trigram lists
+ * for "/var/log/" or ".pdb" are long and say nothing about position, but
+ * in a sorted order every anchored match is one contiguous run found by
+ * binary search. Three orders of file ids are kept, all ASCII-folded:
+ *
+ *   by_path     ids sorted by path, for prefixes
+ *   by_suffix   ids sorted by reversed basename, for suffixes
+ *   ext_ids     ids (ascending) per extension, listed in exts by extension
+ *
+ * Like the FM-index the whole index is one blob stored in the database:
+ *
+ *   anchor_header_t | by_path | by_suffix | anchor_ext_t[num_exts] | ext_ids
+ *
+ * Keys are the paths in file_metadata, so nothing but ids is stored.
+ */
+
+typedef struct {
+    uint64_t magic;
+    uint32_t num_files;
+    uint32_t num_exts;
+    uint64_t num_ext_ids;
+    uint64_t size;
+} anchor_header_t;
+
+typedef struct {
+    char ext[EXT_MAX + 1];           // Folded, without the dot, NUL-padded
+    uint32_t first;                  // Into ext_ids
+    uint32_t num_ids;
+} anchor_ext_t;
+
+struct anchor_index {
+    const anchor_header_t *hdr;
+    const uint32_t *by_path;
+    const uint32_t *by_suffix;
+    const anchor_ext_t *exts;
+    const uint32_t *ext_ids;
+    void *owned;
+};
+
+static bool is_regex_meta(char c) {
+    return strchr(".[]()*+?{}|^$\\", c) != NULL;
+}
+
+/*
+ * Recognize an anchored pattern. As a regex: "^LIT", "LIT$" or "^LIT$"
+ * (also "^LIT.*" and ".*LIT$") where LIT has no metacharacters other
+ * than backslash-escaped ones. As a literal, locate-style globs: "*LIT"
+ * (ends with), "LIT*" (starts with) and "*LIT*", which is an unanchored
+ * substring. LIT must not be empty.
+ */
+bool anchor_parse(const char *pattern, bool regex, anchor_query_t *a) {
+    size_t len = strlen(pattern), n = 0;
+    const char *p = pattern, *end = pattern + len;
+    memset(a, 0, sizeof(*a));
+
+    if (regex) {
+        if (*p == '^') {
+            a->prefix = true;
+            p++;
+        } else if (len >= 2 && p[0] == '.' && p[1] == '*') {
+            p += 2;  // ".*LIT$" is just "LIT$"
+        }
+        // Likewise "^LIT.*", unless the dot is escaped
+        if (a->prefix && end - p >= 2 && end[-2] == '.' && end[-1] == '*') {
+            const char *q = end - 2;
+            while (q > p && q[-1] == '\\') q--;
+            if ((end - 2 - q) % 2 == 0) end -= 2;
+        }
+        for (; p < end; p++) {
+            char c = *p;
+            if (c == '$' && p == end - 1) {
+                a->suffix = true;
+                break;
+            }
+            if (c == '\\') {
+                // Escaped letters and digits are classes or back-references
+                if (++p == end || isalnum((unsigned char)*p)) return false;
+                c = *p;
+            } else if (is_regex_meta(c)) {
+                return false;
+            }
+            if (n == sizeof(a->literal) - 1) return false;
+            a->literal[n++] = c;
+        }
+        if (!a->prefix && !a->suffix) return false;
+    } else {
+        bool lead = len > 1 && p[0] == '*', trail = len > 1 && end[-1] == '*';
+        if (!lead && !trail) return false;
+        p += lead;
+        end -= trail;
+        if (end <= p || end - p >= (ptrdiff_t)sizeof(a->literal)) return false;
+        for (const char *q = p; q < end; q++) {
+            if (*q == '*' || *q == '?' || *q == '[') return false;
+        }
+        n = end - p;
+        memcpy(a->literal, p, n);
+        a->prefix = trail && !lead;
+        a->suffix = lead && !trail;
+    }
+    a->literal[n] = '\0';
+    a->len = n;
+    return n > 0;
+}
+
+/* The anchored query as an equivalent POSIX extended regex */
+void anchor_to_regex(const anchor_query_t *a, char *out, size_t out_len) {
+    size_t n = 0;
+    if (a->prefix && n + 1 < out_len) out[n++] = '^';
+    for (size_t i = 0; i < a->len && n + 2 < out_len; i++) {
+        if (is_regex_meta(a->literal[i])) out[n++] = '\\';
+        out[n++] = a->literal[i];
+    }
+    if (a->suffix && n + 1 < out_len) out[n++] = '$';
+    out[n] = '\0';
+}
+
+/* Check a path (or its basename) against an anchored query */
+bool anchor_matches(const anchor_query_t *a, const char *path, bool case_sensitive, bool basename) {
+    const char *text = basename ? path_basename(path) : path;
+    size_t len = strlen(text);
+    if (len < a->len || (a->prefix && a->suffix && len != a->len)) return false;
+    const char *at = a->prefix ? text : text + len - a->len;
+    return case_sensitive ? memcmp(at, a->literal, a->len) == 0
+                          : strncasecmp(at, a->literal, a->len) == 0;
+}
+
+int anchor_index_attach(qfind_index_t *index, const void *blob, size_t size, bool owned) {
+    const anchor_header_t *h = blob;
+    if (size < sizeof(*h) || h->magic != ANCHOR_MAGIC || h->size != size ||
+        size < sizeof(*h) + (uint64_t)h->num_files * 2 * sizeof(uint32_t) +
+               (uint64_t)h->num_exts * sizeof(anchor_ext_t) + h->num_ext_ids * sizeof(uint32_t))
+        return -EINVAL;
+
+    anchor_index_t *ai = calloc(1, sizeof(anchor_index_t));
+    if (!ai) return -ENOMEM;
+    ai->hdr = h;
+    ai->by_path = (const uint32_t*)(h + 1);
+    ai->by_suffix = ai->by_path + h->num_files;
+    ai->exts = (const anchor_ext_t*)(ai->by_suffix + h->num_files);
+    ai->ext_ids = (const uint32_t*)(ai->exts + h->num_exts);
+    ai->owned = owned ? (void*)blob : NULL;
+
+    anchor_index_free(index);
+    index->anchors = ai;
+    return 0;
+}
+
+void anchor_index_free(qfind_index_t *index) {
+    if (!index->anchors) return;
+    free(index->anchors->owned);
+    free(index->anchors);
+    index->anchors = NULL;
+}
+
+const void *anchor_index_blob(const anchor_index_t *ai, size_t *size) {
+    *size = ai->hdr->size;
+    return ai->hdr;
+}
+
+uint32_t anchor_index_num_files(const anchor_index_t *ai) {
+    return ai->hdr->num_files;
+}
+
+/* Folded comparison of at most n bytes; a string ending first sorts first */
+static int fold_cmp(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        int x = fold_ascii((unsigned char)a[i]), y = fold_ascii((unsigned char)b[i]);
+        if (x != y || !x) return x - y;
+    }
+    return 0;
+}
+
+/* Folded comparison of a and b read backwards from their ends, at most n bytes */
+static int fold_cmp_reversed(const char *a, size_t alen, const char *b, size_t blen, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (i == alen || i == blen) return (i < alen) - (i < blen);
+        int x = fold_ascii((unsigned char)a[alen - 1 - i]), y = fold_ascii((unsigned char)b[blen - 1 - i]);
+        if (x != y) return x - y;
+    }
+    return 0;
+}
+
+/* Folded extension of a path's basename, without the dot; false when it has none worth mapping */
+static bool path_extension(const char *path, char ext[EXT_MAX + 1]) {
+    const char *dot = strrchr(path_basename(path), '.');
+    if (!dot || !dot[1] || strlen(dot + 1) > EXT_MAX) return false;
+    memset(ext, 0, EXT_MAX + 1);
+    for (size_t i = 0; dot[1 + i]; i++) ext[i] = fold_ascii((unsigned char)dot[1 + i]);
+    return true;
+}
+
+static int compare_by_path(const void *a, const void *b, void *arg) {
+    const file_metadata_t *meta = arg;
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    int c = fold_cmp(meta[x].path, meta[y].path, SIZE_MAX);
+    return c ? c : (x > y) - (x < y);
+}
+
+static int compare_by_suffix(const void *a, const void *b, void *arg) {
+    const file_metadata_t *meta = arg;
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    const char *bx = path_basename(meta[x].path), *by = path_basename(meta[y].path);
+    int c = fold_cmp_reversed(bx, strlen(bx), by, strlen(by), SIZE_MAX);
+    return c ? c : (x > y) - (x < y);
+}
+
+/* Extension, then id; ids without an extension come last */
+static int compare_by_ext(const void *a, const void *b, void *arg) {
+    const file_metadata_t *meta = arg;
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    char ex[EXT_MAX + 1], ey[EXT_MAX + 1];
+    bool hx = path_extension(meta[x].path, ex), hy = path_extension(meta[y].path, ey);
+    if (hx != hy) return hx ? -1 : 1;
+    int c = hx ? memcmp(ex, ey, sizeof(ex)) : 0;
+    return c ? c : (x > y) - (x < y);
+}
+
+/* Build from the current metadata; caller holds index_lock for writing */
+int anchor_index_build(qfind_index_t *index) {
+    uint32_t n = index->num_files;
+    file_metadata_t *meta = index->file_metadata;
+    uint32_t *by_path = malloc(((size_t)n + 1) * sizeof(uint32_t));
+    uint32_t *by_suffix = malloc(((size_t)n + 1) * sizeof(uint32_t));
+    uint32_t *by_ext = malloc(((size_t)n + 1) * sizeof(uint32_t));
+    if (!by_path || !by_suffix || !by_ext) goto oom;
+
+    for (uint32_t id = 0; id < n; id++) by_path[id] = by_suffix[id] = by_ext[id] = id;
+    qsort_r(by_path, n, sizeof(uint32_t), compare_by_path, meta);
+    qsort_r(by_suffix, n, sizeof(uint32_t), compare_by_suffix, meta);
+    qsort_r(by_ext, n, sizeof(uint32_t), compare_by_ext, meta);
+
+    // by_ext is grouped by extension; count the groups and the ids in them
+    uint32_t num_exts = 0, num_ext_ids = 0;
+    char ext[EXT_MAX + 1], prev[EXT_MAX + 1];
+    for (uint32_t i = 0; i < n && path_extension(meta[by_ext[i]].path, ext); i++) {
+        if (i == 0 || memcmp(ext, prev, sizeof(ext)) != 0) num_exts++;
+        memcpy(prev, ext, sizeof(ext));
+        num_ext_ids++;
+    }
+
+    uint64_t size = sizeof(anchor_header_t) + (uint64_t)n * 2 * sizeof(uint32_t) +
+                    (uint64_t)num_exts * sizeof(anchor_ext_t) + (uint64_t)num_ext_ids * sizeof(uint32_t);
+    size = (size + 7) & ~7ULL;
+    uint8_t *blob = calloc(1, size);
+    if (!blob) goto oom;
+
+    anchor_header_t h = { ANCHOR_MAGIC, n, num_exts, num_ext_ids, size };
+    memcpy(blob, &h, sizeof(h));
+    uint32_t *out = (uint32_t*)(blob + sizeof(h));
+    memcpy(out, by_path, (size_t)n * sizeof(uint32_t));
+    memcpy(out + n, by_suffix, (size_t)n * sizeof(uint32_t));
+    anchor_ext_t *exts = (anchor_ext_t*)(out + 2 * (size_t)n);
+    uint32_t *ext_ids = (uint32_t*)(exts + num_exts);
+
+    uint32_t e = 0;
+    for (uint32_t i = 0; i < num_ext_ids; i++) {
+        path_extension(meta[by_ext[i]].path, ext);
+        if (i == 0 || memcmp(ext, exts[e - 1].ext, sizeof(ext)) != 0) {
+            memcpy(exts[e].ext, ext, sizeof(ext));
+            exts[e++].first = i;
+        }
+        exts[e - 1].num_ids++;
+        ext_ids[i] = by_ext[i];
+    }
+    free(by_path);
+    free(by_suffix);
+    free(by_ext);
+
+    int ret = anchor_index_attach(index, blob, size, true);
+    if (ret != 0) free(blob);
+    return ret;
+
+oom:
+    free(by_path);
+    free(by_suffix);
+    free(by_ext);
+    return -ENOMEM;
+}
+
+/*
+ * Order position i's path. Rows deleted since the build have an empty
+ * path and take their successor's key, which keeps the order monotonic;
+ * NULL past the end.
+ */
+static const char *key_at(const qfind_index_t *index, const uint32_t *order, uint32_t i, uint32_t n) {
+    for (; i < n; i++) {
+        const char *path = index->file_metadata[order[i]].path;
+        if (path[0]) return path;
+    }
+    return NULL;
+}
+
+static int compare_key(const char *path, const char *key, size_t key_len, bool reversed) {
+    if (!path) return 1;
+    if (!reversed) return fold_cmp(path, key, key_len);
+    const char *base = path_basename(path);
+    return fold_cmp_reversed(base, strlen(base), key, key_len, key_len);
+}
+
+/* [lo, hi) of order positions whose key starts with key (ends with it, if reversed) */
+static void order_range(const qfind_index_t *index, const uint32_t *order, const char *key, size_t key_len,
+                        bool reversed, uint32_t *lo_out, uint32_t *hi_out) {
+    uint32_t n = index->anchors->hdr->num_files;
+    uint32_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (compare_key(key_at(index, order, mid, n), key, key_len, reversed) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *lo_out = lo;
+    hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (compare_key(key_at(index, order, mid, n), key, key_len, reversed) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    *hi_out = lo;
+}
+
+static int compare_ext(const void *key, const void *elem) {
+    return memcmp(key, ((const anchor_ext_t*)elem)->ext, EXT_MAX + 1);
+}
+
+/*
+ * The run of ids that can match the anchored query: its start, length
+ * and whether it is in id order. False when the index cannot answer the
+ * query (a basename prefix). Ids are candidates: check anchor_matches().
+ */
+bool anchor_index_range(const qfind_index_t *index, const anchor_query_t *a, bool basename,
+                        const uint32_t **ids, uint32_t *num_ids, bool *ascending) {
+    const anchor_index_t *ai = index->anchors;
+    uint32_t lo, hi;
+    *ids = NULL;
+    *num_ids = 0;
+    *ascending = false;
+
+    if (!basename && a->prefix) {
+        order_range(index, ai->by_path, a->literal, a->len, false, &lo, &hi);
+        *ids = ai->by_path + lo;
+        *num_ids = hi - lo;
+        return true;
+    }
+    if (!a->suffix || (basename && memchr(a->literal, '/', a->len))) return false;
+
+    // ".ext": exactly the files with that extension, already in id order
+    const char *key = a->literal;
+    size_t key_len = a->len;
+    if (!a->prefix && key[0] == '.' && key_len >= 2 && key_len - 1 <= EXT_MAX &&
+        !memchr(key + 1, '.', key_len - 1) && !memchr(key + 1, '/', key_len - 1)) {
+        char ext[EXT_MAX + 1] = {0};
+        for (size_t i = 1; i < key_len; i++) ext[i - 1] = fold_ascii((unsigned char)key[i]);
+        const anchor_ext_t *e = bsearch(ext, ai->exts, ai->hdr->num_exts, sizeof(anchor_ext_t), compare_ext);
+        if (e) {
+            *ids = ai->ext_ids + e->first;
+            *num_ids = e->num_ids;
+        }
+        *ascending = true;
+        return true;
+    }
+
+    // Only the part after the last '/' is in the basename
+    const char *slash = memrchr(key, '/', key_len);
+    if (slash) {
+        key_len -= slash + 1 - key;
+        key = slash + 1;
+        if (key_len == 0) return true;  // Files never end in '/'
+    }
+    order_range(index, ai->by_suffix, key, key_len, true, &lo, &hi);
+    *ids = ai->by_suffix + lo;
+    *num_ids = hi - lo;
+    return true;
+}
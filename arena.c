@@ -0,0 +1,84 @@
+#include "qfind.h"
+#include <errno.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+#define ARENA_DEFAULT_CHUNK (4UL << 20)
+
+/* Header at the start of every chunk mapping */
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+};
+
+static size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) & ~(align - 1);
+}
+
+/*
+ * Map size bytes (rounded to whole huge pages), preferring explicit huge
+ * pages and falling back to transparent ones. Memory is zeroed.
+ */
+void *huge_map(size_t size) {
+    size = round_up(size, HUGE_PAGE_SIZE);
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) return p;
+
+    p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return NULL;
+    madvise(p, size, MADV_HUGEPAGE);
+    return p;
+}
+
+void huge_unmap(void *p, size_t size) {
+    if (p) munmap(p, round_up(size, HUGE_PAGE_SIZE));
+}
+
+void arena_init(arena_t *a, size_t chunk_size) {
+    memset(a, 0, sizeof(*a));
+    a->chunk_size = round_up(chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK, HUGE_PAGE_SIZE);
+}
+
+static int arena_grow(arena_t *a, size_t need) {
+    size_t size = MAX(a->chunk_size, round_up(need + sizeof(arena_chunk_t), HUGE_PAGE_SIZE));
+    arena_chunk_t *chunk = huge_map(size);
+    if (!chunk) return -ENOMEM;
+
+    chunk->next = a->chunks;
+    chunk->size = size;
+    a->chunks = chunk;
+    a->cur = (uint8_t*)(chunk + 1);
+    a->end = (uint8_t*)chunk + size;
+    a->mapped += size;
+    return 0;
+}
+
+/* Bump-allocate zeroed memory; align must be a power of two */
+void *arena_alloc(arena_t *a, size_t size, size_t align) {
+    uintptr_t p = round_up((uintptr_t)a->cur, align);
+    if (!a->cur || p + size > (uintptr_t)a->end) {
+        if (arena_grow(a, size + align) != 0) return NULL;
+        p = round_up((uintptr_t)a->cur, align);
+    }
+    a->cur = (uint8_t*)(p + size);
+    return (void*)p;
+}
+
+char *arena_strdup(arena_t *a, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = arena_alloc(a, len, 1);
+    if (copy) memcpy(copy, s, len);
+    return copy;
+}
+
+/* Unmap every chunk at once; nothing allocated from the arena survives */
+void arena_destroy(arena_t *a) {
+    arena_chunk_t *chunk = a->chunks;
+    while (chunk) {
+        arena_chunk_t *next = chunk->next;
+        munmap(chunk, chunk->size);
+        chunk = next;
+    }
+    arena_init(a, a->chunk_size);
+}
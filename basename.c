@@ -0,0 +1,294 @@
+#define _GNU_SOURCE
+#include "qfind.h"
+#include <errno.h>
+#include <regex.h>
+
+#define BASENAME_MAGIC 0x454D414E45534142ULL  // "BASENAME"
+#define TRIGRAM_SPACE (1u << 24)
+#define BASENAME_PARALLEL_BYTES (1 << 20)
+#define BASENAME_MAX_TRIGRAMS NAME_MAX  // A component has at most NAME_MAX - 2
+
+/*
+ * Trigram index over basenames only. Directory names such as "usr" or
+ * "lib" occur in the path of almost every file but in few basenames, so
+ * name queries intersect far shorter lists here than in the full-path
+ * index. Lists are varint id deltas, small enough to keep uncompressed;
+ * like the FM-index the whole index is one blob stored in the database.
+ *
+ *   basename_header_t | basename_entry_t[num_trigrams] (by trigram) | deltas
+ */
+
+typedef struct {
+    uint64_t magic;
+    uint32_t num_files;
+    uint32_t num_trigrams;
+    uint64_t data_offset;
+    uint64_t size;
+} basename_header_t;
+
+typedef struct {
+    trigram_t trigram;
+    uint32_t num_ids;
+    uint64_t offset;                 // Into the delta area
+} basename_entry_t;
+
+struct basename_index {
+    const basename_header_t *hdr;
+    const basename_entry_t *entries;
+    const uint8_t *data;
+    void *owned;
+};
+
+/* The last component of path */
+const char *path_basename(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int compare_trigrams(const void *a, const void *b) {
+    trigram_t x = *(const trigram_t*)a, y = *(const trigram_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Distinct folded trigrams of one basename */
+static size_t basename_trigrams(const char *path, trigram_t *out) {
+    size_t n;
+    extract_trigrams(path_basename(path), out, &n, BASENAME_MAX_TRIGRAMS);
+    qsort(out, n, sizeof(trigram_t), compare_trigrams);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kept == 0 || out[kept - 1] != out[i]) out[kept++] = out[i];
+    }
+    return kept;
+}
+
+static size_t put_varint(uint8_t *p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static uint32_t get_varint(const uint8_t **p) {
+    uint32_t v = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = *(*p)++;
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return v;
+}
+
+int basename_index_attach(qfind_index_t *index, const void *blob, size_t size, bool owned) {
+    const basename_header_t *h = blob;
+    if (size < sizeof(*h) || h->magic != BASENAME_MAGIC || h->size != size ||
+        h->data_offset < sizeof(*h) + (uint64_t)h->num_trigrams * sizeof(basename_entry_t))
+        return -EINVAL;
+
+    basename_index_t *bi = calloc(1, sizeof(basename_index_t));
+    if (!bi) return -ENOMEM;
+    bi->hdr = h;
+    bi->entries = (const basename_entry_t*)(h + 1);
+    bi->data = (const uint8_t*)blob + h->data_offset;
+    bi->owned = owned ? (void*)blob : NULL;
+
+    basename_index_free(index);
+    index->base_idx = bi;
+    return 0;
+}
+
+void basename_index_free(qfind_index_t *index) {
+    if (!index->base_idx) return;
+    free(index->base_idx->owned);
+    free(index->base_idx);
+    index->base_idx = NULL;
+}
+
+const void *basename_index_blob(const basename_index_t *bi, size_t *size) {
+    *size = bi->hdr->size;
+    return bi->hdr;
+}
+
+uint32_t basename_index_num_files(const basename_index_t *bi) {
+    return bi->hdr->num_files;
+}
+
+/*
+ * Build from the current metadata; caller holds index_lock for writing.
+ * Two passes over the basenames fill a CSR table indexed by trigram, so
+ * lists come out in id order without sorting postings.
+ */
+int basename_index_build(qfind_index_t *index) {
+    uint32_t *cursor = calloc(TRIGRAM_SPACE, sizeof(uint32_t));
+    if (!cursor) return -ENOMEM;
+
+    trigram_t tri[BASENAME_MAX_TRIGRAMS];
+    uint64_t total = 0;
+    for (uint32_t id = 0; id < index->num_files; id++) {
+        size_t n = basename_trigrams(index->file_metadata[id].path, tri);
+        for (size_t i = 0; i < n; i++) cursor[tri[i]]++;
+        total += n;
+    }
+    if (total >= UINT32_MAX) {
+        free(cursor);
+        return -EFBIG;
+    }
+
+    // Exclusive prefix sums; after the fill cursor[t] is where t's list ends
+    uint32_t num_trigrams = 0, sum = 0;
+    for (uint32_t t = 0; t < TRIGRAM_SPACE; t++) {
+        uint32_t count = cursor[t];
+        num_trigrams += count > 0;
+        cursor[t] = sum;
+        sum += count;
+    }
+
+    uint32_t *postings = malloc((total ? total : 1) * sizeof(uint32_t));
+    uint8_t *deltas = malloc(total * 5 + 1);
+    if (!postings || !deltas) {
+        free(cursor);
+        free(postings);
+        free(deltas);
+        return -ENOMEM;
+    }
+    for (uint32_t id = 0; id < index->num_files; id++) {
+        size_t n = basename_trigrams(index->file_metadata[id].path, tri);
+        for (size_t i = 0; i < n; i++) postings[cursor[tri[i]]++] = id;
+    }
+
+    uint64_t data_offset = sizeof(basename_header_t) + (uint64_t)num_trigrams * sizeof(basename_entry_t);
+    basename_entry_t *entries = malloc((num_trigrams ? num_trigrams : 1) * sizeof(basename_entry_t));
+    size_t data_size = 0;
+    uint32_t e = 0, start = 0;
+    for (uint32_t t = 0; entries && t < TRIGRAM_SPACE; t++) {
+        uint32_t end = cursor[t];
+        if (end == start) continue;
+        entries[e++] = (basename_entry_t){ t, end - start, data_size };
+        uint32_t prev = 0;
+        for (uint32_t i = start; i < end; i++) {
+            data_size += put_varint(deltas + data_size, postings[i] - prev);
+            prev = postings[i];
+        }
+        start = end;
+    }
+    free(cursor);
+    free(postings);
+
+    uint64_t size = (data_offset + data_size + 7) & ~7ULL;
+    uint8_t *blob = entries ? calloc(1, size) : NULL;
+    if (!blob) {
+        free(entries);
+        free(deltas);
+        return -ENOMEM;
+    }
+    basename_header_t h = { BASENAME_MAGIC, index->num_files, num_trigrams, data_offset, size };
+    memcpy(blob, &h, sizeof(h));
+    memcpy(blob + sizeof(h), entries, (size_t)num_trigrams * sizeof(basename_entry_t));
+    memcpy(blob + data_offset, deltas, data_size);
+    free(entries);
+    free(deltas);
+
+    int ret = basename_index_attach(index, blob, size, true);
+    if (ret != 0) free(blob);
+    return ret;
+}
+
+static int compare_entry(const void *key, const void *elem) {
+    trigram_t t = *(const trigram_t*)key, e = ((const basename_entry_t*)elem)->trigram;
+    return (t > e) - (t < e);
+}
+
+static int compare_entry_size(const void *a, const void *b) {
+    uint32_t x = (*(const basename_entry_t**)a)->num_ids, y = (*(const basename_entry_t**)b)->num_ids;
+    return (x > y) - (x < y);
+}
+
+/* Files whose basename contains trigram; 0 when none does */
+uint32_t basename_index_list_size(const basename_index_t *bi, trigram_t trigram) {
+    const basename_entry_t *e = bsearch(&trigram, bi->entries, bi->hdr->num_trigrams,
+                                        sizeof(basename_entry_t), compare_entry);
+    return e ? e->num_ids : 0;
+}
+
+/*
+ * Ids, ascending, of files whose basename has every trigram of the
+ * (3+ byte) pattern. Candidates only: the caller verifies the match.
+ */
+int basename_index_search(const basename_index_t *bi, const char *pattern, file_id_t **ids, uint32_t *num_ids) {
+    static __thread trigram_t tri[MAX_QUERY_TRIGRAMS];
+    static __thread const basename_entry_t *lists[MAX_QUERY_TRIGRAMS];
+    size_t n;
+    *ids = NULL;
+    *num_ids = 0;
+    extract_trigrams(pattern, tri, &n, MAX_QUERY_TRIGRAMS);
+    if (n == 0) return -EINVAL;
+
+    for (size_t i = 0; i < n; i++) {
+        lists[i] = bsearch(&tri[i], bi->entries, bi->hdr->num_trigrams, sizeof(basename_entry_t), compare_entry);
+        if (!lists[i]) return 0;
+    }
+    qsort(lists, n, sizeof(lists[0]), compare_entry_size);
+
+    // Decode the shortest list, then keep ids present in each longer one
+    file_id_t *cand = malloc((lists[0]->num_ids ? lists[0]->num_ids : 1) * sizeof(file_id_t));
+    if (!cand) return -ENOMEM;
+    const uint8_t *p = bi->data + lists[0]->offset;
+    uint32_t id = 0, count = lists[0]->num_ids;
+    for (uint32_t i = 0; i < count; i++) cand[i] = id += get_varint(&p);
+
+    for (size_t l = 1; l < n && count > 0; l++) {
+        if (lists[l] == lists[l - 1]) continue;
+        p = bi->data + lists[l]->offset;
+        uint32_t remaining = lists[l]->num_ids, kept = 0, cur = get_varint(&p);
+        remaining--;
+        for (uint32_t i = 0; i < count; i++) {
+            while (cur < cand[i] && remaining > 0) {
+                cur += get_varint(&p);
+                remaining--;
+            }
+            if (cur == cand[i]) cand[kept++] = cand[i];
+        }
+        count = kept;
+    }
+
+    *ids = cand;
+    *num_ids = count;
+    return 0;
+}
+
+/* What basename_scan() looks for */
+typedef struct {
+    const char *pattern;
+    bool case_sensitive;
+    bool regex;
+} basename_query_t;
+
+static int basename_range(const short_index_t *s, uint32_t first, uint32_t end, void *arg, id_list_t *hits) {
+    const basename_query_t *q = arg;
+    regex_t re;
+    if (q->regex) {
+        int flags = REG_EXTENDED | REG_NOSUB | (q->case_sensitive ? 0 : REG_ICASE);
+        if (regcomp(&re, q->pattern, flags) != 0) return -EINVAL;
+    }
+
+    int ret = 0;
+    for (uint32_t id = first; id < end && ret == 0; id++) {
+        const char *base = path_basename(s->names + s->name_offsets[id]);
+        bool match = q->regex ? regexec(&re, base, 0, NULL, 0) == 0
+                   : q->case_sensitive ? strstr(base, q->pattern) != NULL
+                   : strcasestr(base, q->pattern) != NULL;
+        if (match) ret = id_list_push(hits, id);
+    }
+    if (q->regex) regfree(&re);
+    return ret;
+}
+
+/* Ids, ascending, of indexed files in range whose basename matches; the fallback without an index */
+int basename_scan(const short_index_t *s, id_range_t range, const char *pattern, bool case_sensitive,
+                  bool regex, file_id_t **ids, uint32_t *num_ids) {
+    basename_query_t q = { pattern, case_sensitive, regex };
+    return scan_parallel(s, range, BASENAME_PARALLEL_BYTES, basename_range, &q, ids, num_ids);
+}
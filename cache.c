@@ -0,0 +1,208 @@
+#include "qfind.h"
+#include <errno.h>
+
+#define CACHE_SHARDS 16              // Independent locks; keys are spread by hash
+#define CACHE_ADMIT_SHARE 4          // Objects over 1/4 of the budget are never cached
+
+/*
+ * A bounded map from 64-bit keys to refcounted objects, shared by
+ * concurrent queries. Keys hash to one of CACHE_SHARDS shards, each a
+ * small slot array under its own spinlock, so lookups of different keys
+ * rarely contend and a lock is held for a scan of a few dozen keys only.
+ * Eviction is CLOCK: a hit sets the slot's reference bit, and the hand
+ * clears bits until it finds an unreferenced slot. The byte budget is
+ * shared by all shards; an insert evicts from its own shard until the
+ * total fits. Readers hold their own reference, so an evicted object
+ * lives until its last reader drops it.
+ */
+
+typedef struct {
+    pthread_spinlock_t lock;
+    uint64_t *keys;
+    cache_obj_t **objs;              // NULL for an empty slot
+    uint8_t *referenced;
+    uint32_t cap;
+    uint32_t n;
+    uint32_t hand;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+} __attribute__((aligned(64))) cache_shard_t;
+
+struct shared_cache {
+    cache_shard_t shards[CACHE_SHARDS];
+    size_t max_bytes;
+    _Atomic size_t bytes;
+};
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+}
+
+static cache_shard_t *shard_of(shared_cache_t *c, uint64_t key) {
+    return &c->shards[mix64(key) % CACHE_SHARDS];
+}
+
+void cache_obj_unref(cache_obj_t *obj) {
+    if (obj && atomic_fetch_sub(&obj->refs, 1) == 1) obj->release(obj);
+}
+
+static void release_chain(cache_obj_t *victims) {
+    while (victims) {
+        cache_obj_t *next = victims->next;
+        cache_obj_unref(victims);
+        victims = next;
+    }
+}
+
+/* Cache of at most max_entries objects and max_bytes bytes; NULL on failure */
+shared_cache_t *shared_cache_create(uint32_t max_entries, size_t max_bytes) {
+    shared_cache_t *c = aligned_alloc(64, sizeof(shared_cache_t));
+    if (!c) return NULL;
+    memset(c, 0, sizeof(*c));
+    c->max_bytes = max_bytes;
+
+    uint32_t cap = MAX(max_entries / CACHE_SHARDS, 1);
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *s = &c->shards[i];
+        pthread_spin_init(&s->lock, PTHREAD_PROCESS_PRIVATE);
+        s->cap = cap;
+        s->keys = calloc(cap, sizeof(uint64_t));
+        s->objs = calloc(cap, sizeof(cache_obj_t*));
+        s->referenced = calloc(cap, 1);
+        if (!s->keys || !s->objs || !s->referenced) {
+            shared_cache_destroy(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+void shared_cache_destroy(shared_cache_t *c) {
+    if (!c) return;
+    shared_cache_clear(c);
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *s = &c->shards[i];
+        free(s->keys);
+        free(s->objs);
+        free(s->referenced);
+        pthread_spin_destroy(&s->lock);
+    }
+    free(c);
+}
+
+/* The object cached under key with a reference the caller drops, or NULL */
+cache_obj_t *shared_cache_get(shared_cache_t *c, uint64_t key) {
+    if (!c) return NULL;
+    cache_shard_t *s = shard_of(c, key);
+    cache_obj_t *obj = NULL;
+
+    pthread_spin_lock(&s->lock);
+    for (uint32_t i = 0; i < s->cap; i++) {
+        if (s->objs[i] && s->keys[i] == key) {
+            obj = s->objs[i];
+            s->referenced[i] = 1;
+            atomic_fetch_add(&obj->refs, 1);
+            break;
+        }
+    }
+    pthread_spin_unlock(&s->lock);
+
+    atomic_fetch_add_explicit(obj ? &s->hits : &s->misses, 1, memory_order_relaxed);
+    return obj;
+}
+
+/* Empty slot i of s, chaining its object onto *victims; caller holds s->lock */
+static void take_slot(shared_cache_t *c, cache_shard_t *s, uint32_t i, cache_obj_t **victims) {
+    cache_obj_t *obj = s->objs[i];
+    atomic_fetch_sub(&c->bytes, obj->bytes);
+    obj->next = *victims;
+    *victims = obj;
+    s->objs[i] = NULL;
+    s->n--;
+}
+
+static void evict_one(shared_cache_t *c, cache_shard_t *s, cache_obj_t **victims) {
+    for (;;) {
+        uint32_t i = s->hand;
+        s->hand = (s->hand + 1) % s->cap;
+        if (!s->objs[i]) continue;
+        if (s->referenced[i]) {
+            s->referenced[i] = 0;
+            continue;
+        }
+        take_slot(c, s, i, victims);
+        return;
+    }
+}
+
+/* Cache obj under key, replacing any object already there; the cache takes its own reference */
+void shared_cache_put(shared_cache_t *c, uint64_t key, cache_obj_t *obj) {
+    if (!c || obj->bytes > c->max_bytes / CACHE_ADMIT_SHARE) return;
+    cache_shard_t *s = shard_of(c, key);
+    cache_obj_t *victims = NULL;
+    atomic_fetch_add(&obj->refs, 1);
+
+    pthread_spin_lock(&s->lock);
+    for (uint32_t i = 0; i < s->cap; i++) {
+        if (s->objs[i] && s->keys[i] == key) take_slot(c, s, i, &victims);
+    }
+    // Other shards may briefly overshoot the budget; they trim on their next insert
+    while (s->n == s->cap || (s->n > 0 && atomic_load(&c->bytes) + obj->bytes > c->max_bytes))
+        evict_one(c, s, &victims);
+
+    uint32_t slot = 0;
+    while (s->objs[slot]) slot++;
+    s->keys[slot] = key;
+    s->objs[slot] = obj;
+    s->referenced[slot] = 1;
+    s->n++;
+    atomic_fetch_add(&c->bytes, obj->bytes);
+    pthread_spin_unlock(&s->lock);
+
+    release_chain(victims);
+}
+
+/* Drop every object; readers keep theirs until they let go */
+void shared_cache_clear(shared_cache_t *c) {
+    if (!c) return;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *s = &c->shards[i];
+        cache_obj_t *victims = NULL;
+        pthread_spin_lock(&s->lock);
+        for (uint32_t j = 0; j < s->cap; j++) {
+            if (s->objs[j]) take_slot(c, s, j, &victims);
+        }
+        s->hand = 0;
+        pthread_spin_unlock(&s->lock);
+        release_chain(victims);
+    }
+}
+
+void shared_cache_stats(shared_cache_t *c, cache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!c) return;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cache_shard_t *s = &c->shards[i];
+        stats->hits += atomic_load_explicit(&s->hits, memory_order_relaxed);
+        stats->misses += atomic_load_explicit(&s->misses, memory_order_relaxed);
+        pthread_spin_lock(&s->lock);
+        stats->entries += s->n;
+        pthread_spin_unlock(&s->lock);
+    }
+    stats->bytes = atomic_load(&c->bytes);
+}
+
+/*
+ * Note that query results may have changed: files were added, removed,
+ * renamed or had attributes refreshed. Cached results carry the epoch
+ * they were computed at and stop matching. With postings set the posting
+ * lists were replaced as well, and decoded copies are dropped.
+ */
+void index_changed(qfind_index_t *index, bool postings) {
+    atomic_fetch_add(&index->epoch, 1);
+    if (postings) shared_cache_clear(index->list_cache);
+}
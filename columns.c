@@ -0,0 +1,188 @@
+#include "qfind.h"
+#include <errno.h>
+#include <immintrin.h>
+
+#define META_SAMPLE_ROWS 1024        // Rows meta_filter_sample() checks
+#define SIGN_BIT (1ULL << 63)
+
+/*
+ * File attributes as one array per attribute, indexed by file id. A
+ * filter such as --size or --newer reads only the columns it tests, 64
+ * files per step: each predicate yields a bit mask for the step (AVX2
+ * compares, four 64-bit or eight 32-bit values at a time) and the masks
+ * are ANDed, so rows failing an early predicate cost no further loads.
+ */
+
+int meta_columns_reserve(meta_columns_t *c, size_t capacity) {
+#define GROW(col) do { \
+        void *grown = realloc(c->col, capacity * sizeof(*c->col)); \
+        if (!grown) return -ENOMEM; \
+        c->col = grown; \
+    } while (0)
+    GROW(size);
+    GROW(mtime);
+    GROW(mode);
+    GROW(uid);
+    GROW(gid);
+    GROW(ino);
+#undef GROW
+    return 0;
+}
+
+void meta_columns_set(meta_columns_t *c, uint32_t id, const db_entry_t *attr) {
+    c->size[id] = attr->size;
+    c->mtime[id] = attr->mtime;
+    c->mode[id] = attr->mode;
+    c->uid[id] = attr->uid;
+    c->gid[id] = attr->gid;
+    c->ino[id] = attr->ino;
+}
+
+void meta_columns_free(meta_columns_t *c) {
+    free(c->size);
+    free(c->mtime);
+    free(c->mode);
+    free(c->uid);
+    free(c->gid);
+    free(c->ino);
+    memset(c, 0, sizeof(*c));
+}
+
+/* The attributes of attr that come from lstat() */
+void meta_entry_from_stat(db_entry_t *attr, const struct stat *st) {
+    attr->mode = st->st_mode;
+    attr->mtime = st->st_mtime;
+    attr->size = st->st_size;
+    attr->uid = st->st_uid;
+    attr->gid = st->st_gid;
+    attr->ino = st->st_ino;
+}
+
+void meta_filter_init(meta_filter_t *f) {
+    *f = (meta_filter_t){
+        .min_size = 0, .max_size = UINT64_MAX,
+        .min_mtime = INT64_MIN, .max_mtime = INT64_MAX,
+        .types = 0, .owner = META_ANY_OWNER, .active = false
+    };
+}
+
+static bool tests_size(const meta_filter_t *f) {
+    return f->min_size > 0 || f->max_size < UINT64_MAX;
+}
+
+static bool tests_mtime(const meta_filter_t *f) {
+    return f->min_mtime > INT64_MIN || f->max_mtime < INT64_MAX;
+}
+
+bool meta_filter_match(const meta_columns_t *c, const meta_filter_t *f, uint32_t id) {
+    if (!f->active) return true;
+    if (c->size[id] < f->min_size || c->size[id] > f->max_size) return false;
+    if (c->mtime[id] < f->min_mtime || c->mtime[id] > f->max_mtime) return false;
+    if (f->types && !(f->types >> ((c->mode[id] & S_IFMT) >> 12) & 1)) return false;
+    if (f->owner != META_ANY_OWNER && c->uid[id] != f->owner) return false;
+    return true;
+}
+
+/*
+ * Bit i set when lo <= col[i] <= hi, i < n <= 64. Values are compared as
+ * signed after XOR with bias: 0 for signed columns, SIGN_BIT for unsigned.
+ */
+static uint64_t range_mask(const uint64_t *col, uint32_t n, uint64_t lo, uint64_t hi, uint64_t bias) {
+    uint64_t mask = 0;
+    uint32_t i = 0;
+#ifdef __AVX2__
+    const __m256i vb = _mm256_set1_epi64x(bias);
+    const __m256i vlo = _mm256_set1_epi64x(lo ^ bias);
+    const __m256i vhi = _mm256_set1_epi64x(hi ^ bias);
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(col + i)), vb);
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(vlo, v), _mm256_cmpgt_epi64(v, vhi));
+        mask |= (uint64_t)(~_mm256_movemask_pd(_mm256_castsi256_pd(out)) & 0xF) << i;
+    }
+#endif
+    for (; i < n; i++) {
+        int64_t v = (int64_t)(col[i] ^ bias);
+        if (v >= (int64_t)(lo ^ bias) && v <= (int64_t)(hi ^ bias)) mask |= 1ULL << i;
+    }
+    return mask;
+}
+
+static uint64_t equal_mask(const uint32_t *col, uint32_t n, uint32_t value) {
+    uint64_t mask = 0;
+    uint32_t i = 0;
+#ifdef __AVX2__
+    const __m256i vv = _mm256_set1_epi32(value);
+    for (; i + 8 <= n; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(col + i)), vv);
+        mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+#endif
+    for (; i < n; i++) mask |= (uint64_t)(col[i] == value) << i;
+    return mask;
+}
+
+/* Bit i set when the file type of mode[i] is in types */
+static uint64_t type_mask(const uint32_t *mode, uint32_t n, uint32_t types) {
+    uint64_t mask = 0;
+    uint32_t i = 0;
+#ifdef __AVX2__
+    const __m256i vt = _mm256_set1_epi32(types);
+    const __m256i one = _mm256_set1_epi32(1);
+    for (; i + 8 <= n; i += 8) {
+        __m256i t = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i*)(mode + i)), 12);
+        __m256i hit = _mm256_and_si256(_mm256_srlv_epi32(vt, _mm256_and_si256(t, _mm256_set1_epi32(0xF))), one);
+        mask |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(hit, one))) << i;
+    }
+#endif
+    for (; i < n; i++) mask |= (uint64_t)(types >> ((mode[i] & S_IFMT) >> 12) & 1) << i;
+    return mask;
+}
+
+/* Files [base, base + n) passing every predicate of f, n <= 64 */
+static uint64_t block_mask(const meta_columns_t *c, const meta_filter_t *f, uint32_t base, uint32_t n) {
+    uint64_t mask = n == 64 ? ~0ULL : (1ULL << n) - 1;
+    if (tests_size(f))
+        mask &= range_mask(c->size + base, n, f->min_size, f->max_size, SIGN_BIT);
+    if (mask && tests_mtime(f))
+        mask &= range_mask((const uint64_t*)c->mtime + base, n, f->min_mtime, f->max_mtime, 0);
+    if (mask && f->types) mask &= type_mask(c->mode + base, n, f->types);
+    if (mask && f->owner != META_ANY_OWNER) mask &= equal_mask(c->uid + base, n, f->owner);
+    return mask;
+}
+
+static id_range_t clamp_range(const qfind_index_t *index, id_range_t range) {
+    range.end = MIN(range.end, index->num_files);
+    range.first = MIN(range.first, range.end);
+    return range;
+}
+
+/* Share of the files in range passing f, from an evenly strided sample; for the planner */
+double meta_filter_sample(const qfind_index_t *index, const meta_filter_t *f, id_range_t range) {
+    range = clamp_range(index, range);
+    uint32_t len = range.end - range.first;
+    if (!f->active || len == 0) return 1.0;
+
+    uint32_t stride = MAX(len / META_SAMPLE_ROWS, 1), checked = 0, passed = 0;
+    for (uint32_t id = range.first; id < range.end; id += stride, checked++)
+        passed += meta_filter_match(&index->cols, f, id);
+    return (double)passed / checked;
+}
+
+/* Ids, ascending, of files in range passing f; caller holds index_lock */
+int meta_filter_scan(const qfind_index_t *index, const meta_filter_t *f, id_range_t range,
+                     file_id_t **ids, uint32_t *num_ids) {
+    range = clamp_range(index, range);
+    id_list_t hits = {0};
+    int ret = 0;
+    for (uint32_t base = range.first; base < range.end && ret == 0; base += 64) {
+        uint64_t mask = block_mask(&index->cols, f, base, MIN(64, range.end - base));
+        for (; mask && ret == 0; mask &= mask - 1) ret = id_list_push(&hits, base + __builtin_ctzll(mask));
+    }
+    if (ret != 0) {
+        free(hits.ids);
+        return ret;
+    }
+    *ids = hits.ids;
+    *num_ids = hits.n;
+    return 0;
+}
@@ -0,0 +1,814 @@
+#include "qfind.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <stddef.h>
+#include <syslog.h>
+#include <uthash.h>
+#include <zstd.h>
+#include <zdict.h>
+
+#define DB_HEADER_SIZE 16
+#define DB_SECTION_HEADER_SIZE 16
+#define DB_SECTION_ALIGN 8
+#define DB_MAX_SECTIONS 32
+#define DB_PATH_BLOCK_SIZE INDEX_BLOCK_SIZE           // Raw bytes per compressed DIRZ block
+#define DB_PATH_DICT_CAPACITY (112 * 1024)
+#define DB_PATH_DICT_TRAIN_BYTES (8 << 20)            // Raw records buffered before training
+#define DB_PATH_SAMPLE_SIZE 4096
+#define DB_POSTINGS_HEADER_SIZE 16
+#define DB_POSTING_RECORD_SIZE 24
+
+/*
+ * Layout: header, then tagged sections, each padded to DB_SECTION_ALIGN.
+ * A section's size is its payload alone; readers skip the pad.
+ *
+ *   header   uint32 magic | uint32 version | uint32 flags | uint32 num_sections
+ *   section  uint32 tag | uint32 reserved | uint64 size | payload
+ *
+ * DB_SECTION_DIRS holds one record per directory in walk order:
+ *
+ *   uint16 path_len | path | int64 mtime_ns | int64 ctime_ns |
+ *   uint32 mode | uint32 uid | uint32 gid | uint32 num_entries
+ *   entry: uint8 type | uint16 name_len | name | uint32 mode | int64 mtime |
+ *          uint64 size | uint32 uid | uint32 gid | uint64 ino
+ *
+ * DB_SECTION_DIRS_ZSTD holds the same byte stream as a sequence of
+ * "uint32 raw_len | uint32 frame_len | zstd frame" blocks, compressed with
+ * the dictionary in DB_SECTION_PATH_DICT when there is one.
+ *
+ * DB_SECTION_POSTINGS, all little-endian, with records sorted by trigram:
+ *
+ *   uint32 num_entries | uint32 record_size | uint64 data_size |
+ *   record[num_entries] | compressed posting data
+ *   record: uint32 trigram | uint32 num_files | uint64 offset | uint32 size | uint32 zero
+ *
+ * On a little-endian host a record is an index_entry_t, so the records are
+ * used in place.
+ */
+
+_Static_assert(sizeof(index_entry_t) == DB_POSTING_RECORD_SIZE &&
+               offsetof(index_entry_t, offset) == 8 && offsetof(index_entry_t, size) == 16,
+               "index_entry_t must match the POST record");
+
+typedef struct db_dir_slot {
+    const char *path;
+    uint16_t path_len;
+    const uint8_t *record;
+    UT_hash_handle hh;
+} db_dir_slot_t;
+
+typedef struct {
+    uint32_t tag;
+    const uint8_t *data;
+    uint64_t size;
+} db_section_ref_t;
+
+struct qfind_db {
+    uint8_t *map;
+    size_t map_size;
+    db_section_ref_t sections[DB_MAX_SECTIONS];
+    uint32_t num_sections;
+    const uint8_t *dirs;             // Directory records, mapped or decompressed
+    size_t dirs_size;
+    uint8_t *dirs_buf;               // Owned decompression of DB_SECTION_DIRS_ZSTD
+    uint32_t num_dirs;
+    db_dir_slot_t *slots;            // One per directory record
+    db_dir_slot_t *by_path;          // Hash over slots
+};
+
+struct db_writer {
+    FILE *fp;
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    uint32_t num_sections;
+    off_t section_start;             // Header offset of the open section, -1 if none
+    bool dirs_done;
+    uint32_t num_dirs;
+    bool failed;
+
+    // DB_WRITE_PATH_DICT state
+    bool compress_paths;
+    uint8_t *raw;                    // Directory records not yet compressed
+    size_t raw_size;
+    size_t raw_cap;
+    bool trained;
+    void *path_dict;
+    size_t path_dict_size;
+    ZSTD_CCtx *cctx;
+    ZSTD_CDict *cdict;
+};
+
+static int64_t timespec_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/* Bounds-checked cursor over a mapped section */
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} db_cursor_t;
+
+static bool cursor_read(db_cursor_t *c, void *out, size_t len) {
+    if ((size_t)(c->end - c->p) < len) return false;
+    memcpy(out, c->p, len);
+    c->p += len;
+    return true;
+}
+
+static bool cursor_skip(db_cursor_t *c, size_t len) {
+    if ((size_t)(c->end - c->p) < len) return false;
+    c->p += len;
+    return true;
+}
+
+/* Parse the fixed part of a directory record, leaving the cursor at its entries */
+static bool read_dir_header(db_cursor_t *c, const char **path, uint16_t *path_len, db_dir_t *dir) {
+    if (!cursor_read(c, path_len, sizeof(*path_len))) return false;
+    *path = (const char*)c->p;
+    if (!cursor_skip(c, *path_len)) return false;
+    if (!cursor_read(c, &dir->mtime_ns, sizeof(dir->mtime_ns))) return false;
+    if (!cursor_read(c, &dir->ctime_ns, sizeof(dir->ctime_ns))) return false;
+    if (!cursor_read(c, &dir->mode, sizeof(dir->mode))) return false;
+    if (!cursor_read(c, &dir->uid, sizeof(dir->uid))) return false;
+    if (!cursor_read(c, &dir->gid, sizeof(dir->gid))) return false;
+    if (!cursor_read(c, &dir->num_entries, sizeof(dir->num_entries))) return false;
+    dir->cursor = c->p;
+    dir->end = c->end;
+    dir->remaining = dir->num_entries;
+    return true;
+}
+
+bool db_dir_next_entry(db_dir_t *dir, db_entry_t *entry) {
+    if (dir->remaining == 0) return false;
+
+    db_cursor_t c = { dir->cursor, dir->end };
+    if (!cursor_read(&c, &entry->type, sizeof(entry->type))) return false;
+    if (!cursor_read(&c, &entry->name_len, sizeof(entry->name_len))) return false;
+    entry->name = (const char*)c.p;
+    if (!cursor_skip(&c, entry->name_len)) return false;
+    if (!cursor_read(&c, &entry->mode, sizeof(entry->mode))) return false;
+    if (!cursor_read(&c, &entry->mtime, sizeof(entry->mtime))) return false;
+    if (!cursor_read(&c, &entry->size, sizeof(entry->size))) return false;
+    if (!cursor_read(&c, &entry->uid, sizeof(entry->uid))) return false;
+    if (!cursor_read(&c, &entry->gid, sizeof(entry->gid))) return false;
+    if (!cursor_read(&c, &entry->ino, sizeof(entry->ino))) return false;
+
+    dir->cursor = c.p;
+    dir->remaining--;
+    return true;
+}
+
+static bool skip_dir_entries(db_cursor_t *c, const db_dir_t *dir) {
+    db_dir_t it = *dir;
+    db_entry_t entry;
+    for (uint32_t i = 0; i < dir->num_entries; i++) {
+        if (!db_dir_next_entry(&it, &entry)) return false;
+    }
+    c->p = it.cursor;
+    return true;
+}
+
+const void *db_section(const qfind_db_t *db, uint32_t tag, size_t *size) {
+    for (uint32_t i = 0; i < db->num_sections; i++) {
+        if (db->sections[i].tag == tag) {
+            if (size) *size = db->sections[i].size;
+            return db->sections[i].data;
+        }
+    }
+    return NULL;
+}
+
+/* Inflate a DB_SECTION_DIRS_ZSTD stream into one owned buffer of records */
+static int inflate_dir_blocks(qfind_db_t *db, const uint8_t *data, size_t size) {
+    size_t dict_size = 0;
+    const void *dict = db_section(db, DB_SECTION_PATH_DICT, &dict_size);
+
+    uint64_t raw_total = 0;
+    db_cursor_t c = { data, data + size };
+    while (c.p < c.end) {
+        uint32_t raw_len, frame_len;
+        if (!cursor_read(&c, &raw_len, sizeof(raw_len)) ||
+            !cursor_read(&c, &frame_len, sizeof(frame_len)) ||
+            !cursor_skip(&c, frame_len)) return -EINVAL;
+        raw_total += raw_len;
+    }
+
+    db->dirs_buf = malloc(raw_total ? raw_total : 1);
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    ZSTD_DDict *ddict = dict ? ZSTD_createDDict(dict, dict_size) : NULL;
+    int ret = (!db->dirs_buf || !dctx || (dict && !ddict)) ? -ENOMEM : 0;
+
+    size_t out = 0;
+    c.p = data;
+    while (ret == 0 && c.p < c.end) {
+        uint32_t raw_len, frame_len;
+        if (!cursor_read(&c, &raw_len, sizeof(raw_len)) ||
+            !cursor_read(&c, &frame_len, sizeof(frame_len)) ||
+            frame_len > (size_t)(c.end - c.p) || raw_len > raw_total - out) {
+            ret = -EINVAL;
+            break;
+        }
+        size_t n = ddict
+            ? ZSTD_decompress_usingDDict(dctx, db->dirs_buf + out, raw_len, c.p, frame_len, ddict)
+            : ZSTD_decompressDCtx(dctx, db->dirs_buf + out, raw_len, c.p, frame_len);
+        if (ZSTD_isError(n) || n != raw_len) ret = -EINVAL;
+        out += raw_len;
+        c.p += frame_len;
+    }
+
+    ZSTD_freeDDict(ddict);
+    ZSTD_freeDCtx(dctx);
+    db->dirs = db->dirs_buf;
+    db->dirs_size = out;
+    return ret;
+}
+
+qfind_db_t *db_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < DB_HEADER_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    qfind_db_t *db = calloc(1, sizeof(qfind_db_t));
+    if (!db) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    db->map = map;
+    db->map_size = st.st_size;
+
+    db_cursor_t c = { map, map + st.st_size };
+    uint32_t magic, version, flags, num_sections;
+    if (!cursor_read(&c, &magic, sizeof(magic)) ||
+        !cursor_read(&c, &version, sizeof(version)) ||
+        !cursor_read(&c, &flags, sizeof(flags)) ||
+        !cursor_read(&c, &num_sections, sizeof(num_sections))) goto corrupt;
+    if (magic != DB_MAGIC || version != DB_VERSION) {
+        syslog(LOG_ERR, "%s: not a qfind database (or unsupported version)", path);
+        goto corrupt;
+    }
+    if (num_sections > DB_MAX_SECTIONS) goto corrupt;
+
+    for (uint32_t i = 0; i < num_sections; i++) {
+        uint32_t tag, reserved;
+        uint64_t size;
+        if (!cursor_read(&c, &tag, sizeof(tag)) ||
+            !cursor_read(&c, &reserved, sizeof(reserved)) ||
+            !cursor_read(&c, &size, sizeof(size)) ||
+            size > (uint64_t)(c.end - c.p)) goto corrupt;
+
+        db->sections[db->num_sections++] = (db_section_ref_t){ tag, c.p, size };
+        c.p += size;
+        size_t pad = (DB_SECTION_ALIGN - (size_t)(c.p - map) % DB_SECTION_ALIGN) % DB_SECTION_ALIGN;
+        if (!cursor_skip(&c, pad)) goto corrupt;
+    }
+
+    size_t size;
+    const uint8_t *dirs;
+    if ((dirs = db_section(db, DB_SECTION_DIRS, &size)) != NULL) {
+        db->dirs = dirs;
+        db->dirs_size = size;
+    } else if ((dirs = db_section(db, DB_SECTION_DIRS_ZSTD, &size)) != NULL) {
+        if (inflate_dir_blocks(db, dirs, size) != 0) goto corrupt;
+    } else {
+        goto corrupt;
+    }
+
+    // Count records first so the lookup slots are a single allocation
+    db_cursor_t dc = { db->dirs, db->dirs + db->dirs_size };
+    while (dc.p < dc.end) {
+        const char *dir_path;
+        uint16_t path_len;
+        db_dir_t dir;
+        if (!read_dir_header(&dc, &dir_path, &path_len, &dir) || !skip_dir_entries(&dc, &dir))
+            goto corrupt;
+        db->num_dirs++;
+    }
+
+    db->slots = calloc(db->num_dirs ? db->num_dirs : 1, sizeof(db_dir_slot_t));
+    if (!db->slots) goto corrupt;
+
+    dc.p = db->dirs;
+    for (uint32_t i = 0; i < db->num_dirs; i++) {
+        db_dir_slot_t *slot = &db->slots[i];
+        db_dir_t dir;
+        slot->record = dc.p;
+        read_dir_header(&dc, &slot->path, &slot->path_len, &dir);
+        skip_dir_entries(&dc, &dir);
+        HASH_ADD_KEYPTR(hh, db->by_path, slot->path, slot->path_len, slot);
+    }
+
+    return db;
+
+corrupt:
+    syslog(LOG_ERR, "%s: corrupt database", path);
+    db_close(db);
+    errno = EINVAL;
+    return NULL;
+}
+
+void db_close(qfind_db_t *db) {
+    if (!db) return;
+    HASH_CLEAR(hh, db->by_path);
+    free(db->slots);
+    free(db->dirs_buf);
+    munmap(db->map, db->map_size);
+    free(db);
+}
+
+bool db_find_dir(qfind_db_t *db, const char *path, db_dir_t *dir) {
+    db_dir_slot_t *slot;
+    HASH_FIND(hh, db->by_path, path, strlen(path), slot);
+    if (!slot) return false;
+
+    db_cursor_t c = { slot->record, db->dirs + db->dirs_size };
+    const char *p;
+    uint16_t len;
+    return read_dir_header(&c, &p, &len, dir);
+}
+
+static void section_begin(db_writer_t *w, uint32_t tag) {
+    uint32_t header[4] = { tag, 0, 0, 0 };
+    w->section_start = ftello(w->fp);
+    fwrite(header, sizeof(header), 1, w->fp);
+}
+
+/* Patch the open section's payload size and pad it to DB_SECTION_ALIGN */
+static void section_end(db_writer_t *w) {
+    static const uint8_t zeros[DB_SECTION_ALIGN];
+    off_t end = ftello(w->fp);
+    uint64_t size = end - w->section_start - DB_SECTION_HEADER_SIZE;
+    size_t pad = (DB_SECTION_ALIGN - (end % DB_SECTION_ALIGN)) % DB_SECTION_ALIGN;
+    fwrite(zeros, 1, pad, w->fp);
+    end += pad;
+
+    if (fseeko(w->fp, w->section_start + 8, SEEK_SET) != 0 ||
+        fwrite(&size, sizeof(size), 1, w->fp) != 1 ||
+        fseeko(w->fp, end, SEEK_SET) != 0) {
+        w->failed = true;
+    }
+    w->section_start = -1;
+    w->num_sections++;
+}
+
+db_writer_t *db_writer_create(const char *path, uint32_t flags) {
+    db_writer_t *w = calloc(1, sizeof(db_writer_t));
+    if (!w) return NULL;
+
+    if (snprintf(w->path, sizeof(w->path), "%s", path) >= (int)sizeof(w->path) ||
+        snprintf(w->tmp_path, sizeof(w->tmp_path), "%s.XXXXXX", path) >= (int)sizeof(w->tmp_path)) {
+        free(w);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    if (flags & DB_WRITE_PATH_DICT) {
+        w->compress_paths = true;
+        w->cctx = ZSTD_createCCtx();
+        if (!w->cctx) {
+            free(w);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    int fd = mkstemp(w->tmp_path);
+    if (fd < 0) {
+        ZSTD_freeCCtx(w->cctx);
+        free(w);
+        return NULL;
+    }
+    fchmod(fd, 0644);
+
+    w->fp = fdopen(fd, "wb");
+    if (!w->fp) {
+        close(fd);
+        unlink(w->tmp_path);
+        ZSTD_freeCCtx(w->cctx);
+        free(w);
+        return NULL;
+    }
+
+    // num_sections is patched in db_writer_commit()
+    uint32_t header[4] = { DB_MAGIC, DB_VERSION, 0, 0 };
+    fwrite(header, sizeof(header), 1, w->fp);
+    section_begin(w, w->compress_paths ? DB_SECTION_DIRS_ZSTD : DB_SECTION_DIRS);
+    return w;
+}
+
+/* Train the path dictionary on the records buffered so far */
+static void train_path_dictionary(db_writer_t *w) {
+    w->trained = true;
+
+    size_t num_samples = w->raw_size / DB_PATH_SAMPLE_SIZE;
+    if (num_samples < 8) return;  // Too little data; blocks go out without a dictionary
+
+    size_t *sizes = malloc(num_samples * sizeof(size_t));
+    void *dict = malloc(DB_PATH_DICT_CAPACITY);
+    if (!sizes || !dict) {
+        free(sizes);
+        free(dict);
+        return;
+    }
+    for (size_t i = 0; i < num_samples; i++) sizes[i] = DB_PATH_SAMPLE_SIZE;
+
+    size_t dict_size = ZDICT_trainFromBuffer(dict, DB_PATH_DICT_CAPACITY, w->raw, sizes, num_samples);
+    free(sizes);
+    if (ZDICT_isError(dict_size)) {
+        syslog(LOG_WARNING, "Path dictionary training failed: %s", ZDICT_getErrorName(dict_size));
+        free(dict);
+        return;
+    }
+
+    w->cdict = ZSTD_createCDict(dict, dict_size, ZSTD_CLEVEL_DEFAULT);
+    if (!w->cdict) {
+        free(dict);
+        return;
+    }
+    w->path_dict = dict;
+    w->path_dict_size = dict_size;
+}
+
+/* Compress and write whole DB_PATH_BLOCK_SIZE blocks (or everything, if final) */
+static void flush_path_blocks(db_writer_t *w, bool final) {
+    size_t done = 0;
+    size_t bound = ZSTD_compressBound(DB_PATH_BLOCK_SIZE);
+    uint8_t *frame = malloc(bound);
+    if (!frame) {
+        w->failed = true;
+        return;
+    }
+
+    while (w->raw_size - done >= DB_PATH_BLOCK_SIZE || (final && done < w->raw_size)) {
+        uint32_t raw_len = MIN((size_t)DB_PATH_BLOCK_SIZE, w->raw_size - done);
+        size_t n = w->cdict
+            ? ZSTD_compress_usingCDict(w->cctx, frame, bound, w->raw + done, raw_len, w->cdict)
+            : ZSTD_compressCCtx(w->cctx, frame, bound, w->raw + done, raw_len, ZSTD_CLEVEL_DEFAULT);
+        if (ZSTD_isError(n)) {
+            syslog(LOG_ERR, "ZSTD error: %s", ZSTD_getErrorName(n));
+            w->failed = true;
+            break;
+        }
+        uint32_t frame_len = n;
+        fwrite(&raw_len, sizeof(raw_len), 1, w->fp);
+        fwrite(&frame_len, sizeof(frame_len), 1, w->fp);
+        fwrite(frame, 1, frame_len, w->fp);
+        done += raw_len;
+    }
+    free(frame);
+
+    memmove(w->raw, w->raw + done, w->raw_size - done);
+    w->raw_size -= done;
+}
+
+static void put_bytes(db_writer_t *w, const void *data, size_t len) {
+    if (!w->compress_paths) {
+        fwrite(data, 1, len, w->fp);
+        return;
+    }
+
+    if (w->raw_size + len > w->raw_cap) {
+        size_t new_cap = MAX(w->raw_cap * 2, w->raw_size + len + DB_PATH_BLOCK_SIZE);
+        uint8_t *grown = realloc(w->raw, new_cap);
+        if (!grown) {
+            w->failed = true;
+            return;
+        }
+        w->raw = grown;
+        w->raw_cap = new_cap;
+    }
+    memcpy(w->raw + w->raw_size, data, len);
+    w->raw_size += len;
+}
+
+int db_writer_add_dir(db_writer_t *w, const char *path, const struct stat *st,
+                      const db_entry_t *entries, uint32_t num_entries) {
+    uint16_t path_len = strlen(path);
+    int64_t mtime_ns = timespec_ns(&st->st_mtim);
+    int64_t ctime_ns = timespec_ns(&st->st_ctim);
+    uint32_t mode = st->st_mode, uid = st->st_uid, gid = st->st_gid;
+
+    put_bytes(w, &path_len, sizeof(path_len));
+    put_bytes(w, path, path_len);
+    put_bytes(w, &mtime_ns, sizeof(mtime_ns));
+    put_bytes(w, &ctime_ns, sizeof(ctime_ns));
+    put_bytes(w, &mode, sizeof(mode));
+    put_bytes(w, &uid, sizeof(uid));
+    put_bytes(w, &gid, sizeof(gid));
+    put_bytes(w, &num_entries, sizeof(num_entries));
+
+    for (uint32_t i = 0; i < num_entries; i++) {
+        const db_entry_t *e = &entries[i];
+        put_bytes(w, &e->type, sizeof(e->type));
+        put_bytes(w, &e->name_len, sizeof(e->name_len));
+        put_bytes(w, e->name, e->name_len);
+        put_bytes(w, &e->mode, sizeof(e->mode));
+        put_bytes(w, &e->mtime, sizeof(e->mtime));
+        put_bytes(w, &e->size, sizeof(e->size));
+        put_bytes(w, &e->uid, sizeof(e->uid));
+        put_bytes(w, &e->gid, sizeof(e->gid));
+        put_bytes(w, &e->ino, sizeof(e->ino));
+    }
+
+    if (w->compress_paths) {
+        // Buffer the start of the walk as training data, then stream blocks
+        if (!w->trained && w->raw_size >= DB_PATH_DICT_TRAIN_BYTES) train_path_dictionary(w);
+        if (w->trained) flush_path_blocks(w, false);
+    }
+
+    if (w->failed || ferror(w->fp)) {
+        w->failed = true;
+        return -EIO;
+    }
+    w->num_dirs++;
+    return 0;
+}
+
+/* Close the directory section; every other section follows it */
+static void finish_dirs(db_writer_t *w) {
+    if (w->dirs_done) return;
+    w->dirs_done = true;
+
+    if (w->compress_paths) {
+        if (!w->trained) train_path_dictionary(w);
+        flush_path_blocks(w, true);
+    }
+    section_end(w);
+
+    if (w->path_dict) {
+        section_begin(w, DB_SECTION_PATH_DICT);
+        fwrite(w->path_dict, 1, w->path_dict_size, w->fp);
+        section_end(w);
+    }
+}
+
+int db_writer_add_section(db_writer_t *w, uint32_t tag, const void *data, size_t size) {
+    finish_dirs(w);
+    section_begin(w, tag);
+    fwrite(data, 1, size, w->fp);
+    section_end(w);
+    return (w->failed || ferror(w->fp)) ? -EIO : 0;
+}
+
+/* Persist the finalized posting lists and, if trained, their dictionary */
+int db_writer_add_postings(db_writer_t *w, const qfind_index_t *index) {
+    finish_dirs(w);
+
+    uint32_t header[2] = { htole32(index->num_entries), htole32(DB_POSTING_RECORD_SIZE) };
+    uint64_t data_size = htole64(index->compressed_size);
+    section_begin(w, DB_SECTION_POSTINGS);
+    fwrite(header, sizeof(header), 1, w->fp);
+    fwrite(&data_size, sizeof(data_size), 1, w->fp);
+
+    // Field by field, so neither host byte order nor padding reaches the file
+    for (uint32_t i = 0; i < index->num_entries; i++) {
+        const index_entry_t *e = &index->entries[i];
+        uint32_t head[2] = { htole32(e->trigram), htole32(e->num_files) };
+        uint64_t offset = htole64(e->offset);
+        uint32_t tail[2] = { htole32(e->size), 0 };
+        fwrite(head, sizeof(head), 1, w->fp);
+        fwrite(&offset, sizeof(offset), 1, w->fp);
+        fwrite(tail, sizeof(tail), 1, w->fp);
+    }
+    fwrite(index->compressed_data, 1, index->compressed_size, w->fp);
+    section_end(w);
+
+    if (index->posting_dict) {
+        return db_writer_add_section(w, DB_SECTION_POSTING_DICT,
+                                     index->posting_dict, index->posting_dict_size);
+    }
+    return (w->failed || ferror(w->fp)) ? -EIO : 0;
+}
+
+static void free_writer(db_writer_t *w) {
+    ZSTD_freeCDict(w->cdict);
+    ZSTD_freeCCtx(w->cctx);
+    free(w->path_dict);
+    free(w->raw);
+    free(w);
+}
+
+void db_writer_abort(db_writer_t *w) {
+    if (!w) return;
+    fclose(w->fp);
+    unlink(w->tmp_path);
+    free_writer(w);
+}
+
+/* Patch the section count, flush, and atomically replace the old database */
+int db_writer_commit(db_writer_t *w) {
+    finish_dirs(w);
+
+    if (w->failed || ferror(w->fp) ||
+        fseeko(w->fp, 12, SEEK_SET) != 0 ||
+        fwrite(&w->num_sections, sizeof(w->num_sections), 1, w->fp) != 1 ||
+        fflush(w->fp) != 0 || fsync(fileno(w->fp)) != 0) {
+        int err = errno ? errno : EIO;
+        syslog(LOG_ERR, "Failed to write database %s: %s", w->tmp_path, strerror(err));
+        db_writer_abort(w);
+        return -err;
+    }
+
+    if (fclose(w->fp) != 0) {
+        int err = errno;
+        unlink(w->tmp_path);
+        free_writer(w);
+        return -err;
+    }
+
+    // Read it back before it replaces a database that still loads
+    qfind_db_t *check = db_open(w->tmp_path);
+    bool valid = check && check->num_sections == w->num_sections && check->num_dirs == w->num_dirs;
+    db_close(check);
+    if (!valid) {
+        syslog(LOG_ERR, "Database %s does not read back; keeping %s", w->tmp_path, w->path);
+        unlink(w->tmp_path);
+        free_writer(w);
+        return -EINVAL;
+    }
+
+    if (rename(w->tmp_path, w->path) != 0) {
+        int err = errno;
+        unlink(w->tmp_path);
+        free_writer(w);
+        return -err;
+    }
+
+    free_writer(w);
+    return 0;
+}
+
+/* Join a directory and an entry name without doubling the root slash */
+int db_join_path(char *out, size_t out_len, const char *dir, const char *name, size_t name_len) {
+    const char *sep = (dir[0] == '/' && dir[1] == '\0') ? "" : "/";
+    int n = snprintf(out, out_len, "%s%s%.*s", dir, sep, (int)name_len, name);
+    return (n < 0 || (size_t)n >= out_len) ? -ENAMETOOLONG : n;
+}
+
+/*
+ * Point the index at the database's persisted posting lists; they stay
+ * mapped. Every record must lie inside the data, in strict trigram order.
+ */
+static int attach_postings(qfind_index_t *index, qfind_db_t *db) {
+    size_t size;
+    const uint8_t *post = db_section(db, DB_SECTION_POSTINGS, &size);
+    if (!post) return -ENOENT;
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+    return -ENOENT;  // Records are only used in place; rebuild from the paths
+#else
+    db_cursor_t c = { post, post + size };
+    uint32_t num_entries, record_size;
+    uint64_t data_size;
+    if (!cursor_read(&c, &num_entries, sizeof(num_entries)) ||
+        !cursor_read(&c, &record_size, sizeof(record_size)) ||
+        !cursor_read(&c, &data_size, sizeof(data_size)) ||
+        record_size != DB_POSTING_RECORD_SIZE ||
+        data_size > size - DB_POSTINGS_HEADER_SIZE ||
+        (uint64_t)num_entries * DB_POSTING_RECORD_SIZE != size - DB_POSTINGS_HEADER_SIZE - data_size) {
+        syslog(LOG_ERR, "Posting section has a bad header or size");
+        return -EINVAL;
+    }
+
+    const index_entry_t *entries = (const index_entry_t*)c.p;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        const index_entry_t *e = &entries[i];
+        if (e->offset > data_size || e->size > data_size - e->offset ||
+            (i > 0 && e->trigram <= entries[i - 1].trigram)) {
+            syslog(LOG_ERR, "Posting record %u is out of bounds or order", i);
+            return -EINVAL;
+        }
+    }
+
+    size_t dict_size;
+    const void *dict = db_section(db, DB_SECTION_POSTING_DICT, &dict_size);
+    if (dict && posting_dict_attach(index, (void*)dict, dict_size, false) != 0) return -ENOMEM;
+
+    index->entries = (index_entry_t*)c.p;
+    index->num_entries = num_entries;
+    index->compressed_data = (void*)(c.p + (size_t)num_entries * sizeof(index_entry_t));
+    index->compressed_size = data_size;
+    index->postings_mapped = true;
+    return 0;
+#endif
+}
+
+/* Whether the directory at path lies below the one at parent */
+static bool dir_below(const char *parent, size_t parent_len, const char *path, size_t len) {
+    if (parent_len == 1 && parent[0] == '/') return len > 1 && path[0] == '/';
+    return len > parent_len && memcmp(path, parent, parent_len) == 0 && path[parent_len] == '/';
+}
+
+/*
+ * Populate an empty index from a database written by qfind_update_database().
+ * Persisted posting lists are used in place; older databases without them
+ * get their trigram index rebuilt from the stored paths.
+ */
+int qfind_load_database(qfind_index_t *index, const char *path) {
+    qfind_db_t *db = db_open(path);
+    if (!db) return errno ? -errno : -EINVAL;
+
+    int ret = attach_postings(index, db);
+    bool rebuild = ret == -ENOENT;
+    if (ret != 0 && !rebuild) {
+        db_close(db);
+        return ret;
+    }
+    ret = 0;
+
+    // Records are in walk order, so a directory's ancestors are on a stack of open records
+    uint32_t *open_dirs = malloc((db->num_dirs ? db->num_dirs : 1) * sizeof(uint32_t));
+    uint32_t depth = 0, first_dir = index->num_dirs;
+    if (!open_dirs) ret = -ENOMEM;
+
+    for (uint32_t i = 0; i < db->num_dirs && ret == 0; i++) {
+        db_dir_t dir;
+        db_cursor_t c = { db->slots[i].record, db->dirs + db->dirs_size };
+        const char *dir_path;
+        uint16_t dir_len;
+        read_dir_header(&c, &dir_path, &dir_len, &dir);
+
+        while (depth > 0) {
+            const db_dir_slot_t *top = &db->slots[open_dirs[depth - 1]];
+            if (dir_below(top->path, top->path_len, dir_path, dir_len)) break;
+            depth--;
+        }
+        uint32_t d;
+        ret = perm_add_dir(index, depth ? first_dir + open_dirs[depth - 1] : DIR_NONE, dir.mode, dir.uid, dir.gid, &d);
+        if (ret != 0) break;
+        open_dirs[depth++] = i;
+
+        char dir_buf[PATH_MAX];
+        snprintf(dir_buf, sizeof(dir_buf), "%.*s", (int)dir_len, dir_path);
+
+        db_entry_t entry;
+        while (ret == 0 && db_dir_next_entry(&dir, &entry)) {
+            if (entry.type != DB_ENTRY_FILE) continue;
+
+            char full_path[PATH_MAX];
+            if (db_join_path(full_path, sizeof(full_path), dir_buf, entry.name, entry.name_len) < 0)
+                continue;
+            ret = rebuild ? index_append_file(index, full_path, &entry)
+                          : index_append_metadata(index, full_path, &entry);
+            if (ret > 0) ret = 0;
+        }
+        index->dirs[d].end = index->num_files;
+    }
+    free(open_dirs);
+
+    pthread_rwlock_wrlock(&index->index_lock);
+    if (ret == 0 && rebuild) ret = compress_posting_lists(index);
+    if (ret == 0) ret = short_index_build(index);
+    if (ret == 0) plan_prepare(index);
+    index->num_walked = index->num_files;
+    pthread_rwlock_unlock(&index->index_lock);
+
+    // The FM-index, basename and anchor indexes are only valid against the id order they were built with
+    size_t fm_size;
+    const void *fm = db_section(db, DB_SECTION_FM_INDEX, &fm_size);
+    if (ret == 0 && !rebuild && fm && fm_index_attach(index, fm, fm_size, false) == 0 &&
+        fm_index_num_docs(index->fm) != index->num_files) {
+        syslog(LOG_WARNING, "FM-index in %s does not match its paths; ignoring it", path);
+        fm_index_free(index);
+    }
+    size_t base_size;
+    const void *base = db_section(db, DB_SECTION_BASENAMES, &base_size);
+    if (ret == 0 && !rebuild && base && basename_index_attach(index, base, base_size, false) == 0 &&
+        basename_index_num_files(index->base_idx) != index->num_files) {
+        syslog(LOG_WARNING, "Basename index in %s does not match its paths; ignoring it", path);
+        basename_index_free(index);
+    }
+    size_t anchor_size;
+    const void *anchors = db_section(db, DB_SECTION_ANCHORS, &anchor_size);
+    if (ret == 0 && !rebuild && anchors && anchor_index_attach(index, anchors, anchor_size, false) == 0 &&
+        anchor_index_num_files(index->anchors) != index->num_files) {
+        syslog(LOG_WARNING, "Anchor index in %s does not match its paths; ignoring it", path);
+        anchor_index_free(index);
+    }
+
+    if (ret == 0 && !rebuild) {
+        index->db = db;
+    } else {
+        fm_index_free(index);
+        basename_index_free(index);
+        anchor_index_free(index);
+        if (index->postings_mapped) {
+            index->entries = NULL;
+            index->compressed_data = NULL;
+            index->num_entries = 0;
+            index->postings_mapped = false;
+        }
+        posting_dict_release(index);
+        db_close(db);
+    }
+    return ret;
+}
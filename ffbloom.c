@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <xxhash.h>
+#include <math.h>
 
 struct ffbloom_s {
     uint8_t* primary;
@@ -116,4 +117,17 @@ void ffbloom_get_candidates(const ffbloom_t bloom,
             output[(*num_found)++] = patterns[i];
         }
     }
-}
\ No newline at end of file
+}
+
+void ffbloom_clear(ffbloom_t bloom) {
+    if (!bloom) return;
+    memset(bloom->primary, 0, bloom->primary_size);
+    memset(bloom->secondary, 0, bloom->secondary_size);
+}
+
+/* Expected false positive rate of the secondary filter after num_items insertions */
+double ffbloom_fpr(const ffbloom_t bloom, uint64_t num_items) {
+    if (!bloom) return 1.0;
+    double bits = (double)bloom->secondary_size * 8;
+    return pow(1.0 - exp(-(double)bloom->num_hash_funcs * num_items / bits), bloom->num_hash_funcs);
+}
@@ -0,0 +1,420 @@
+#include "qfind.h"
+#include <errno.h>
+#include <immintrin.h>
+
+#define FM_MAGIC 0x58444E494D46ULL   // "FMINDX"
+#define FM_BLOCK 256                 // Rows per occurrence checkpoint
+#define FM_SAMPLE 32                 // Text positions per suffix array sample
+#define FM_SENTINEL 0                // Code of the terminating symbol
+#define FM_SEPARATOR 1               // Code of the NUL between two paths
+
+/*
+ * FM-index over the ASCII-folded name arena (every path NUL-terminated, in
+ * id order). Counting a pattern is one backward-search step per byte;
+ * each occurrence is located by LF-walking to a sampled suffix array row.
+ *
+ * The whole index is a single position-independent blob, so a built index
+ * is written to the database as-is and a loaded one is used in place.
+ *
+ *   fm_header_t | bwt[n] | occ[(n / FM_BLOCK + 1) * sigma] (uint32)
+ *   | sampled-row bits | rank per bit word (uint32) | samples (uint32)
+ *   | doc_starts[num_docs] (uint64)                  each part 8-aligned
+ */
+
+typedef struct {
+    uint64_t magic;
+    uint64_t n;                      // Text length including the sentinel
+    uint32_t num_docs;
+    uint32_t sigma;                  // Symbol codes in use
+    uint64_t C[256];                 // Text symbols smaller than each code
+    uint8_t code[256];               // Byte to code; 0 for bytes not in the text
+    uint64_t off_bwt;
+    uint64_t off_occ;
+    uint64_t off_bits;
+    uint64_t off_rank;
+    uint64_t off_samples;
+    uint64_t off_docs;
+    uint64_t size;
+} fm_header_t;
+
+struct fm_index {
+    const fm_header_t *hdr;
+    const uint8_t *bwt;
+    const uint32_t *occ;
+    const uint64_t *bits;
+    const uint32_t *rank;
+    const uint32_t *samples;
+    const uint64_t *doc_starts;
+    void *owned;                     // Blob to free, NULL when it lives in the database
+};
+
+/* ---- SA-IS suffix sorting (Nong, Zhang & Chan) over int symbols ---- */
+
+#define S_TYPE(t, i) (((t)[(i) / 8] >> ((i) % 8)) & 1)
+#define IS_LMS(t, i) ((i) > 0 && S_TYPE(t, i) && !S_TYPE(t, (i) - 1))
+
+static void get_buckets(const int32_t *s, int32_t n, int32_t k, int32_t *bkt, bool end) {
+    memset(bkt, 0, (k + 1) * sizeof(int32_t));
+    for (int32_t i = 0; i < n; i++) bkt[s[i]]++;
+    int32_t sum = 0;
+    for (int32_t i = 0; i <= k; i++) {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+static void induce_l(const uint8_t *t, int32_t *sa, const int32_t *s, int32_t *bkt, int32_t n, int32_t k) {
+    get_buckets(s, n, k, bkt, false);
+    for (int32_t i = 0; i < n; i++) {
+        int32_t j = sa[i] - 1;
+        if (sa[i] > 0 && !S_TYPE(t, j)) sa[bkt[s[j]]++] = j;
+    }
+}
+
+static void induce_s(const uint8_t *t, int32_t *sa, const int32_t *s, int32_t *bkt, int32_t n, int32_t k) {
+    get_buckets(s, n, k, bkt, true);
+    for (int32_t i = n - 1; i >= 0; i--) {
+        int32_t j = sa[i] - 1;
+        if (sa[i] > 0 && S_TYPE(t, j)) sa[--bkt[s[j]]] = j;
+    }
+}
+
+/* s[n - 1] must be the unique smallest symbol; symbols are 0..k */
+static int sais(const int32_t *s, int32_t *sa, int32_t n, int32_t k) {
+    uint8_t *t = calloc(n / 8 + 1, 1);
+    int32_t *bkt = malloc((k + 1) * sizeof(int32_t));
+    if (!t || !bkt) {
+        free(t);
+        free(bkt);
+        return -ENOMEM;
+    }
+
+    // Classify suffixes: S-type bits set, the sentinel is S-type
+    t[(n - 1) / 8] |= 1 << ((n - 1) % 8);
+    for (int32_t i = n - 2; i >= 0; i--) {
+        if (s[i] < s[i + 1] || (s[i] == s[i + 1] && S_TYPE(t, i + 1))) t[i / 8] |= 1 << (i % 8);
+    }
+
+    // Stage 1: sort the LMS substrings by induction
+    get_buckets(s, n, k, bkt, true);
+    for (int32_t i = 0; i < n; i++) sa[i] = -1;
+    for (int32_t i = 1; i < n; i++) {
+        if (IS_LMS(t, i)) sa[--bkt[s[i]]] = i;
+    }
+    induce_l(t, sa, s, bkt, n, k);
+    induce_s(t, sa, s, bkt, n, k);
+
+    int32_t n1 = 0;
+    for (int32_t i = 0; i < n; i++) {
+        if (sa[i] > 0 && IS_LMS(t, sa[i])) sa[n1++] = sa[i];
+    }
+
+    // Name the LMS substrings; equal substrings share a name
+    for (int32_t i = n1; i < n; i++) sa[i] = -1;
+    int32_t name = 0, prev = -1;
+    for (int32_t i = 0; i < n1; i++) {
+        int32_t pos = sa[i];
+        bool diff = false;
+        for (int32_t d = 0; d < n; d++) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || S_TYPE(t, pos + d) != S_TYPE(t, prev + d)) {
+                diff = true;
+                break;
+            }
+            if (d > 0 && (IS_LMS(t, pos + d) || IS_LMS(t, prev + d))) break;
+        }
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int32_t i = n - 1, j = n - 1; i >= n1; i--) {
+        if (sa[i] >= 0) sa[j--] = sa[i];
+    }
+
+    // Stage 2: sort the reduced string, recursing while names repeat
+    int32_t *s1 = sa + n - n1, *sa1 = sa;
+    int ret = 0;
+    if (name < n1) ret = sais(s1, sa1, n1, name - 1);
+    else for (int32_t i = 0; i < n1; i++) sa1[s1[i]] = i;
+
+    // Stage 3: induce the full order from the sorted LMS suffixes
+    if (ret == 0) {
+        get_buckets(s, n, k, bkt, true);
+        for (int32_t i = 1, j = 0; i < n; i++) {
+            if (IS_LMS(t, i)) s1[j++] = i;
+        }
+        for (int32_t i = 0; i < n1; i++) sa1[i] = s1[sa1[i]];
+        for (int32_t i = n1; i < n; i++) sa[i] = -1;
+        for (int32_t i = n1 - 1; i >= 0; i--) {
+            int32_t j = sa[i];
+            sa[i] = -1;
+            sa[--bkt[s[j]]] = j;
+        }
+        induce_l(t, sa, s, bkt, n, k);
+        induce_s(t, sa, s, bkt, n, k);
+    }
+
+    free(t);
+    free(bkt);
+    return ret;
+}
+
+/* ---- Query side ---- */
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+/* Occurrences of code c in bwt[0, i) */
+static uint64_t fm_occ(const fm_index_t *fm, uint8_t c, uint64_t i) {
+    uint64_t block = i / FM_BLOCK;
+    uint64_t count = fm->occ[block * fm->hdr->sigma + c];
+    const uint8_t *p = fm->bwt + block * FM_BLOCK;
+    const uint8_t *end = fm->bwt + i;
+
+#ifdef __AVX2__
+    const __m256i vc = _mm256_set1_epi8(c);
+    for (; p + 32 <= end; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vc)));
+    }
+#endif
+    for (; p < end; p++) count += *p == c;
+    return count;
+}
+
+static uint64_t fm_lf(const fm_index_t *fm, uint64_t row) {
+    uint8_t c = fm->bwt[row];
+    return fm->hdr->C[c] + fm_occ(fm, c, row);
+}
+
+/* Text position of the suffix at row */
+static uint64_t fm_locate(const fm_index_t *fm, uint64_t row) {
+    uint64_t steps = 0;
+    while (!((fm->bits[row / 64] >> (row % 64)) & 1)) {
+        row = fm_lf(fm, row);
+        steps++;
+    }
+    uint64_t below = fm->bits[row / 64] & ((1ULL << (row % 64)) - 1);
+    return (uint64_t)fm->samples[fm->rank[row / 64] + __builtin_popcountll(below)] + steps;
+}
+
+static uint32_t fm_doc_of(const fm_index_t *fm, uint64_t pos) {
+    uint32_t lo = 0, hi = fm->hdr->num_docs;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (fm->doc_starts[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int compare_file_ids(const void *a, const void *b) {
+    file_id_t x = *(const file_id_t*)a, y = *(const file_id_t*)b;
+    return (x > y) - (x < y);
+}
+
+uint32_t fm_index_num_docs(const fm_index_t *fm) {
+    return fm->hdr->num_docs;
+}
+
+/* Backward search: rows [*sp, *ep) are the suffixes starting with the folded pattern */
+static void fm_range(const fm_index_t *fm, const char *pattern, uint64_t *sp, uint64_t *ep) {
+    const fm_header_t *h = fm->hdr;
+    *sp = 0;
+    *ep = h->n;
+    for (size_t i = strlen(pattern); i-- > 0 && *sp < *ep; ) {
+        uint8_t c = h->code[fold_ascii((unsigned char)pattern[i])];
+        if (c == 0) {  // A byte no path contains
+            *sp = *ep = 0;
+            return;
+        }
+        *sp = h->C[c] + fm_occ(fm, c, *sp);
+        *ep = h->C[c] + fm_occ(fm, c, *ep);
+    }
+}
+
+/* Occurrences of the pattern, ASCII case-folded, across all paths */
+uint64_t fm_index_count(const fm_index_t *fm, const char *pattern) {
+    uint64_t sp, ep;
+    fm_range(fm, pattern, &sp, &ep);
+    return sp < ep ? ep - sp : 0;
+}
+
+/* Sorted, unique ids of documents containing the pattern, ASCII case-folded */
+int fm_index_search(const fm_index_t *fm, const char *pattern, file_id_t **ids, uint32_t *num_ids) {
+    uint64_t sp, ep;
+    *ids = NULL;
+    *num_ids = 0;
+    fm_range(fm, pattern, &sp, &ep);
+    if (sp >= ep) return 0;
+
+    file_id_t *out = malloc((ep - sp) * sizeof(file_id_t));
+    if (!out) return -ENOMEM;
+    for (uint64_t row = sp; row < ep; row++) out[row - sp] = fm_doc_of(fm, fm_locate(fm, row));
+
+    // A path matching twice yields two rows
+    qsort(out, ep - sp, sizeof(file_id_t), compare_file_ids);
+    uint32_t n = 0;
+    for (uint64_t i = 0; i < ep - sp; i++) {
+        if (n == 0 || out[n - 1] != out[i]) out[n++] = out[i];
+    }
+    *ids = out;
+    *num_ids = n;
+    return 0;
+}
+
+/* ---- Construction and attachment ---- */
+
+/* Whether an 8-aligned part of len bytes at off lies inside a blob of size bytes */
+static bool fm_part_fits(uint64_t off, uint64_t len, uint64_t size) {
+    return off % 8 == 0 && off <= size && len <= size - off;
+}
+
+int fm_index_attach(qfind_index_t *index, const void *blob, size_t size, bool owned) {
+    const fm_header_t *h = blob;
+    if (size < sizeof(fm_header_t) || h->magic != FM_MAGIC || h->size != size) return -EINVAL;
+
+    // Every part's length follows from the header counts; a loaded blob may lie
+    if (h->n == 0 || h->n > size || h->sigma < 2 || h->sigma > 256) return -EINVAL;
+    for (int b = 0; b < 256; b++) {
+        if (h->code[b] >= h->sigma) return -EINVAL;
+    }
+    uint64_t num_blocks = h->n / FM_BLOCK + 1;
+    uint64_t num_words = (h->n + 63) / 64;
+    uint64_t num_samples = (h->n + FM_SAMPLE - 1) / FM_SAMPLE;
+    if (!fm_part_fits(h->off_bwt, h->n, size) ||
+        !fm_part_fits(h->off_occ, num_blocks * h->sigma * sizeof(uint32_t), size) ||
+        !fm_part_fits(h->off_bits, num_words * sizeof(uint64_t), size) ||
+        !fm_part_fits(h->off_rank, num_words * sizeof(uint32_t), size) ||
+        !fm_part_fits(h->off_samples, num_samples * sizeof(uint32_t), size) ||
+        !fm_part_fits(h->off_docs, (uint64_t)h->num_docs * sizeof(uint64_t), size)) return -EINVAL;
+
+    fm_index_t *fm = calloc(1, sizeof(fm_index_t));
+    if (!fm) return -ENOMEM;
+
+    const uint8_t *base = blob;
+    fm->hdr = h;
+    fm->bwt = base + h->off_bwt;
+    fm->occ = (const uint32_t*)(base + h->off_occ);
+    fm->bits = (const uint64_t*)(base + h->off_bits);
+    fm->rank = (const uint32_t*)(base + h->off_rank);
+    fm->samples = (const uint32_t*)(base + h->off_samples);
+    fm->doc_starts = (const uint64_t*)(base + h->off_docs);
+    fm->owned = owned ? (void*)blob : NULL;
+
+    fm_index_free(index);
+    index->fm = fm;
+    return 0;
+}
+
+void fm_index_free(qfind_index_t *index) {
+    if (!index->fm) return;
+    free(index->fm->owned);
+    free(index->fm);
+    index->fm = NULL;
+}
+
+const void *fm_index_blob(const fm_index_t *fm, size_t *size) {
+    *size = fm->hdr->size;
+    return fm->hdr;
+}
+
+/*
+ * Build from the short index's name arena (short_index_build() must have
+ * run). Costs about 9 bytes per text byte while sorting.
+ */
+int fm_index_build(qfind_index_t *index) {
+    const short_index_t *si = &index->short_idx;
+    if (si->names_size + 1 >= INT32_MAX) {
+        // Queries fall back to the other engines while index->fm is NULL
+        syslog(LOG_WARNING, "Name corpus too large for the FM-index; not building it");
+        fm_index_free(index);
+        return 0;
+    }
+
+    int32_t n = si->names_size + 1;
+    fm_header_t h = { .magic = FM_MAGIC, .n = n, .num_docs = si->num_files };
+
+    // Dense codes: sentinel, separator, then each folded byte in use
+    bool used[256] = {0};
+    for (size_t i = 0; i < si->names_size; i++) used[fold_ascii((unsigned char)si->names[i])] = true;
+    h.sigma = 2;
+    for (int b = 1; b < 256; b++) {
+        if (used[b]) h.code[b] = h.sigma++;
+    }
+    if (h.sigma > 256) return -EINVAL;
+
+    int32_t *text = malloc((size_t)n * sizeof(int32_t));
+    int32_t *sa = malloc((size_t)n * sizeof(int32_t));
+    if (!text || !sa) {
+        free(text);
+        free(sa);
+        return -ENOMEM;
+    }
+    for (size_t i = 0; i < si->names_size; i++) {
+        unsigned char b = si->names[i];
+        text[i] = b ? h.code[fold_ascii(b)] : FM_SEPARATOR;
+    }
+    text[n - 1] = FM_SENTINEL;
+
+    int ret = sais(text, sa, n, h.sigma - 1);
+    if (ret != 0) {
+        free(text);
+        free(sa);
+        return ret;
+    }
+
+    uint64_t counts[256] = {0};
+    for (int32_t i = 0; i < n; i++) counts[text[i]]++;
+    for (uint32_t c = 1; c < h.sigma; c++) h.C[c] = h.C[c - 1] + counts[c - 1];
+
+    uint64_t num_blocks = n / FM_BLOCK + 1;
+    uint64_t num_words = (n + 63) / 64;
+    uint64_t num_samples = (n + FM_SAMPLE - 1) / FM_SAMPLE;
+    h.off_bwt = align8(sizeof(fm_header_t));
+    h.off_occ = align8(h.off_bwt + n);
+    h.off_bits = align8(h.off_occ + num_blocks * h.sigma * sizeof(uint32_t));
+    h.off_rank = align8(h.off_bits + num_words * sizeof(uint64_t));
+    h.off_samples = align8(h.off_rank + num_words * sizeof(uint32_t));
+    h.off_docs = align8(h.off_samples + num_samples * sizeof(uint32_t));
+    h.size = align8(h.off_docs + (uint64_t)h.num_docs * sizeof(uint64_t));
+
+    uint8_t *blob = calloc(1, h.size);
+    if (!blob) {
+        free(text);
+        free(sa);
+        return -ENOMEM;
+    }
+    memcpy(blob, &h, sizeof(h));
+    uint8_t *bwt = blob + h.off_bwt;
+    uint32_t *occ = (uint32_t*)(blob + h.off_occ);
+    uint64_t *bits = (uint64_t*)(blob + h.off_bits);
+    uint32_t *rank = (uint32_t*)(blob + h.off_rank);
+    uint32_t *samples = (uint32_t*)(blob + h.off_samples);
+    uint64_t *docs = (uint64_t*)(blob + h.off_docs);
+
+    uint32_t running[256] = {0};
+    uint32_t sampled = 0;
+    for (int32_t row = 0; row < n; row++) {
+        if (row % FM_BLOCK == 0) memcpy(occ + (row / FM_BLOCK) * h.sigma, running, h.sigma * sizeof(uint32_t));
+        if (row % 64 == 0) rank[row / 64] = sampled;
+
+        int32_t pos = sa[row];
+        bwt[row] = text[pos > 0 ? pos - 1 : n - 1];
+        running[bwt[row]]++;
+        if (pos % FM_SAMPLE == 0) {
+            bits[row / 64] |= 1ULL << (row % 64);
+            samples[sampled++] = pos;
+        }
+    }
+    if (n % FM_BLOCK == 0) memcpy(occ + (n / FM_BLOCK) * h.sigma, running, h.sigma * sizeof(uint32_t));
+    for (uint32_t d = 0; d < h.num_docs; d++) docs[d] = si->name_offsets[d];
+
+    free(text);
+    free(sa);
+    ret = fm_index_attach(index, blob, h.size, true);
+    if (ret != 0) free(blob);
+    return ret;
+}
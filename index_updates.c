@@ -1,6 +1,11 @@
+#define _GNU_SOURCE
 #include "qfind.h"
 #include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/vfs.h>
 #include <pthread.h>
+#include <errno.h>
+#include <mntent.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -9,11 +14,41 @@
 #include <dirent.h>
 #include <stdatomic.h>
 #include <syslog.h>
+#include <sys/mman.h>
+#include <xxhash.h>
 
 #define EVENT_BUF_LEN (65536)
 #define MAX_WATCHES 1024
 #define LSM_BATCH_SIZE 5000
-#define PATH_CACHE_SIZE 100000
+#define LSM_RING_SIZE (1 << 22)      // 4MB of queued update records per batch
+
+enum {
+    LSM_NODE_EMPTY = 0,              // Reserved or free; consumer must not pass it
+    LSM_NODE_READY,                  // Fully written record
+    LSM_NODE_PAD                     // Filler up to the ring end before a wrapped record
+};
+#define PATH_IDS_INIT (1 << 16)      // Initial path map slots, a power of two
+#define PATH_ID_EMPTY UINT32_MAX
+#define PATH_ID_TOMBSTONE (UINT32_MAX - 1)
+#define MAX_FAN_MOUNTS 64
+#define EVENT_DEBOUNCE_MS 200        // Quiet period before a path's events are applied
+#define MOVE_PAIR_TIMEOUT_MS 500     // Unpaired IN_MOVED_FROM becomes a delete after this
+#define PENDING_SLAB_SIZE (4 << 20)  // Bytes for debouncing events and unpaired moves
+#define PENDING_MIN_SHIFT 6          // Smallest slab record: 64 bytes
+#define PENDING_CLASSES 8            // Record sizes 64 B .. 8 KB, a power of two each
+
+#define FAN_EVENT_MASK (FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO|FAN_MODIFY|FAN_ONDIR)
+
+typedef enum {
+    CHANGE_SOURCE_INOTIFY,
+    CHANGE_SOURCE_FANOTIFY
+} change_source_t;
+
+/* One fanotify filesystem mark; mount_fd anchors open_by_handle_at() */
+typedef struct fan_mount {
+    __kernel_fsid_t fsid;
+    int mount_fd;
+} fan_mount_t;
 
 typedef struct watch_mapping {
     int wd;
@@ -21,68 +56,159 @@ typedef struct watch_mapping {
     UT_hash_handle hh;
 } watch_mapping_t;
 
-typedef struct path_cache_entry {
-    char path[PATH_MAX];
-    file_id_t id;
+/* Coalesced events for one path, applied once the path goes quiet */
+typedef struct pending_event {
+    uint32_t mask;
+    uint64_t last_seen_ms;
+    UT_hash_handle hh;
+    char path[];
+} pending_event_t;
+
+/* IN_MOVED_FROM half of a rename, waiting for the IN_MOVED_TO with the same cookie */
+typedef struct pending_move {
+    uint32_t cookie;
+    uint32_t mask;
+    uint64_t seen_ms;
     UT_hash_handle hh;
-} path_cache_entry_t;
-
-// redundant
-//typedef struct lsm_node {
-//     file_id_t id;
-//     char *path;
-//     bool is_add;
-//     struct lsm_node *next;
-// } lsm_node_t;
-
-// typedef struct lsm_batch {
-//     lsm_node_t *head;
-//     lsm_node_t *tail;
-//     size_t count;
-//     pthread_spinlock_t lock;
-// } lsm_batch_t;
+    char path[];
+} pending_move_t;
+
+/*
+ * Fixed slab the pending events and moves are carved from, in power-of-two
+ * size classes with a free list each, so a burst of events allocates
+ * nothing and a record costs its path rather than PATH_MAX.
+ */
+typedef struct {
+    uint8_t *base;
+    uint8_t *cur;                    // Never-used bytes start here
+    uint8_t *end;
+    void *free[PENDING_CLASSES];
+} pending_slab_t;
+
+/*
+ * Id of every live file by path, built over the whole index when realtime
+ * mode starts. Slots hold ids alone and a probe compares the file's stored
+ * path, so the map costs four bytes a slot on top of paths the index keeps
+ * anyway. Update thread only: it is also the only writer of stored paths.
+ */
+typedef struct {
+    uint32_t *slots;                 // Ids, or PATH_ID_EMPTY / PATH_ID_TOMBSTONE
+    uint32_t cap;
+    uint32_t live;
+    uint32_t used;                   // Live and tombstoned slots
+} path_ids_t;
 
 static struct {
+    change_source_t source;
     int inotify_fd;
+    int fanotify_fd;
+    fan_mount_t fan_mounts[MAX_FAN_MOUNTS];
+    int num_fan_mounts;
     pthread_t update_thread;
     atomic_bool running;
     pthread_rwlock_t watch_lock;
     watch_mapping_t *watches;
-    path_cache_entry_t *path_cache;
-    lsm_batch_t pending_adds;
+    path_ids_t path_ids;               // Update thread only
+    pending_event_t *pending_events;   // Update thread only
+    pending_move_t *pending_moves;     // Update thread only
+    pending_slab_t slab;               // Update thread only
+    lsm_batch_t pending_adds;          // Adds and renames, applied in order
     lsm_batch_t pending_dels;
-    pthread_spinlock_t cache_lock;
+    pthread_mutex_t commit_lock;       // Serializes consumers, never taken by producers
+    pthread_t commit_thread;           // Drains the rings so producers never commit
+    atomic_bool committing;
+    pthread_mutex_t wait_lock;         // Guards commit_requested; wake and drained use it
+    pthread_cond_t wake;               // Producers ask the commit thread for a drain
+    pthread_cond_t drained;            // The commit thread finished a drain
+    bool commit_requested;
     qfind_index_t *index;
 } realtime_ctx;
 
 static void process_inotify_events(qfind_index_t *index);
-static void handle_file_event(qfind_index_t *index, const struct inotify_event *event, const char *base_path);
-static file_id_t path_to_id(const char *path);
-static void cache_path(const char *path, file_id_t id);
-static void uncache_path(const char *path);
+static void process_fanotify_events(qfind_index_t *index);
+static void queue_file_event(qfind_index_t *index, uint32_t mask, uint32_t cookie,
+                             const char *name, const char *path);
+static void flush_pending_events(qfind_index_t *index, bool force);
+static void handle_file_event(qfind_index_t *index, uint32_t mask, const char *path);
+static void handle_rename(qfind_index_t *index, const char *from, const char *to, bool is_dir);
+static file_id_t path_to_id(const qfind_index_t *index, const char *path);
+static int path_ids_insert(qfind_index_t *index, file_id_t id);
+static void path_ids_remove(const qfind_index_t *index, file_id_t id);
+static int path_ids_build(qfind_index_t *index);
+static void request_commit(bool wait);
+
+/* Ask the commit thread to drain the rings and, if wait, block until it has */
+static void request_commit(bool wait) {
+    pthread_mutex_lock(&realtime_ctx.wait_lock);
+    realtime_ctx.commit_requested = true;
+    pthread_cond_signal(&realtime_ctx.wake);
+    if (wait) pthread_cond_wait(&realtime_ctx.drained, &realtime_ctx.wait_lock);
+    pthread_mutex_unlock(&realtime_ctx.wait_lock);
+}
+
+static void *commit_thread_func(void *arg) {
+    qfind_index_t *index = (qfind_index_t*)arg;
+    pthread_mutex_lock(&realtime_ctx.wait_lock);
+    while (atomic_load(&realtime_ctx.committing)) {
+        if (!realtime_ctx.commit_requested) {
+            pthread_cond_wait(&realtime_ctx.wake, &realtime_ctx.wait_lock);
+            continue;
+        }
+        realtime_ctx.commit_requested = false;
+        pthread_mutex_unlock(&realtime_ctx.wait_lock);
+        qfind_commit_updates(index);
+        pthread_mutex_lock(&realtime_ctx.wait_lock);
+        pthread_cond_broadcast(&realtime_ctx.drained);
+    }
+    pthread_mutex_unlock(&realtime_ctx.wait_lock);
+    return NULL;
+}
+
+static void stop_commit_thread(void) {
+    pthread_mutex_lock(&realtime_ctx.wait_lock);
+    atomic_store(&realtime_ctx.committing, false);
+    pthread_cond_signal(&realtime_ctx.wake);
+    pthread_mutex_unlock(&realtime_ctx.wait_lock);
+    pthread_join(realtime_ctx.commit_thread, NULL);
+}
 
 static void* update_thread_func(void *arg) {
     qfind_index_t *index = (qfind_index_t*)arg;
-    struct pollfd pfd = { .fd = realtime_ctx.inotify_fd, .events = POLLIN };
+    bool use_fanotify = realtime_ctx.source == CHANGE_SOURCE_FANOTIFY;
+    struct pollfd pfd = {
+        .fd = use_fanotify ? realtime_ctx.fanotify_fd : realtime_ctx.inotify_fd,
+        .events = POLLIN
+    };
     
     while (atomic_load(&realtime_ctx.running)) {
-        int ready = poll(&pfd, 1, 30000);
+        bool have_pending = realtime_ctx.pending_events || realtime_ctx.pending_moves;
+        int ready = poll(&pfd, 1, have_pending ? EVENT_DEBOUNCE_MS : 30000);
         if (ready > 0) {
-            process_inotify_events(index);
+            if (use_fanotify) process_fanotify_events(index);
+            else process_inotify_events(index);
         }
         else if (ready < 0 && errno != EINTR) {
-            syslog(LOG_ERR, "inotify poll error: %s", strerror(errno));
+            syslog(LOG_ERR, "change source poll error: %s", strerror(errno));
             break;
         }
+
+        flush_pending_events(index, false);
         
         if (realtime_ctx.pending_adds.count >= LSM_BATCH_SIZE ||
             realtime_ctx.pending_dels.count >= LSM_BATCH_SIZE) {
-            qfind_commit_updates(index);
+            request_commit(false);
         }
     }
+    flush_pending_events(index, true);
     return NULL;
 }
 
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 static void process_inotify_events(qfind_index_t *index) {
     char buffer[EVENT_BUF_LEN] __attribute__ ((aligned(__alignof__(struct inotify_event))));
     ssize_t len;
@@ -90,6 +216,8 @@ static void process_inotify_events(qfind_index_t *index) {
     while ((len = read(realtime_ctx.inotify_fd, buffer, sizeof(buffer))) > 0) {
         for (char *ptr = buffer; ptr < buffer + len; ) {
             struct inotify_event *event = (struct inotify_event*)ptr;
+            ptr += sizeof(struct inotify_event) + event->len;
+
             pthread_rwlock_rdlock(&realtime_ctx.watch_lock);
             watch_mapping_t *wm;
             HASH_FIND_INT(realtime_ctx.watches, &event->wd, wm);
@@ -101,121 +229,627 @@ static void process_inotify_events(qfind_index_t *index) {
                     syslog(LOG_WARNING, "Path too long: %s/%s", wm->path, event->name);
                     continue;
                 }
-                handle_file_event(index, event, full_path);
+                queue_file_event(index, event->mask, event->cookie, event->name, full_path);
             }
-            
-            ptr += sizeof(struct inotify_event) + event->len;
         }
     }
 }
 
-static void handle_file_event(qfind_index_t *index, const struct inotify_event *event, const char *path) {
-    struct stat st;
-    if (lstat(path, &st) == -1) {
-        syslog(LOG_ERR, "Failed to stat %s: %s", path, strerror(errno));
-        return;
+static fan_mount_t *find_fan_mount(const __kernel_fsid_t *fsid) {
+    for (int i = 0; i < realtime_ctx.num_fan_mounts; i++) {
+        fan_mount_t *m = &realtime_ctx.fan_mounts[i];
+        if (m->fsid.val[0] == fsid->val[0] && m->fsid.val[1] == fsid->val[1]) return m;
     }
+    return NULL;
+}
 
-    if (fnmatch(".*", event->name, FNM_PERIOD) == 0) return;
+/* Turn a (directory handle, name) record from FAN_REPORT_DFID_NAME into a path */
+static int resolve_fanotify_path(const struct fanotify_event_info_fid *fid,
+                                 char *out, size_t out_len, const char **name_out) {
+    fan_mount_t *m = find_fan_mount(&fid->fsid);
+    if (!m) return -ENOENT;
 
-    if (event->mask & (IN_CREATE|IN_MOVED_TO|IN_MODIFY)) {
-        if (S_ISREG(st.st_mode)) {
-            file_id_t id = atomic_fetch_add(&index->num_files, 1);
-            
-            // Expand metadata array if needed
-            if (index->num_files % 1000 == 0) {
-                file_metadata_t *new_meta = realloc(index->file_metadata, 
-                    (index->num_files + 1000) * sizeof(file_metadata_t));
-                if (!new_meta) {
-                    syslog(LOG_CRIT, "Memory allocation failed for file metadata");
-                    return;
+    struct file_handle *handle = (struct file_handle*)fid->handle;
+    const char *name = (const char*)handle->f_handle + handle->handle_bytes;
+
+    int dir_fd = open_by_handle_at(m->mount_fd, handle, O_PATH | O_CLOEXEC);
+    if (dir_fd < 0) return -errno;
+
+    char proc_path[64];
+    char dir_path[PATH_MAX];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", dir_fd);
+    ssize_t len = readlink(proc_path, dir_path, sizeof(dir_path) - 1);
+    close(dir_fd);
+    if (len < 0) return -errno;
+    dir_path[len] = '\0';
+
+    // Events on the marked directory itself carry "." as the name
+    if (strcmp(name, ".") == 0) {
+        if (snprintf(out, out_len, "%s", dir_path) >= (int)out_len) return -ENAMETOOLONG;
+        const char *slash = strrchr(out, '/');
+        *name_out = slash ? slash + 1 : out;
+    } else {
+        int n = snprintf(out, out_len, "%s%s%s", dir_path,
+                         strcmp(dir_path, "/") == 0 ? "" : "/", name);
+        if (n >= (int)out_len) return -ENAMETOOLONG;
+        *name_out = out + n - strlen(name);
+    }
+    return 0;
+}
+
+static void process_fanotify_events(qfind_index_t *index) {
+    char buffer[EVENT_BUF_LEN] __attribute__ ((aligned(__alignof__(struct fanotify_event_metadata))));
+    ssize_t len;
+
+    while ((len = read(realtime_ctx.fanotify_fd, buffer, sizeof(buffer))) > 0) {
+        struct fanotify_event_metadata *meta = (struct fanotify_event_metadata*)buffer;
+
+        for (; FAN_EVENT_OK(meta, len); meta = FAN_EVENT_NEXT(meta, len)) {
+            if (meta->vers != FANOTIFY_METADATA_VERSION) {
+                syslog(LOG_ERR, "fanotify metadata version mismatch");
+                return;
+            }
+            if (meta->mask & FAN_Q_OVERFLOW) {
+                syslog(LOG_WARNING, "fanotify queue overflow, index may be stale until next --update");
+                continue;
+            }
+
+            // FAN_RENAME carries both ends of the move; plain events carry one record
+            char paths[2][PATH_MAX];
+            const char *names[2] = { NULL, NULL };
+            bool resolved = true;
+            char *info = (char*)(meta + 1);
+            char *info_end = (char*)meta + meta->event_len;
+
+            while (info < info_end) {
+                struct fanotify_event_info_fid *fid = (struct fanotify_event_info_fid*)info;
+                info += fid->hdr.len;
+                if (fid->hdr.len == 0) break;
+
+                int slot;
+                switch (fid->hdr.info_type) {
+                    case FAN_EVENT_INFO_TYPE_DFID_NAME:
+                    case FAN_EVENT_INFO_TYPE_OLD_DFID_NAME: slot = 0; break;
+                    case FAN_EVENT_INFO_TYPE_NEW_DFID_NAME: slot = 1; break;
+                    default: continue;
+                }
+
+                int ret = resolve_fanotify_path(fid, paths[slot], PATH_MAX, &names[slot]);
+                if (ret < 0) {
+                    // Directory may already be gone by the time we resolve it
+                    if (ret != -ESTALE && ret != -ENOENT)
+                        syslog(LOG_WARNING, "Failed to resolve fanotify event: %s", strerror(-ret));
+                    resolved = false;
                 }
-                index->file_metadata = new_meta;
             }
+            if (!resolved || !names[0]) continue;
+
+            if ((meta->mask & FAN_RENAME) && names[1]) {
+                if (fnmatch(".*", names[1], FNM_PERIOD) == 0)
+                    queue_file_event(index, IN_DELETE, 0, names[0], paths[0]);
+                else if (fnmatch(".*", names[0], FNM_PERIOD) == 0)
+                    queue_file_event(index, IN_CREATE, 0, names[1], paths[1]);
+                else
+                    handle_rename(index, paths[0], paths[1], meta->mask & FAN_ONDIR);
+                continue;
+            }
+
+            // FAN_* event bits share their values with the IN_* ones
+            uint32_t mask = meta->mask & (FAN_CREATE|FAN_DELETE|FAN_MOVED_FROM|FAN_MOVED_TO|FAN_MODIFY);
+            if (meta->mask & FAN_ONDIR) mask |= IN_ISDIR;
+            queue_file_event(index, mask, 0, names[0], paths[0]);
+        }
+    }
+}
+
+static int slab_class(size_t size) {
+    int c = 0;
+    while (((size_t)1 << (c + PENDING_MIN_SHIFT)) < size) c++;
+    return c;
+}
+
+static void *slab_alloc(size_t size) {
+    pending_slab_t *slab = &realtime_ctx.slab;
+    int c = slab_class(size);
+    if (c >= PENDING_CLASSES) return NULL;
+
+    void *p = slab->free[c];
+    if (p) {
+        slab->free[c] = *(void**)p;
+        return p;
+    }
+    size_t bytes = (size_t)1 << (c + PENDING_MIN_SHIFT);
+    if ((size_t)(slab->end - slab->cur) < bytes) return NULL;
+    p = slab->cur;
+    slab->cur += bytes;
+    return p;
+}
+
+static void slab_free(void *p, size_t size) {
+    int c = slab_class(size);
+    *(void**)p = realtime_ctx.slab.free[c];
+    realtime_ctx.slab.free[c] = p;
+}
+
+/* A record from the slab; a full slab applies every pending event early to make room */
+static void *pending_alloc(qfind_index_t *index, size_t size) {
+    void *p = slab_alloc(size);
+    if (!p) {
+        flush_pending_events(index, true);
+        p = slab_alloc(size);
+    }
+    if (!p) syslog(LOG_CRIT, "Pending event slab exhausted");
+    return p;
+}
+
+static void free_pending_event(pending_event_t *ev) {
+    slab_free(ev, sizeof(pending_event_t) + strlen(ev->path) + 1);
+}
+
+static void free_pending_move(pending_move_t *move) {
+    slab_free(move, sizeof(pending_move_t) + strlen(move->path) + 1);
+}
+
+static void queue_file_event(qfind_index_t *index, uint32_t mask, uint32_t cookie,
+                             const char *name, const char *path) {
+    if (fnmatch(".*", name, FNM_PERIOD) == 0) return;
+
+    uint64_t now = monotonic_ms();
+
+    if ((mask & IN_MOVED_FROM) && cookie) {
+        size_t len = strlen(path);
+        pending_move_t *move = pending_alloc(index, sizeof(pending_move_t) + len + 1);
+        if (!move) return;
+        move->cookie = cookie;
+        memcpy(move->path, path, len + 1);
+        move->mask = mask;
+        move->seen_ms = now;
+        HASH_ADD_INT(realtime_ctx.pending_moves, cookie, move);
+        return;
+    }
+
+    if ((mask & IN_MOVED_TO) && cookie) {
+        pending_move_t *move;
+        HASH_FIND_INT(realtime_ctx.pending_moves, &cookie, move);
+        if (move) {
+            HASH_DEL(realtime_ctx.pending_moves, move);
+            handle_rename(index, move->path, path, mask & IN_ISDIR);
+            free_pending_move(move);
+            return;
+        }
+    }
+
+    pending_event_t *ev;
+    HASH_FIND_STR(realtime_ctx.pending_events, path, ev);
+    if (!ev) {
+        size_t len = strlen(path);
+        ev = pending_alloc(index, sizeof(pending_event_t) + len + 1);
+        if (!ev) return;
+        memcpy(ev->path, path, len + 1);
+        ev->mask = 0;
+        HASH_ADD_KEYPTR(hh, realtime_ctx.pending_events, ev->path, len, ev);
+    }
+    ev->mask |= mask;
+    ev->last_seen_ms = now;
+}
+
+static void flush_pending_events(qfind_index_t *index, bool force) {
+    uint64_t now = monotonic_ms();
+
+    pending_move_t *move, *move_tmp;
+    HASH_ITER(hh, realtime_ctx.pending_moves, move, move_tmp) {
+        if (!force && now - move->seen_ms < MOVE_PAIR_TIMEOUT_MS) continue;
+        // Moved out of the watched tree
+        HASH_DEL(realtime_ctx.pending_moves, move);
+        handle_file_event(index, IN_DELETE | (move->mask & IN_ISDIR), move->path);
+        free_pending_move(move);
+    }
+
+    pending_event_t *ev, *ev_tmp;
+    HASH_ITER(hh, realtime_ctx.pending_events, ev, ev_tmp) {
+        if (!force && now - ev->last_seen_ms < EVENT_DEBOUNCE_MS) continue;
+        HASH_DEL(realtime_ctx.pending_events, ev);
+        handle_file_event(index, ev->mask, ev->path);
+        free_pending_event(ev);
+    }
+}
+
+static int lsm_batch_init(lsm_batch_t *batch) {
+    batch->ring = mmap(NULL, LSM_RING_SIZE, PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (batch->ring == MAP_FAILED) {
+        batch->ring = NULL;
+        return -errno;
+    }
+    batch->capacity = LSM_RING_SIZE;
+    atomic_init(&batch->head, 0);
+    atomic_init(&batch->tail, 0);
+    atomic_init(&batch->count, 0);
+    return 0;
+}
+
+static void lsm_batch_destroy(lsm_batch_t *batch) {
+    if (batch->ring) munmap(batch->ring, batch->capacity);
+    batch->ring = NULL;
+}
+
+/*
+ * Reserve a contiguous record with one CAS on head. A record that would
+ * straddle the ring end is preceded by a pad record, so every node is
+ * contiguous. Returns NULL when the ring is full.
+ */
+static lsm_node_t *lsm_reserve(lsm_batch_t *batch, size_t size) {
+    const uint64_t mask = batch->capacity - 1;
+    size = (size + 7) & ~(size_t)7;
+    uint64_t head = atomic_load_explicit(&batch->head, memory_order_relaxed);
+
+    for (;;) {
+        uint64_t pos = head & mask;
+        uint64_t pad = pos + size > batch->capacity ? batch->capacity - pos : 0;
+        uint64_t tail = atomic_load_explicit(&batch->tail, memory_order_acquire);
+        if (head + pad + size - tail > batch->capacity) return NULL;
+
+        if (atomic_compare_exchange_weak_explicit(&batch->head, &head, head + pad + size,
+                                                  memory_order_acq_rel, memory_order_relaxed)) {
+            if (pad) {
+                lsm_node_t *filler = (lsm_node_t*)(batch->ring + pos);
+                filler->size = pad;
+                atomic_store_explicit(&filler->state, LSM_NODE_PAD, memory_order_release);
+            }
+            lsm_node_t *node = (lsm_node_t*)(batch->ring + ((head + pad) & mask));
+            node->size = size;
+            return node;
+        }
+    }
+}
+
+/* Oldest record if its producer has published it; consumer side only */
+static lsm_node_t *lsm_peek(lsm_batch_t *batch) {
+    if (!batch->ring) return NULL;
+    const uint64_t mask = batch->capacity - 1;
+
+    for (;;) {
+        uint64_t tail = atomic_load_explicit(&batch->tail, memory_order_relaxed);
+        if (tail == atomic_load_explicit(&batch->head, memory_order_acquire)) return NULL;
+
+        lsm_node_t *node = (lsm_node_t*)(batch->ring + (tail & mask));
+        uint32_t state = atomic_load_explicit(&node->state, memory_order_acquire);
+        if (state == LSM_NODE_READY) return node;
+        if (state != LSM_NODE_PAD) return NULL;
+
+        uint32_t size = node->size;
+        memset(node, 0, size);
+        atomic_store_explicit(&batch->tail, tail + size, memory_order_release);
+    }
+}
+
+/* Hand a consumed record's bytes back to producers */
+static void lsm_release(lsm_batch_t *batch, lsm_node_t *node) {
+    uint64_t tail = atomic_load_explicit(&batch->tail, memory_order_relaxed);
+    uint32_t size = node->size;
+    // Zero the bytes so a stale header can never look published on the next lap
+    memset(node, 0, size);
+    atomic_fetch_sub_explicit(&batch->count, 1, memory_order_relaxed);
+    atomic_store_explicit(&batch->tail, tail + size, memory_order_release);
+}
+
+/*
+ * Lock- and allocation-free on the fast path. A full ring means the
+ * consumer is behind: the producer waits for the commit thread to drain
+ * it, so events back up into the change source instead of being dropped.
+ */
+static void lsm_enqueue(lsm_batch_t *batch, lsm_op_t op, file_id_t id, const char *path) {
+    size_t path_len = strlen(path);
+    size_t size = sizeof(lsm_node_t) + path_len + 1;
+
+    lsm_node_t *node;
+    while ((node = lsm_reserve(batch, size)) == NULL) request_commit(true);
+
+    node->id = id;
+    node->op = op;
+    node->path_len = path_len;
+    memcpy(node->path, path, path_len + 1);
 
-            // Initialize metadata
-            file_metadata_t *meta = &index->file_metadata[id];
-            strncpy(meta->path, path, PATH_MAX-1);
-            meta->path[PATH_MAX-1] = '\0';
-            meta->id = id;
-            meta->permissions = st.st_mode;
-            meta->modified = st.st_mtime;
-
-            lsm_node_t *node = malloc(sizeof(lsm_node_t));
-            if (!node) {
-                syslog(LOG_CRIT, "Failed to allocate LSM node");
+    // Counted before it is visible, so the consumer's decrement cannot underflow
+    atomic_fetch_add_explicit(&batch->count, 1, memory_order_relaxed);
+    atomic_store_explicit(&node->state, LSM_NODE_READY, memory_order_release);
+}
+
+/*
+ * Apply the coalesced events of one path. Events are collapsed by the
+ * path's current state rather than replayed, so a create+modify+delete
+ * burst inside the debounce window costs nothing.
+ */
+static void handle_file_event(qfind_index_t *index, uint32_t mask, const char *path) {
+    struct stat st;
+    bool exists = lstat(path, &st) == 0;
+    file_id_t id = path_to_id(index, path);
+
+    if (exists && (mask & (IN_CREATE|IN_MOVED_TO|IN_MODIFY))) {
+        if (S_ISREG(st.st_mode)) {
+            if (id != INVALID_FILE_ID) {
+                // Trigrams depend only on the path: refresh the attribute columns in place
+                db_entry_t attr;
+                meta_entry_from_stat(&attr, &st);
+                meta_columns_set(&index->cols, id, &attr);
+                index_changed(index, false);
                 return;
             }
-            node->path = strdup(path);
-            node->is_add = true;
-            node->id = id;
-            node->next = NULL;
-
-            pthread_spin_lock(&realtime_ctx.cache_lock);
-            cache_path(path, id);
-            pthread_spin_unlock(&realtime_ctx.cache_lock);
-
-            pthread_spin_lock(&realtime_ctx.pending_adds.lock);
-            if (!realtime_ctx.pending_adds.head) {
-                realtime_ctx.pending_adds.head = node;
-            } else {
-                realtime_ctx.pending_adds.tail->next = node;
+
+            // The metadata array and path arena are shared with readers
+            pthread_rwlock_wrlock(&index->index_lock);
+            id = index->num_files;
+            db_entry_t attr;
+            meta_entry_from_stat(&attr, &st);
+            int ret = index_append_metadata(index, path, &attr);
+            pthread_rwlock_unlock(&index->index_lock);
+            if (ret != 0 || path_ids_insert(index, id) != 0) {
+                syslog(LOG_CRIT, "Memory allocation failed for file metadata");
+                return;
             }
-            realtime_ctx.pending_adds.tail = node;
-            realtime_ctx.pending_adds.count++;
-            pthread_spin_unlock(&realtime_ctx.pending_adds.lock);
+
+            lsm_enqueue(&realtime_ctx.pending_adds, LSM_ADD, id, path);
         }
-        else if (S_ISDIR(st.st_mode)) {
+        else if (S_ISDIR(st.st_mode) && realtime_ctx.source == CHANGE_SOURCE_INOTIFY) {
+            // Filesystem marks already cover new directories
             add_watch_recursive(path);
         }
     }
-    else if (event->mask & (IN_DELETE|IN_MOVED_FROM|IN_DELETE_SELF)) {
-        pthread_spin_lock(&realtime_ctx.cache_lock);
-        file_id_t id = path_to_id(path);
+    else if (!exists && (mask & (IN_DELETE|IN_MOVED_FROM|IN_DELETE_SELF|IN_MODIFY))) {
         if (id != INVALID_FILE_ID) {
-            lsm_node_t *node = malloc(sizeof(lsm_node_t));
-            if (!node) {
-                syslog(LOG_CRIT, "Failed to allocate LSM node");
-                pthread_spin_unlock(&realtime_ctx.cache_lock);
-                return;
-            }
-            node->path = strdup(path);
-            node->is_add = false;
-            node->id = id;
-            node->next = NULL;
-
-            pthread_spin_lock(&realtime_ctx.pending_dels.lock);
-            if (!realtime_ctx.pending_dels.head) {
-                realtime_ctx.pending_dels.head = node;
-            } else {
-                realtime_ctx.pending_dels.tail->next = node;
+            path_ids_remove(index, id);
+            lsm_enqueue(&realtime_ctx.pending_dels, LSM_DEL, id, path);
+        }
+    }
+}
+
+static bool has_path_prefix(const char *path, const char *prefix, size_t prefix_len) {
+    return strncmp(path, prefix, prefix_len) == 0 && path[prefix_len] == '/';
+}
+
+/* Point file id at a copy of path, keeping the path map in step; caller holds index_lock */
+static int move_stored_path(qfind_index_t *index, file_id_t id, const char *path) {
+    // The old bytes stay in the arena until the index is destroyed
+    char *moved = arena_strdup(&index->path_arena, path);
+    if (!moved) return -ENOMEM;
+    path_ids_remove(index, id);
+    index->file_metadata[id].path = moved;
+    return path_ids_insert(index, id);
+}
+
+/*
+ * Rename in place: ids are kept, and stored paths, the path map and
+ * watches are rewritten now, so later events find the files under their
+ * new names. One LSM_RENAME node indexes the new paths at commit time, no
+ * matter how many descendants a renamed directory has.
+ */
+static void handle_rename(qfind_index_t *index, const char *from, const char *to, bool is_dir) {
+    if (strlen(to) >= PATH_MAX) return;
+
+    // Anything still debouncing under the old name now lives under the new one
+    pending_event_t *ev;
+    HASH_FIND_STR(realtime_ctx.pending_events, from, ev);
+    if (ev) {
+        HASH_DEL(realtime_ctx.pending_events, ev);
+        free_pending_event(ev);
+        queue_file_event(index, IN_CREATE, 0, "", to);
+    }
+
+    size_t from_len = strlen(from);
+    file_id_t id = INVALID_FILE_ID;
+    file_id_t *moved = NULL;
+    uint32_t num_moved = 0, moved_cap = 0;
+
+    if (!is_dir) {
+        id = path_to_id(index, from);
+        if (id == INVALID_FILE_ID) {
+            // Not indexed under its old name; index it under the new one
+            queue_file_event(index, IN_CREATE, 0, "", to);
+            return;
+        }
+        // Renamed over an indexed file, which goes away
+        file_id_t replaced = path_to_id(index, to);
+        if (replaced != INVALID_FILE_ID && replaced != id) {
+            path_ids_remove(index, replaced);
+            lsm_enqueue(&realtime_ctx.pending_dels, LSM_DEL, replaced, to);
+        }
+        moved = &id;
+        num_moved = 1;
+    } else {
+        // Only this thread rewrites paths; the read lock keeps commit's deletes out
+        pthread_rwlock_rdlock(&index->index_lock);
+        for (uint32_t i = 0; i < index->num_files; i++) {
+            const char *path = index->file_metadata[i].path;
+            if (!has_path_prefix(path, from, from_len) || path_to_id(index, path) != i) continue;
+            if (num_moved == moved_cap) {
+                moved_cap = moved_cap ? moved_cap * 2 : 64;
+                file_id_t *grown = realloc(moved, moved_cap * sizeof(file_id_t));
+                if (!grown) break;
+                moved = grown;
             }
-            realtime_ctx.pending_dels.tail = node;
-            realtime_ctx.pending_dels.count++;
-            pthread_spin_unlock(&realtime_ctx.pending_dels.lock);
+            moved[num_moved++] = i;
+        }
+        pthread_rwlock_unlock(&index->index_lock);
+    }
 
-            uncache_path(path);
+    pthread_rwlock_wrlock(&index->index_lock);
+    for (uint32_t i = 0; i < num_moved; i++) {
+        const char *old = index->file_metadata[moved[i]].path;
+        char new_path[PATH_MAX];
+        if (snprintf(new_path, sizeof(new_path), "%s%s", to, old + from_len) >= PATH_MAX) {
+            syslog(LOG_WARNING, "Renamed path too long: %s%s", to, old + from_len);
+            continue;
         }
-        pthread_spin_unlock(&realtime_ctx.cache_lock);
+        if (move_stored_path(index, moved[i], new_path) != 0) {
+            syslog(LOG_CRIT, "Memory allocation failed for renamed path");
+            break;
+        }
+    }
+    index_changed(index, false);
+    pthread_rwlock_unlock(&index->index_lock);
+    if (is_dir) free(moved);
+
+    if (is_dir && realtime_ctx.source == CHANGE_SOURCE_INOTIFY) {
+        // Watch descriptors follow the inode; only their recorded paths change
+        watch_mapping_t *wm, *tmp;
+        pthread_rwlock_wrlock(&realtime_ctx.watch_lock);
+        HASH_ITER(hh, realtime_ctx.watches, wm, tmp) {
+            if (strcmp(wm->path, from) != 0 && !has_path_prefix(wm->path, from, from_len)) continue;
+            char new_path[PATH_MAX];
+            if (snprintf(new_path, sizeof(new_path), "%s%s", to, wm->path + from_len) < PATH_MAX)
+                strcpy(wm->path, new_path);
+        }
+        pthread_rwlock_unlock(&realtime_ctx.watch_lock);
+    }
+
+    lsm_enqueue(&realtime_ctx.pending_adds, LSM_RENAME, id, to);
+}
+
+static bool is_pseudo_filesystem(const char *type) {
+    static const char *pseudo[] = {
+        "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "securityfs",
+        "debugfs", "tracefs", "pstore", "bpf", "mqueue", "hugetlbfs", "configfs",
+        "fusectl", "autofs", "binfmt_misc", "efivarfs", "nsfs"
+    };
+    for (size_t i = 0; i < sizeof(pseudo)/sizeof(pseudo[0]); i++) {
+        if (strcmp(type, pseudo[i]) == 0) return true;
     }
+    return false;
+}
+
+/*
+ * Place one FAN_MARK_FILESYSTEM mark per distinct filesystem mounted
+ * under root, so startup cost depends on the mount table, not on the
+ * number of directories.
+ */
+static int init_fanotify_source(const char *root) {
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+                           O_RDONLY | O_LARGEFILE);
+    if (fd < 0) return -errno;
+
+    FILE *mounts = setmntent("/proc/self/mounts", "r");
+    if (!mounts) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+
+    size_t root_len = strlen(root);
+    uint64_t mask = FAN_EVENT_MASK | FAN_RENAME;
+    struct mntent *ent;
+    realtime_ctx.num_fan_mounts = 0;
+
+    while ((ent = getmntent(mounts)) != NULL) {
+        if (is_pseudo_filesystem(ent->mnt_type)) continue;
+        if (strcmp(root, "/") != 0 &&
+            (strncmp(ent->mnt_dir, root, root_len) != 0 ||
+             (ent->mnt_dir[root_len] != '/' && ent->mnt_dir[root_len] != '\0'))) continue;
+
+        struct statfs sfs;
+        if (statfs(ent->mnt_dir, &sfs) != 0) continue;
+
+        __kernel_fsid_t fsid;
+        memcpy(&fsid, &sfs.f_fsid, sizeof(fsid));
+        if (find_fan_mount(&fsid)) continue;
+
+        if (realtime_ctx.num_fan_mounts >= MAX_FAN_MOUNTS) {
+            syslog(LOG_WARNING, "Too many filesystems, not watching %s", ent->mnt_dir);
+            continue;
+        }
+
+        int ret = fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, ent->mnt_dir);
+        if (ret != 0 && errno == EINVAL && (mask & FAN_RENAME)) {
+            // FAN_RENAME needs Linux 5.17; renames then arrive as unpaired moves
+            mask &= ~(uint64_t)FAN_RENAME;
+            ret = fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, ent->mnt_dir);
+        }
+        if (ret != 0) {
+            // Filesystems without file handle support (e.g. some FUSE) can't be marked
+            syslog(LOG_WARNING, "fanotify_mark(%s) failed: %s", ent->mnt_dir, strerror(errno));
+            continue;
+        }
+
+        int mount_fd = open(ent->mnt_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (mount_fd < 0) continue;
+
+        realtime_ctx.fan_mounts[realtime_ctx.num_fan_mounts++] = (fan_mount_t){
+            .fsid = fsid,
+            .mount_fd = mount_fd
+        };
+    }
+    endmntent(mounts);
+
+    if (realtime_ctx.num_fan_mounts == 0) {
+        close(fd);
+        return -ENODEV;
+    }
+
+    realtime_ctx.fanotify_fd = fd;
+    return 0;
+}
+
+static void close_fanotify_source(void) {
+    for (int i = 0; i < realtime_ctx.num_fan_mounts; i++) {
+        close(realtime_ctx.fan_mounts[i].mount_fd);
+    }
+    realtime_ctx.num_fan_mounts = 0;
+    close(realtime_ctx.fanotify_fd);
 }
 
 int init_realtime_updates(qfind_index_t *index) {
-    realtime_ctx.inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
-    if (realtime_ctx.inotify_fd < 0) {
-        syslog(LOG_ERR, "inotify_init failed: %s", strerror(errno));
-        return -1;
+    // fanotify needs CAP_SYS_ADMIN and Linux 5.9+; fall back to inotify otherwise
+    int ret = init_fanotify_source("/");
+    if (ret == 0) {
+        realtime_ctx.source = CHANGE_SOURCE_FANOTIFY;
+    } else {
+        syslog(LOG_INFO, "fanotify unavailable (%s), using inotify watches", strerror(-ret));
+        realtime_ctx.source = CHANGE_SOURCE_INOTIFY;
+        realtime_ctx.inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+        if (realtime_ctx.inotify_fd < 0) {
+            syslog(LOG_ERR, "inotify_init failed: %s", strerror(errno));
+            return -1;
+        }
     }
 
     pthread_rwlock_init(&realtime_ctx.watch_lock, NULL);
-    pthread_spin_init(&realtime_ctx.cache_lock, PTHREAD_PROCESS_PRIVATE);
-    pthread_spin_init(&realtime_ctx.pending_adds.lock, PTHREAD_PROCESS_PRIVATE);
-    pthread_spin_init(&realtime_ctx.pending_dels.lock, PTHREAD_PROCESS_PRIVATE);
+    pthread_mutex_init(&realtime_ctx.commit_lock, NULL);
+    if (lsm_batch_init(&realtime_ctx.pending_adds) != 0 ||
+        lsm_batch_init(&realtime_ctx.pending_dels) != 0) {
+        syslog(LOG_CRIT, "Failed to map LSM update rings");
+        lsm_batch_destroy(&realtime_ctx.pending_adds);
+        return -1;
+    }
+    if (path_ids_build(index) != 0) {
+        syslog(LOG_CRIT, "Memory allocation failed for the path map");
+        lsm_batch_destroy(&realtime_ctx.pending_adds);
+        lsm_batch_destroy(&realtime_ctx.pending_dels);
+        return -1;
+    }
+    realtime_ctx.slab.base = mmap(NULL, PENDING_SLAB_SIZE, PROT_READ|PROT_WRITE,
+                                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (realtime_ctx.slab.base == MAP_FAILED) {
+        syslog(LOG_CRIT, "Failed to map the pending event slab");
+        lsm_batch_destroy(&realtime_ctx.pending_adds);
+        lsm_batch_destroy(&realtime_ctx.pending_dels);
+        return -1;
+    }
+    realtime_ctx.slab.cur = realtime_ctx.slab.base;
+    realtime_ctx.slab.end = realtime_ctx.slab.base + PENDING_SLAB_SIZE;
     atomic_store(&realtime_ctx.running, true);
     realtime_ctx.index = index;
 
+    pthread_mutex_init(&realtime_ctx.wait_lock, NULL);
+    pthread_cond_init(&realtime_ctx.wake, NULL);
+    pthread_cond_init(&realtime_ctx.drained, NULL);
+    atomic_store(&realtime_ctx.committing, true);
+    if (pthread_create(&realtime_ctx.commit_thread, NULL, commit_thread_func, index)) {
+        syslog(LOG_ERR, "Failed to start commit thread: %s", strerror(errno));
+        return -1;
+    }
+
     const char *watch_paths[] = { "/" };
-    for (size_t i = 0; i < sizeof(watch_paths)/sizeof(watch_paths[0]); i++) {
+    for (size_t i = 0; realtime_ctx.source == CHANGE_SOURCE_INOTIFY &&
+                       i < sizeof(watch_paths)/sizeof(watch_paths[0]); i++) {
         if (add_watch_recursive(watch_paths[i]) < 0) {
             syslog(LOG_ERR, "Failed to initialize watch points");
             stop_realtime_updates();
@@ -225,7 +859,9 @@ int init_realtime_updates(qfind_index_t *index) {
 
     if (pthread_create(&realtime_ctx.update_thread, NULL, update_thread_func, index)) {
         syslog(LOG_ERR, "Failed to start update thread: %s", strerror(errno));
-        close(realtime_ctx.inotify_fd);
+        stop_commit_thread();
+        if (realtime_ctx.source == CHANGE_SOURCE_FANOTIFY) close_fanotify_source();
+        else close(realtime_ctx.inotify_fd);
         return -1;
     }
 
@@ -275,40 +911,51 @@ int add_watch_recursive(const char *path) {
     return wd;
 }
 
-int qfind_commit_updates(qfind_index_t *index) {
-    lsm_batch_t adds = {0}, dels = {0};
-
-    pthread_spin_lock(&realtime_ctx.pending_adds.lock);
-    adds = realtime_ctx.pending_adds;
-    realtime_ctx.pending_adds = (lsm_batch_t){0};
-    pthread_spin_unlock(&realtime_ctx.pending_adds.lock);
+/*
+ * Index the paths a rename moved; handle_rename() already rewrote them.
+ * Postings for the old paths stay behind until the next full build; they
+ * only produce candidates that fail verification.
+ */
+static void apply_rename(qfind_index_t *index, const lsm_node_t *node) {
+    pthread_rwlock_rdlock(&index->index_lock);
+    if (node->id != INVALID_FILE_ID) {
+        const char *path = index->file_metadata[node->id].path;
+        if (path[0]) add_file_to_index(index, path, node->id);
+    } else {
+        for (uint32_t i = 0; i < index->num_files; i++) {
+            const char *path = index->file_metadata[i].path;
+            if (has_path_prefix(path, node->path, node->path_len)) add_file_to_index(index, path, i);
+        }
+    }
+    pthread_rwlock_unlock(&index->index_lock);
+}
 
-    pthread_spin_lock(&realtime_ctx.pending_dels.lock);
-    dels = realtime_ctx.pending_dels;
-    realtime_ctx.pending_dels = (lsm_batch_t){0};
-    pthread_spin_unlock(&realtime_ctx.pending_dels.lock);
+int qfind_commit_updates(qfind_index_t *index) {
+    pthread_mutex_lock(&realtime_ctx.commit_lock);
 
-    // Process additions
-    for (lsm_node_t *node = adds.head; node; node = node->next) {
-        add_file_to_index(index, node->path, node->id);
-        free(node->path);
-        free(node);
+    // Process additions and renames
+    lsm_node_t *node;
+    while ((node = lsm_peek(&realtime_ctx.pending_adds)) != NULL) {
+        if (node->op == LSM_RENAME) apply_rename(index, node);
+        else add_file_to_index(index, node->path, node->id);
+        lsm_release(&realtime_ctx.pending_adds, node);
     }
 
-    // Process deletions
-    for (lsm_node_t *node = dels.head; node; node = node->next) {
-        for (uint32_t i = 0; i < index->num_files; i++) {
-            if (strcmp(index->file_metadata[i].path, node->path) == 0) {
-                index->file_metadata[i].path[0] = '\0';
-                break;
-            }
-        }
-        free(node->path);
-        free(node);
+    // Process deletions; their ids already left the path map
+    pthread_rwlock_wrlock(&index->index_lock);
+    while ((node = lsm_peek(&realtime_ctx.pending_dels)) != NULL) {
+        index->file_metadata[node->id].path[0] = '\0';
+        lsm_release(&realtime_ctx.pending_dels, node);
     }
 
-    compress_posting_lists(index);
-    return 0;
+    // Merged into the installed lists under the lock, so no query sees them half replaced
+    int ret = compress_posting_lists(index);
+    index_changed(index, true);
+    short_index_build(index);
+    plan_prepare(index);
+    pthread_rwlock_unlock(&index->index_lock);
+    pthread_mutex_unlock(&realtime_ctx.commit_lock);
+    return ret;
 }
 
 int stop_realtime_updates() {
@@ -324,30 +971,99 @@ int stop_realtime_updates() {
     }
     pthread_rwlock_unlock(&realtime_ctx.watch_lock);
 
-    close(realtime_ctx.inotify_fd);
+    if (realtime_ctx.source == CHANGE_SOURCE_FANOTIFY) close_fanotify_source();
+    else close(realtime_ctx.inotify_fd);
+    stop_commit_thread();
     qfind_commit_updates(realtime_ctx.index);
+
+    lsm_batch_destroy(&realtime_ctx.pending_adds);
+    lsm_batch_destroy(&realtime_ctx.pending_dels);
+    pthread_mutex_destroy(&realtime_ctx.commit_lock);
+    pthread_mutex_destroy(&realtime_ctx.wait_lock);
+    pthread_cond_destroy(&realtime_ctx.wake);
+    pthread_cond_destroy(&realtime_ctx.drained);
+    munmap(realtime_ctx.slab.base, PENDING_SLAB_SIZE);
+    realtime_ctx.slab = (pending_slab_t){ 0 };
+    free(realtime_ctx.path_ids.slots);
+    realtime_ctx.path_ids = (path_ids_t){ 0 };
+    return 0;
+}
+
+static uint32_t path_ids_home(const path_ids_t *map, const char *path) {
+    return XXH3_64bits(path, strlen(path)) & (map->cap - 1);
+}
+
+static file_id_t path_to_id(const qfind_index_t *index, const char *path) {
+    const path_ids_t *map = &realtime_ctx.path_ids;
+    if (!map->slots) return INVALID_FILE_ID;
+    for (uint32_t i = path_ids_home(map, path);; i = (i + 1) & (map->cap - 1)) {
+        uint32_t id = map->slots[i];
+        if (id == PATH_ID_EMPTY) return INVALID_FILE_ID;
+        if (id != PATH_ID_TOMBSTONE && strcmp(index->file_metadata[id].path, path) == 0) return id;
+    }
+}
+
+/* Re-insert the live ids into cap slots, dropping tombstones */
+static int path_ids_resize(const qfind_index_t *index, uint32_t cap) {
+    path_ids_t *map = &realtime_ctx.path_ids;
+    uint32_t *slots = malloc((size_t)cap * sizeof(uint32_t));
+    if (!slots) return -ENOMEM;
+    memset(slots, 0xff, (size_t)cap * sizeof(uint32_t));
+
+    path_ids_t grown = { slots, cap, map->live, map->live };
+    for (uint32_t i = 0; i < map->cap; i++) {
+        uint32_t id = map->slots[i];
+        if (id == PATH_ID_EMPTY || id == PATH_ID_TOMBSTONE) continue;
+        uint32_t j = path_ids_home(&grown, index->file_metadata[id].path);
+        while (slots[j] != PATH_ID_EMPTY) j = (j + 1) & (cap - 1);
+        slots[j] = id;
+    }
+    free(map->slots);
+    *map = grown;
     return 0;
 }
 
-static file_id_t path_to_id(const char *path) {
-    path_cache_entry_t *entry;
-    HASH_FIND_STR(realtime_ctx.path_cache, path, entry);
-    return entry ? entry->id : INVALID_FILE_ID;
+/* Map id's stored path to id; the path must not be mapped already */
+static int path_ids_insert(qfind_index_t *index, file_id_t id) {
+    path_ids_t *map = &realtime_ctx.path_ids;
+    // Keep at least a quarter of the slots empty so probes stay short
+    if ((uint64_t)(map->used + 1) * 4 > (uint64_t)map->cap * 3) {
+        uint32_t cap = map->cap ? map->cap : PATH_IDS_INIT;
+        while ((uint64_t)(map->live + 1) * 2 > cap) cap *= 2;
+        if (path_ids_resize(index, cap) != 0) return -ENOMEM;
+    }
+
+    uint32_t i = path_ids_home(map, index->file_metadata[id].path);
+    while (map->slots[i] != PATH_ID_EMPTY && map->slots[i] != PATH_ID_TOMBSTONE)
+        i = (i + 1) & (map->cap - 1);
+    if (map->slots[i] == PATH_ID_EMPTY) map->used++;
+    map->slots[i] = id;
+    map->live++;
+    return 0;
 }
 
-static void cache_path(const char *path, file_id_t id) {
-    path_cache_entry_t *entry = malloc(sizeof(path_cache_entry_t));
-    strncpy(entry->path, path, PATH_MAX-1);
-    entry->path[PATH_MAX-1] = '\0';
-    entry->id = id;
-    HASH_ADD_STR(realtime_ctx.path_cache, path, entry);
+/* Unmap id, found through its stored path */
+static void path_ids_remove(const qfind_index_t *index, file_id_t id) {
+    path_ids_t *map = &realtime_ctx.path_ids;
+    if (!map->slots) return;
+    for (uint32_t i = path_ids_home(map, index->file_metadata[id].path);; i = (i + 1) & (map->cap - 1)) {
+        if (map->slots[i] == PATH_ID_EMPTY) return;
+        if (map->slots[i] == id) {
+            map->slots[i] = PATH_ID_TOMBSTONE;
+            map->live--;
+            return;
+        }
+    }
 }
 
-static void uncache_path(const char *path) {
-    path_cache_entry_t *entry;
-    HASH_FIND_STR(realtime_ctx.path_cache, path, entry);
-    if (entry) {
-        HASH_DEL(realtime_ctx.path_cache, entry);
-        free(entry);
+static int path_ids_build(qfind_index_t *index) {
+    pthread_rwlock_rdlock(&index->index_lock);
+    uint32_t cap = PATH_IDS_INIT;
+    while ((uint64_t)index->num_files * 2 > cap) cap *= 2;
+    int ret = path_ids_resize(index, cap);
+    for (uint32_t id = 0; id < index->num_files && ret == 0; id++) {
+        if (index->file_metadata[id].path[0]) ret = path_ids_insert(index, id);
     }
+    pthread_rwlock_unlock(&index->index_lock);
+    return ret;
 }
@@ -1,5 +1,6 @@
 #include "qfind.h"
 #include <zstd.h>
+#include <zdict.h>
 #include <immintrin.h>
 #include <sys/mman.h>
 #include <errno.h>
@@ -8,21 +9,41 @@
 #include <math.h>
 
 #define GOLOMB_OPT_WINDOW 64
-#define TRIE_GROW_SIZE 256
-#define POSTING_CHUNK 4096
+#define POSTING_INLINE 4              // Ids stored in the table slot itself
+#define POSTING_FIRST_CHUNK 16        // Capacity of a list's first chained chunk
+#define POSTING_TIER_GROWTH 4
+#define POSTING_CHUNK 4096            // Largest chunk capacity
 #define ALIGNMENT 64
 #define MAX_LOAD_FACTOR 0.7
 #define INITIAL_CAPACITY (1U << 20)
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define POSTING_DICT_CAPACITY (112 * 1024)            // zstd's recommended dictionary size
+#define POSTING_DICT_SAMPLE_BUDGET (100 * POSTING_DICT_CAPACITY)
+#define POSTING_DICT_MIN_SAMPLES 64
+#define RUN_IO_BUFFER (1 << 20)       // stdio buffer per spilled run
+#define MIN_RUN_BYTES (16 << 20)
+
+/*
+ * Posting accumulator chunk. A list's first POSTING_INLINE ids live in its
+ * table slot; later ones go to a chain of chunks whose capacity grows by
+ * POSTING_TIER_GROWTH per link up to POSTING_CHUNK, so rare trigrams stay
+ * small and appends never move existing ids.
+ */
+typedef struct posting_chunk {
+    struct posting_chunk *next;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t ids[];
+} posting_chunk_t;
 
 typedef struct {
     trigram_t trigram;
-    uint32_t *deltas;
-    size_t capacity;
-    size_t count;
+    uint32_t count;                  // Total ids, inline and chained
+    uint32_t inline_ids[POSTING_INLINE];
+    posting_chunk_t *head;
+    posting_chunk_t *tail;
     size_t offset;
     size_t size;
-    UT_hash_handle hh;
+    uint32_t num_ids;                // Distinct ids, set when the list is encoded
 } trigram_entry;
 
 typedef struct {
@@ -30,6 +51,12 @@ typedef struct {
     size_t capacity;
     size_t count;
     pthread_rwlock_t lock;
+    arena_t postings;                // Posting chunks, released with the table
+    uint32_t width;                  // uint32 slots per posting: id, or id and position
+    FILE **runs;                     // Spilled sorted runs, see spill_run()
+    size_t num_runs;
+    size_t runs_cap;
+    bool spill_failed;               // A run could not be written; the build is lost
     ZSTD_CCtx *zstd_cctx;
     ZSTD_DCtx *zstd_dctx;
 } inverted_index;
@@ -89,51 +116,65 @@ static uint8_t calculate_golomb_param(const uint32_t *deltas, size_t count) {
         total += deltas[i];
     }
     uint32_t average = total / count;
-    return (uint8_t)(log2(MAX(1, average)) + 0.5);
+    return (uint8_t)MIN(log2(MAX(1, average)) + 0.5, 24.0);
 }
 
+/*
+ * Golomb-Rice bitstream, MSB first: quotient in unary (q one-bits and a
+ * zero), then the k low bits. The last byte is zero-padded.
+ */
 static size_t golomb_encode_scalar(const uint32_t *deltas, size_t count, 
                                   uint8_t *output, uint8_t k) {
     uint8_t *out = output;
-    const uint32_t mask = (1 << k) - 1;
+    uint64_t bits = 0;
+    unsigned nbits = 0;
     
     for (size_t i = 0; i < count; i++) {
         uint32_t q = deltas[i] >> k;
-        uint32_t r = deltas[i] & mask;
-        
-        while (q > 0) {
-            *out++ = 0xFF;
-            q--;
+
+        while (q >= 32) {
+            bits = (bits << 32) | 0xFFFFFFFFu;
+            nbits += 32;
+            while (nbits >= 8) *out++ = bits >> (nbits -= 8);
+            q -= 32;
         }
-        *out++ = (uint8_t)r;
+        bits = (bits << (q + 1)) | (((1ULL << q) - 1) << 1);
+        nbits += q + 1;
+        bits = (bits << k) | (deltas[i] & ((1U << k) - 1));
+        nbits += k;
+        while (nbits >= 8) *out++ = bits >> (nbits -= 8);
     }
+    if (nbits > 0) *out++ = bits << (8 - nbits);
     
     return out - output;
 }
 
-
-
-/* Buffer management */
-static trigram_entry* create_trigram_entry() {
-    trigram_entry *entry = aligned_alloc(ALIGNMENT, sizeof(trigram_entry));
-    if (!entry) return NULL;
-    
-    entry->deltas = aligned_alloc(ALIGNMENT, POSTING_CHUNK * sizeof(uint32_t));
-    if (!entry->deltas) {
-        free(entry);
-        return NULL;
+static size_t put_varint(uint8_t *out, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
     }
-    
-    entry->capacity = POSTING_CHUNK;
-    entry->count = 0;
-    return entry;
+    out[n++] = v;
+    return n;
 }
 
-static void free_trigram_entry(trigram_entry *entry) {
-    if (entry) {
-        free(entry->deltas);
-        free(entry);
+/*
+ * ASCII-folded trigrams of text, one per byte offset: out[i] is the
+ * trigram starting at text[i], so duplicates are kept and the index of a
+ * trigram is its position.
+ */
+void extract_trigrams(const char *text, trigram_t *out, size_t *out_count, size_t max_out) {
+    size_t len = strlen(text);
+    size_t n = 0;
+
+    for (size_t i = 0; i + TRIGRAM_SIZE <= len && n < max_out; i++) {
+        const unsigned char *p = (const unsigned char*)text + i;
+        out[n++] = (trigram_t)fold_ascii(p[0]) |
+                   (trigram_t)fold_ascii(p[1]) << 8 |
+                   (trigram_t)fold_ascii(p[2]) << 16;
     }
+    *out_count = n;
 }
 
 /* Quadratic probing hash table */
@@ -153,29 +194,202 @@ static trigram_entry* find_trigram_entry(trigram_t trigram) {
 
 static int resize_trigram_table() {
     const size_t new_capacity = idx.capacity * 2;
-    trigram_entry *new_entries = mmap(NULL, new_capacity * sizeof(trigram_entry),
-                                     PROT_READ|PROT_WRITE, 
-                                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
-    if (new_entries == MAP_FAILED) {
-        new_entries = aligned_alloc(ALIGNMENT, new_capacity * sizeof(trigram_entry));
-        if (!new_entries) return -1;
-    }
+    trigram_entry *old_entries = idx.entries;
+    const size_t old_capacity = idx.capacity;
+    trigram_entry *new_entries = huge_map(new_capacity * sizeof(trigram_entry));
+    if (!new_entries) return -1;
 
-    memset(new_entries, 0, new_capacity * sizeof(trigram_entry));
-    
-    for (size_t i = 0; i < idx.capacity; i++) {
-        trigram_entry *old_entry = &idx.entries[i];
+    // find_trigram_entry() probes idx, so point it at the new table first
+    idx.entries = new_entries;
+    idx.capacity = new_capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        trigram_entry *old_entry = &old_entries[i];
         if (old_entry->count == 0) continue;
 
         trigram_entry *new_entry = find_trigram_entry(old_entry->trigram);
         memcpy(new_entry, old_entry, sizeof(trigram_entry));
     }
 
-    if (idx.entries != MAP_FAILED) 
-        munmap(idx.entries, idx.capacity * sizeof(trigram_entry));
-    
-    idx.entries = new_entries;
-    idx.capacity = new_capacity;
+    huge_unmap(old_entries, old_capacity * sizeof(trigram_entry));
+    return 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static int ensure_capacity(void **buf, size_t *cap, size_t need, size_t elem) {
+    if (*cap >= need) return 0;
+    size_t new_cap = MAX(need, *cap * 2);
+    void *grown = realloc(*buf, new_cap * elem);
+    if (!grown) return -1;
+    *buf = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+ * Append one posting (idx.width slots): inline while it fits, then into the
+ * tail chunk of the chain. Every capacity is even, so an (id, position)
+ * pair never straddles two chunks.
+ */
+static int posting_append(trigram_entry *entry, uint32_t id, uint32_t pos) {
+    if (entry->count < POSTING_INLINE) {
+        entry->inline_ids[entry->count++] = id;
+        if (idx.width == 2) entry->inline_ids[entry->count++] = pos;
+        return 0;
+    }
+
+    posting_chunk_t *tail = entry->tail;
+    if (!tail || tail->count == tail->capacity) {
+        uint32_t capacity = tail ? MIN(tail->capacity * POSTING_TIER_GROWTH, POSTING_CHUNK)
+                                 : POSTING_FIRST_CHUNK;
+        posting_chunk_t *chunk = arena_alloc(&idx.postings,
+            sizeof(posting_chunk_t) + capacity * sizeof(uint32_t), ALIGNMENT);
+        if (!chunk) return -1;
+        chunk->capacity = capacity;
+        if (tail) tail->next = chunk;
+        else entry->head = chunk;
+        entry->tail = tail = chunk;
+    }
+
+    tail->ids[tail->count++] = id;
+    entry->count++;
+    if (idx.width == 2) {
+        tail->ids[tail->count++] = pos;
+        entry->count++;
+    }
+    return 0;
+}
+
+static uint32_t posting_last(const trigram_entry *entry) {
+    return entry->tail ? entry->tail->ids[entry->tail->count - 1] : entry->inline_ids[entry->count - 1];
+}
+
+static int compare_pairs(const void *a, const void *b) {
+    const uint32_t *x = a, *y = b;
+    if (x[0] != y[0]) return (x[0] > y[0]) - (x[0] < y[0]);
+    return (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+/* Sort gathered postings and drop duplicates; returns the remaining slot count */
+static size_t sort_unique(uint32_t *v, size_t slots) {
+    size_t w = idx.width, n = 0;
+    qsort(v, slots / w, w * sizeof(uint32_t), w == 2 ? compare_pairs : compare_u32);
+    for (size_t j = 0; j < slots; j += w) {
+        if (n > 0 && memcmp(&v[n - w], &v[j], w * sizeof(uint32_t)) == 0) continue;
+        memmove(&v[n], &v[j], w * sizeof(uint32_t));
+        n += w;
+    }
+    return n;
+}
+
+/* Copy a list's slots, in append order, into out (entry->count of them) */
+static void posting_gather(const trigram_entry *entry, uint32_t *out) {
+    size_t n = MIN(entry->count, (uint32_t)POSTING_INLINE);
+    memcpy(out, entry->inline_ids, n * sizeof(uint32_t));
+    for (const posting_chunk_t *c = entry->head; c; c = c->next) {
+        memcpy(out + n, c->ids, c->count * sizeof(uint32_t));
+        n += c->count;
+    }
+}
+
+/*
+ * Half the build budget goes to the accumulators (slot table plus chunks),
+ * the rest to metadata and merge buffers. A run is never smaller than
+ * MIN_RUN_BYTES of chunks, even when the table alone exceeds the budget.
+ */
+static bool accumulators_over_budget(size_t limit) {
+    size_t table = idx.capacity * sizeof(trigram_entry);
+    size_t budget = limit / 2 > table ? limit / 2 - table : 0;
+    return idx.postings.mapped >= MAX(budget, (size_t)MIN_RUN_BYTES);
+}
+
+static int compare_slot_trigrams(const void *a, const void *b) {
+    trigram_t x = (*(trigram_entry* const*)a)->trigram, y = (*(trigram_entry* const*)b)->trigram;
+    return (x > y) - (x < y);
+}
+
+/* Anonymous temporary file under $TMPDIR; it disappears with its last close */
+static FILE *open_run_file(void) {
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/qfind-run.XXXXXX", dir && *dir ? dir : "/tmp");
+
+    int fd = mkstemp(path);
+    if (fd < 0) return NULL;
+    unlink(path);
+
+    FILE *fp = fdopen(fd, "w+b");
+    if (!fp) {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(fp, NULL, _IOFBF, RUN_IO_BUFFER);
+    return fp;
+}
+
+/* Empty the accumulators once their lists live in a run or the installed postings */
+static void reset_accumulators(void) {
+    memset(idx.entries, 0, idx.capacity * sizeof(trigram_entry));
+    idx.count = 0;
+    arena_destroy(&idx.postings);
+}
+
+static void close_runs(void) {
+    for (size_t i = 0; i < idx.num_runs; i++) fclose(idx.runs[i]);
+    idx.num_runs = 0;
+}
+
+/*
+ * Write every accumulated list to a new run, in trigram order with sorted,
+ * unique postings, as "uint32 trigram | uint32 slots | uint32 v[slots]"
+ * records, then empty the table and release its chunks. Caller holds idx.lock.
+ */
+static int spill_run(void) {
+    if (idx.count == 0) return 0;
+
+    trigram_entry **order = malloc(idx.count * sizeof(trigram_entry*));
+    FILE *fp = open_run_file();
+    uint32_t *ids = NULL;
+    size_t ids_cap = 0;
+    int ret = (order && fp && ensure_capacity((void**)&idx.runs, &idx.runs_cap,
+                                               idx.num_runs + 1, sizeof(FILE*)) == 0) ? 0 : -1;
+
+    size_t n = 0;
+    for (size_t i = 0; ret == 0 && i < idx.capacity; i++) {
+        if (idx.entries[i].count) order[n++] = &idx.entries[i];
+    }
+    if (ret == 0) qsort(order, n, sizeof(trigram_entry*), compare_slot_trigrams);
+
+    for (size_t i = 0; ret == 0 && i < n; i++) {
+        trigram_entry *entry = order[i];
+        if (ensure_capacity((void**)&ids, &ids_cap, entry->count, sizeof(uint32_t)) != 0) {
+            ret = -1;
+            break;
+        }
+        posting_gather(entry, ids);
+        uint32_t unique = sort_unique(ids, entry->count);
+        if (fwrite(&entry->trigram, sizeof(trigram_t), 1, fp) != 1 ||
+            fwrite(&unique, sizeof(unique), 1, fp) != 1 ||
+            fwrite(ids, sizeof(uint32_t), unique, fp) != unique) {
+            ret = -1;
+        }
+    }
+    if (ret == 0 && fflush(fp) != 0) ret = -1;
+
+    free(order);
+    free(ids);
+    if (ret != 0) {
+        syslog(LOG_ERR, "Failed to spill posting run: %s", strerror(errno));
+        if (fp) fclose(fp);
+        idx.spill_failed = true;
+        return -EIO;
+    }
+
+    idx.runs[idx.num_runs++] = fp;
+    reset_accumulators();
     return 0;
 }
 
@@ -185,149 +399,599 @@ int add_file_to_index(qfind_index_t *index, const char *path, file_id_t file_id)
     size_t trigram_count = 0;
     extract_trigrams(path, trigrams, &trigram_count, PATH_MAX);
     
-    trie_node_t *node = index->trie_root;
-    const char *p = path;
-    
-    while (*p) {
-        char current = *p;
-        uint8_t run_length = 1;
-        
-        while (*(p+1) == current) {
-            p++;
-            run_length++;
-        }
+    pthread_rwlock_wrlock(&idx.lock);
 
-        if (run_length > 1) {
-            if (!node->children[0xFF]) {
-                node->children[0xFF] = calloc(1, sizeof(trie_node_t));
-                if (!node->children[0xFF]) goto oom;
-                node->children[0xFF]->key = 0xFF;
-            }
-            node = node->children[0xFF];
-            node->count = run_length;
-        } else {
-            unsigned char c = *p;
-            if (!node->children[c]) {
-                node->children[c] = calloc(1, sizeof(trie_node_t));
-                if (!node->children[c]) goto oom;
-                node->children[c]->key = c;
-            }
-            node = node->children[c];
-        }
-        p++;
+    // Postings already lost to a failed spill cannot be recovered; stop adding more
+    if (idx.spill_failed) {
+        pthread_rwlock_unlock(&idx.lock);
+        return -EIO;
     }
-    
-    node->is_end = true;
-    node->file_id = file_id;
 
-    pthread_rwlock_wrlock(&idx.lock);
-    
     if ((float)idx.count / idx.capacity > MAX_LOAD_FACTOR && resize_trigram_table() != 0) 
         goto oom_unlock;
 
+    idx.width = index->positional ? 2 : 1;
     for (uint32_t i = 0; i < trigram_count; i++) {
         trigram_entry *entry = find_trigram_entry(trigrams[i]);
-        
         if (entry->count == 0) {
             entry->trigram = trigrams[i];
-            entry->count = 1;
-            entry->deltas = aligned_alloc(ALIGNMENT, POSTING_CHUNK * sizeof(uint32_t));
-            if (!entry->deltas) goto oom_unlock;
-            entry->capacity = POSTING_CHUNK;
             idx.count++;
-        } else {
-            if (entry->count >= entry->capacity) {
-                size_t new_cap = entry->capacity * 2;
-                uint32_t *new_buf = aligned_alloc(ALIGNMENT, new_cap * sizeof(uint32_t));
-                if (!new_buf) goto oom_unlock;
-                memcpy(new_buf, entry->deltas, entry->count * sizeof(uint32_t));
-                free(entry->deltas);
-                entry->deltas = new_buf;
-                entry->capacity = new_cap;
-            }
-            entry->deltas[entry->count++] = file_id;
         }
+        // Without positions a repeated trigram would only add a duplicate id
+        if (!index->positional && entry->count > 0 && posting_last(entry) == file_id) continue;
+        if (posting_append(entry, file_id, i) != 0) goto oom_unlock;
     }
-    
+
+    int ret = 0;
+    if (index->memory_limit && accumulators_over_budget(index->memory_limit)) ret = spill_run();
+
     pthread_rwlock_unlock(&idx.lock);
-    return 0;
+    return ret;
 
 oom_unlock:
     pthread_rwlock_unlock(&idx.lock);
-oom:
     syslog(LOG_CRIT, "Out of memory in add_file_to_index");
-    return -1;
+    return -ENOMEM;
 }
 
-int compress_posting_lists(qfind_index_t *index) {
-    pthread_rwlock_wrlock(&idx.lock);
-    
-    size_t max_compressed = ZSTD_compressBound(idx.count * sizeof(uint32_t));
-    void *compressed_buf = mmap(NULL, max_compressed, PROT_READ|PROT_WRITE,
-                               MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
-    if (compressed_buf == MAP_FAILED) {
-        compressed_buf = malloc(max_compressed);
-        if (!compressed_buf) goto error;
+static int compare_index_entries(const void *a, const void *b) {
+    trigram_t x = ((const index_entry_t*)a)->trigram, y = ((const index_entry_t*)b)->trigram;
+    return (x > y) - (x < y);
+}
+
+/* One finalize worker: a contiguous slot range, its own codec context and output */
+typedef struct {
+    size_t first_slot;
+    size_t end_slot;
+    ZSTD_CCtx *cctx;
+    const ZSTD_CDict *cdict;         // Shared trained dictionary, or NULL
+    uint32_t *scratch;               // Postings, then id deltas, of the list being encoded
+    uint8_t *gr_buf;                 // Encoded form of the list being encoded
+    uint8_t *pos_buf;                // Position stream of the list being encoded
+    size_t scratch_cap;
+    size_t gr_cap;
+    size_t pos_cap;
+    uint32_t num_ids;                // Distinct ids in the last encoded list
+    uint8_t *out;                    // Concatenated zstd frames
+    size_t out_size;
+    size_t out_cap;
+    int error;
+} compress_worker_t;
+
+/*
+ * Encode the sorted, unique postings in w->scratch (slots uint32s) into
+ * w->gr_buf: POSTING_HEADER_SIZE header, the Golomb-Rice stream of id
+ * deltas and, for positional lists, per id a varint position count and
+ * varint position deltas. Returns the encoded size, or a negative errno.
+ */
+static ssize_t encode_postings(compress_worker_t *w, size_t slots) {
+    size_t n = 0, pos_len = 0;
+    uint32_t prev = 0;
+
+    if (idx.width == 2) {
+        // Worst case per pair: a new id's count varint plus a position varint
+        if (ensure_capacity((void**)&w->pos_buf, &w->pos_cap, slots / 2 * 6, 1) != 0)
+            return -ENOMEM;
     }
 
-    size_t total_compressed = 0;
-    for (size_t i = 0; i < idx.capacity; i++) {
+    // Id deltas are compacted to the front of scratch; each write trails its read
+    for (size_t j = 0; j < slots; ) {
+        uint32_t id = w->scratch[j];
+        size_t end = j + idx.width;
+        if (idx.width == 2) {
+            while (end < slots && w->scratch[end] == id) end += 2;
+            uint32_t prev_pos = 0;
+            pos_len += put_varint(w->pos_buf + pos_len, (end - j) / 2);
+            for (size_t p = j + 1; p < end; p += 2) {
+                pos_len += put_varint(w->pos_buf + pos_len, w->scratch[p] - prev_pos);
+                prev_pos = w->scratch[p];
+            }
+        }
+        w->scratch[n++] = id - prev;
+        prev = id;
+        j = end;
+    }
+
+    uint8_t k = calculate_golomb_param(w->scratch, n);
+
+    // Unary quotient bits plus k + 1 bits per id
+    uint64_t bits = (uint64_t)n * (k + 1);
+    for (size_t j = 0; j < n; j++) bits += w->scratch[j] >> k;
+    size_t bound = POSTING_HEADER_SIZE + bits / 8 + 1 + pos_len;
+    if (ensure_capacity((void**)&w->gr_buf, &w->gr_cap, bound, 1) != 0)
+        return -ENOMEM;
+
+    uint32_t num_ids = n;
+    w->gr_buf[0] = k;
+    w->gr_buf[1] = idx.width == 2 ? POSTING_POSITIONAL : 0;
+    memcpy(w->gr_buf + 2, &num_ids, sizeof(num_ids));
+    size_t size = POSTING_HEADER_SIZE;
+    size += golomb_encode_scalar(w->scratch, n, w->gr_buf + size, k);
+    memcpy(w->gr_buf + size, w->pos_buf, pos_len);
+    w->num_ids = num_ids;
+    return size + pos_len;
+}
+
+/* Gather the list into w->scratch, sort and encode it */
+static ssize_t encode_one_list(compress_worker_t *w, trigram_entry *entry) {
+    if (ensure_capacity((void**)&w->scratch, &w->scratch_cap, entry->count, sizeof(uint32_t)) != 0)
+        return -ENOMEM;
+
+    posting_gather(entry, w->scratch);
+    return encode_postings(w, sort_unique(w->scratch, entry->count));
+}
+
+/* Append a zstd frame of w->gr_buf to the worker's output at a worker-local offset */
+static int compress_encoded(compress_worker_t *w, size_t gr_size, size_t *offset, size_t *size) {
+    size_t frame_bound = ZSTD_compressBound(gr_size);
+    if (ensure_capacity((void**)&w->out, &w->out_cap, w->out_size + frame_bound, 1) != 0)
+        return -ENOMEM;
+
+    size_t zstd_size = w->cdict
+        ? ZSTD_compress_usingCDict(w->cctx, w->out + w->out_size, frame_bound,
+                                   w->gr_buf, gr_size, w->cdict)
+        : ZSTD_compressCCtx(w->cctx, w->out + w->out_size, frame_bound,
+                            w->gr_buf, gr_size, ZSTD_CLEVEL_DEFAULT);
+    if (ZSTD_isError(zstd_size)) {
+        syslog(LOG_ERR, "ZSTD error: %s", ZSTD_getErrorName(zstd_size));
+        return -EIO;
+    }
+
+    *offset = w->out_size;
+    *size = zstd_size;
+    w->out_size += zstd_size;
+    return 0;
+}
+
+static int compress_one_list(compress_worker_t *w, trigram_entry *entry) {
+    ssize_t gr_size = encode_one_list(w, entry);
+    if (gr_size < 0) return gr_size;
+    entry->num_ids = w->num_ids;
+    return compress_encoded(w, gr_size, &entry->offset, &entry->size);
+}
+
+static void compress_worker(void *arg) {
+    compress_worker_t *w = arg;
+    for (size_t i = w->first_slot; i < w->end_slot && w->error == 0; i++) {
         trigram_entry *entry = &idx.entries[i];
         if (entry->count == 0) continue;
+        w->error = compress_one_list(w, entry);
+    }
+}
+
+static void free_compress_workers(compress_worker_t *workers, int n) {
+    for (int t = 0; t < n; t++) {
+        ZSTD_freeCCtx(workers[t].cctx);
+        free(workers[t].scratch);
+        free(workers[t].gr_buf);
+        free(workers[t].pos_buf);
+        free(workers[t].out);
+    }
+}
+
+/*
+ * Train a dictionary on the encoded form of an evenly strided sample of
+ * lists. Tiny lists compress to little more than frame overhead on their
+ * own; a shared dictionary carries the common byte patterns instead.
+ */
+static int train_posting_dictionary(qfind_index_t *index) {
+    compress_worker_t sampler = {0};
+    uint8_t *samples = NULL;
+    size_t *sample_sizes = NULL;
+    size_t samples_len = 0, samples_cap = 0, num_samples = 0, sizes_cap = 0;
+    int ret = -1;
+
+    uint64_t total_postings = 0;
+    for (size_t i = 0; i < idx.capacity; i++) total_postings += idx.entries[i].count;
+    // Each posting is roughly a byte once encoded
+    size_t stride = MAX((size_t)1, (size_t)(total_postings / POSTING_DICT_SAMPLE_BUDGET));
+
+    for (size_t i = 0, seen = 0; i < idx.capacity && samples_len < POSTING_DICT_SAMPLE_BUDGET; i++) {
+        trigram_entry *entry = &idx.entries[i];
+        if (entry->count == 0 || seen++ % stride != 0) continue;
+
+        ssize_t gr_size = encode_one_list(&sampler, entry);
+        if (gr_size < 0) goto out;
+        if (ensure_capacity((void**)&samples, &samples_cap, samples_len + gr_size, 1) != 0 ||
+            ensure_capacity((void**)&sample_sizes, &sizes_cap, num_samples + 1, sizeof(size_t)) != 0)
+            goto out;
+        memcpy(samples + samples_len, sampler.gr_buf, gr_size);
+        samples_len += gr_size;
+        sample_sizes[num_samples++] = gr_size;
+    }
+
+    if (num_samples < POSTING_DICT_MIN_SAMPLES) {
+        ret = 0;  // Too small an index to benefit; stay dictionary-less
+        goto out;
+    }
+
+    void *dict = malloc(POSTING_DICT_CAPACITY);
+    if (!dict) goto out;
+    size_t dict_size = ZDICT_trainFromBuffer(dict, POSTING_DICT_CAPACITY, samples,
+                                             sample_sizes, num_samples);
+    if (ZDICT_isError(dict_size)) {
+        syslog(LOG_WARNING, "Posting dictionary training failed: %s", ZDICT_getErrorName(dict_size));
+        free(dict);
+        ret = 0;
+        goto out;
+    }
+
+    ret = posting_dict_attach(index, dict, dict_size, true);
+    if (ret != 0) free(dict);
+
+out:
+    free(samples);
+    free(sample_sizes);
+    free(sampler.scratch);
+    free(sampler.gr_buf);
+    free(sampler.pos_buf);
+    return ret;
+}
+
+/* Install dictionary bytes (owned: freed by the index) and digest them for both directions */
+int posting_dict_attach(qfind_index_t *index, void *dict, size_t dict_size, bool owned) {
+    ZSTD_CDict *cdict = ZSTD_createCDict(dict, dict_size, ZSTD_CLEVEL_DEFAULT);
+    ZSTD_DDict *ddict = ZSTD_createDDict(dict, dict_size);
+    if (!cdict || !ddict) {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        return -1;
+    }
+
+    posting_dict_release(index);
+    index->posting_dict = dict;
+    index->posting_dict_size = dict_size;
+    index->posting_dict_owned = owned;
+    index->posting_cdict = cdict;
+    index->posting_ddict = ddict;
+    return 0;
+}
+
+void posting_dict_release(qfind_index_t *index) {
+    ZSTD_freeCDict(index->posting_cdict);
+    ZSTD_freeDDict(index->posting_ddict);
+    if (index->posting_dict_owned) free(index->posting_dict);
+    index->posting_dict = NULL;
+    index->posting_dict_size = 0;
+    index->posting_cdict = NULL;
+    index->posting_ddict = NULL;
+}
+
+/* Decompress one posting list, through the trained dictionary if the index has one */
+size_t posting_decompress(const qfind_index_t *index, ZSTD_DCtx *dctx,
+                          const index_entry_t *entry, void *dst, size_t dst_cap) {
+    const uint8_t *src = (const uint8_t*)index->compressed_data + entry->offset;
+    if (index->posting_ddict)
+        return ZSTD_decompress_usingDDict(dctx, dst, dst_cap, src, entry->size, index->posting_ddict);
+    return ZSTD_decompressDCtx(dctx, dst, dst_cap, src, entry->size);
+}
+
+/* Replace the index's posting lists with freshly built ones */
+static void install_postings(qfind_index_t *index, void *data, size_t size,
+                             index_entry_t *entries, uint32_t num_entries) {
+    if (!index->postings_mapped) {
+        free(index->compressed_data);
+        free(index->entries);
+    }
+    index->postings_mapped = false;
+    index->compressed_data = data;
+    index->compressed_size = size;
+    index->entries = entries;
+    index->num_entries = num_entries;
+    index_changed(index, true);
+}
+
+/* Cursor over one spilled run: the header of its next record */
+typedef struct {
+    FILE *fp;
+    trigram_t trigram;
+    uint32_t count;
+} run_reader_t;
+
+static bool run_next(run_reader_t *r) {
+    return fread(&r->trigram, sizeof(trigram_t), 1, r->fp) == 1 &&
+           fread(&r->count, sizeof(r->count), 1, r->fp) == 1;
+}
+
+/* Min-heap of run readers on their current trigram */
+static void heap_sift_down(run_reader_t **heap, size_t n, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < n && heap[l]->trigram < heap[min]->trigram) min = l;
+        if (r < n && heap[r]->trigram < heap[min]->trigram) min = r;
+        if (min == i) return;
+        run_reader_t *tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+/*
+ * k-way merge of all spilled runs into the final posting lists. Memory is
+ * one stdio buffer per run plus the ids of the trigram being merged; the
+ * output comes out in trigram order, so no final sort is needed.
+ */
+static int merge_runs(qfind_index_t *index) {
+    run_reader_t *readers = calloc(idx.num_runs, sizeof(run_reader_t));
+    run_reader_t **heap = calloc(idx.num_runs, sizeof(run_reader_t*));
+    compress_worker_t w = { .cdict = index->posting_cdict, .cctx = ZSTD_createCCtx() };
+    index_entry_t *entries = NULL;
+    size_t entries_cap = 0;
+    uint32_t num_entries = 0;
+    int ret = (readers && heap && w.cctx) ? 0 : -1;
+
+    size_t n = 0;
+    for (size_t i = 0; ret == 0 && i < idx.num_runs; i++) {
+        readers[i].fp = idx.runs[i];
+        rewind(readers[i].fp);
+        if (run_next(&readers[i])) heap[n++] = &readers[i];
+    }
+    for (size_t i = n / 2; i-- > 0; ) heap_sift_down(heap, n, i);
+
+    while (ret == 0 && n > 0) {
+        trigram_t trigram = heap[0]->trigram;
+        size_t count = 0, sources = 0;
+
+        // Concatenate this trigram's ids from every run that has it
+        while (ret == 0 && n > 0 && heap[0]->trigram == trigram) {
+            run_reader_t *r = heap[0];
+            if (ensure_capacity((void**)&w.scratch, &w.scratch_cap, count + r->count, sizeof(uint32_t)) != 0 ||
+                fread(w.scratch + count, sizeof(uint32_t), r->count, r->fp) != r->count) {
+                ret = -1;
+                break;
+            }
+            count += r->count;
+            sources++;
+            if (!run_next(r)) heap[0] = heap[--n];
+            heap_sift_down(heap, n, 0);
+        }
+        if (ret != 0) break;
+
+        // Each run is sorted on its own; postings from different runs interleave
+        if (sources > 1) count = sort_unique(w.scratch, count);
 
-        qsort(entry->deltas, entry->count, sizeof(uint32_t), 
-             (int (*)(const void*, const void*))memcmp);
-        
-        uint32_t prev = 0;
-        for (size_t j = 0; j < entry->count; j++) {
-            uint32_t temp = entry->deltas[j];
-            entry->deltas[j] -= prev;
-            prev = temp;
+        size_t offset, size;
+        ssize_t gr_size = encode_postings(&w, count);
+        if (gr_size < 0 || compress_encoded(&w, gr_size, &offset, &size) != 0 ||
+            ensure_capacity((void**)&entries, &entries_cap, num_entries + 1, sizeof(index_entry_t)) != 0) {
+            ret = -1;
+            break;
         }
+        entries[num_entries++] = (index_entry_t){
+            .trigram = trigram,
+            .num_files = w.num_ids,
+            .offset = offset,
+            .size = size
+        };
+    }
+
+    if (ret == 0) {
+        install_postings(index, w.out, w.out_size, entries, num_entries);
+        w.out = NULL;
+    } else {
+        syslog(LOG_ERR, "Posting run merge failed");
+        free(entries);
+    }
+    free_compress_workers(&w, 1);
+    free(readers);
+    free(heap);
+    return ret;
+}
 
-        uint8_t k = calculate_golomb_param(entry->deltas, entry->count);
-
-        //if you ave avk, use golomb_encode_avk512 below
-        size_t gr_size = golomb_encode_scalar(entry->deltas, entry->count,
-                                             (uint8_t*)compressed_buf + total_compressed, k);
-
-        size_t zstd_size = ZSTD_compressCCtx(idx.zstd_cctx,
-                                            index->compressed_data + total_compressed,
-                                            max_compressed - total_compressed,
-                                            compressed_buf, gr_size,
-                                            ZSTD_CLEVEL_DEFAULT);
-        
-        if (ZSTD_isError(zstd_size)) {
-            syslog(LOG_ERR, "ZSTD error: %s", ZSTD_getErrorName(zstd_size));
-            goto error;
+/*
+ * Fold the accumulated lists into the installed ones, both in trigram
+ * order. Lists only one side has keep or get a single frame; a trigram on
+ * both sides is decoded, merged and re-encoded. A commit so costs the
+ * lists it touched plus a copy of the other frames, and mapped postings
+ * are read, never dropped.
+ */
+static int merge_installed(qfind_index_t *index) {
+    trigram_entry **order = malloc(idx.count * sizeof(trigram_entry*));
+    index_entry_t *entries = malloc((index->num_entries + idx.count) * sizeof(index_entry_t));
+    compress_worker_t w = { .cdict = index->posting_cdict, .cctx = ZSTD_createCCtx() };
+    uint32_t num_entries = 0;
+    int ret = (order && entries && w.cctx) ? 0 : -ENOMEM;
+
+    size_t n = 0;
+    for (size_t i = 0; ret == 0 && i < idx.capacity; i++) {
+        if (idx.entries[i].count) order[n++] = &idx.entries[i];
+    }
+    if (ret == 0) qsort(order, n, sizeof(trigram_entry*), compare_slot_trigrams);
+
+    const uint8_t *base_data = index->compressed_data;
+    size_t a = 0, b = 0;
+    while (ret == 0 && (a < index->num_entries || b < n)) {
+        const index_entry_t *base = a < index->num_entries ? &index->entries[a] : NULL;
+        trigram_entry *fresh = b < n ? order[b] : NULL;
+        index_entry_t *out = &entries[num_entries++];
+
+        if (!fresh || (base && base->trigram < fresh->trigram)) {
+            if (ensure_capacity((void**)&w.out, &w.out_cap, w.out_size + base->size, 1) != 0) {
+                ret = -ENOMEM;
+                break;
+            }
+            memcpy(w.out + w.out_size, base_data + base->offset, base->size);
+            *out = *base;
+            out->offset = w.out_size;
+            w.out_size += base->size;
+            a++;
+            continue;
         }
 
-        entry->offset = total_compressed;
-        entry->size = zstd_size;
-        total_compressed += zstd_size;
+        ssize_t gr_size;
+        if (base && base->trigram == fresh->trigram) {
+            uint32_t *old;
+            size_t old_slots;
+            ret = posting_list_slots(index, idx.zstd_dctx, base, &old, &old_slots);
+            if (ret != 0) break;
+            if (ensure_capacity((void**)&w.scratch, &w.scratch_cap, old_slots + fresh->count,
+                                sizeof(uint32_t)) != 0) {
+                free(old);
+                ret = -ENOMEM;
+                break;
+            }
+            memcpy(w.scratch, old, old_slots * sizeof(uint32_t));
+            free(old);
+            posting_gather(fresh, w.scratch + old_slots);
+            gr_size = encode_postings(&w, sort_unique(w.scratch, old_slots + fresh->count));
+            a++;
+        } else {
+            gr_size = encode_one_list(&w, fresh);
+        }
+        b++;
+
+        size_t offset, size;
+        ret = gr_size < 0 ? (int)gr_size : compress_encoded(&w, gr_size, &offset, &size);
+        *out = (index_entry_t){
+            .trigram = fresh->trigram,
+            .num_files = w.num_ids,
+            .offset = offset,
+            .size = size
+        };
     }
 
-    index->compressed_size = total_compressed;
-    munmap(compressed_buf, max_compressed);
-    pthread_rwlock_unlock(&idx.lock);
-    return 0;
+    if (ret == 0) {
+        install_postings(index, w.out, w.out_size, entries, num_entries);
+        w.out = NULL;
+    } else {
+        syslog(LOG_ERR, "Merging new postings failed: %s", strerror(-ret));
+        free(entries);
+    }
+    free_compress_workers(&w, 1);
+    free(order);
+    return ret;
+}
+
+/*
+ * Finalize: trigram slots are split into ranges of roughly equal posting
+ * volume, one per pool thread, each compressed as a task, and the outputs
+ * are stitched into index->compressed_data by a prefix sum of their sizes.
+ */
+int compress_posting_lists(qfind_index_t *index) {
+    pthread_rwlock_wrlock(&idx.lock);
+    idx.width = index->positional ? 2 : 1;
+
+    // Trained once per index; later commits reuse the same dictionary, as
+    // do installed lists built without one
+    if (index->use_dicts && !index->posting_cdict && index->num_entries == 0 &&
+        train_posting_dictionary(index) != 0) {
+        pthread_rwlock_unlock(&idx.lock);
+        return -1;
+    }
+
+    if (idx.spill_failed) {
+        pthread_rwlock_unlock(&idx.lock);
+        return -EIO;
+    }
+
+    // Once anything was spilled, the final lists come from merging the runs
+    if (idx.num_runs > 0) {
+        int ret = spill_run();
+        if (ret == 0) ret = merge_runs(index);
+        if (ret == 0) close_runs();
+        pthread_rwlock_unlock(&idx.lock);
+        return ret;
+    }
+
+    // Later commits merge into what is installed instead of rebuilding it
+    if (index->num_entries > 0) {
+        int ret = idx.count ? merge_installed(index) : 0;
+        if (ret == 0) reset_accumulators();
+        pthread_rwlock_unlock(&idx.lock);
+        return ret;
+    }
+
+    int nthreads = pool_threads();
+    compress_worker_t *workers = calloc(nthreads, sizeof(compress_worker_t));
+    size_t *bases = calloc(nthreads, sizeof(size_t));
+    if (!workers || !bases) {
+        free(workers);
+        free(bases);
+        pthread_rwlock_unlock(&idx.lock);
+        return -1;
+    }
+
+    uint64_t total_postings = 0;
+    for (size_t i = 0; i < idx.capacity; i++) total_postings += idx.entries[i].count;
+
+    uint64_t per_thread = total_postings / nthreads + 1;
+    size_t slot = 0;
+    for (int t = 0; t < nthreads; t++) {
+        workers[t].first_slot = slot;
+        uint64_t volume = 0;
+        while (slot < idx.capacity && (volume < per_thread || t == nthreads - 1)) {
+            volume += idx.entries[slot++].count;
+        }
+        workers[t].end_slot = slot;
+        workers[t].cdict = index->posting_cdict;
+        workers[t].cctx = ZSTD_createCCtx();
+        if (!workers[t].cctx) {
+            free_compress_workers(workers, t + 1);
+            free(workers);
+            free(bases);
+            pthread_rwlock_unlock(&idx.lock);
+            return -1;
+        }
+    }
+
+    pool_for(compress_worker, workers, sizeof(compress_worker_t), nthreads);
+
+    size_t total_compressed = 0;
+    int ret = 0;
+    for (int t = 0; t < nthreads; t++) {
+        if (workers[t].error) ret = -1;
+        bases[t] = total_compressed;
+        total_compressed += workers[t].out_size;
+    }
+
+    uint8_t *data = ret == 0 ? malloc(total_compressed ? total_compressed : 1) : NULL;
+    index_entry_t *entries = ret == 0 ? malloc((idx.count ? idx.count : 1) * sizeof(index_entry_t)) : NULL;
+    if (!data || !entries) {
+        free(data);
+        free(entries);
+        free_compress_workers(workers, nthreads);
+        free(workers);
+        free(bases);
+        pthread_rwlock_unlock(&idx.lock);
+        return -1;
+    }
+
+    uint32_t num_entries = 0;
+    for (int t = 0; t < nthreads; t++) {
+        memcpy(data + bases[t], workers[t].out, workers[t].out_size);
+        for (size_t i = workers[t].first_slot; i < workers[t].end_slot; i++) {
+            trigram_entry *entry = &idx.entries[i];
+            if (entry->count == 0) continue;
+            entry->offset += bases[t];
+            entries[num_entries++] = (index_entry_t){
+                .trigram = entry->trigram,
+                .num_files = entry->num_ids,
+                .offset = entry->offset,
+                .size = entry->size
+            };
+        }
+    }
+    free_compress_workers(workers, nthreads);
+    free(workers);
+    free(bases);
+
+    // Sorted by trigram so lookups can binary search
+    qsort(entries, num_entries, sizeof(index_entry_t), compare_index_entries);
+    install_postings(index, data, total_compressed, entries, num_entries);
+    reset_accumulators();
 
-error:
-    if (compressed_buf != MAP_FAILED) munmap(compressed_buf, max_compressed);
     pthread_rwlock_unlock(&idx.lock);
-    return -1;
+    return 0;
 }
 
 int init_inverted_index() {
-    idx.entries = mmap(NULL, INITIAL_CAPACITY * sizeof(trigram_entry),
-                      PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
-    if (idx.entries == MAP_FAILED) {
-        idx.entries = aligned_alloc(ALIGNMENT, INITIAL_CAPACITY * sizeof(trigram_entry));
-        if (!idx.entries) return -1;
-    }
-    
-    memset(idx.entries, 0, INITIAL_CAPACITY * sizeof(trigram_entry));
+    idx.entries = huge_map(INITIAL_CAPACITY * sizeof(trigram_entry));
+    if (!idx.entries) return -1;
     idx.capacity = INITIAL_CAPACITY;
+    idx.count = 0;
+    idx.spill_failed = false;
+    arena_init(&idx.postings, 0);
     pthread_rwlock_init(&idx.lock, NULL);
     
     idx.zstd_cctx = ZSTD_createCCtx();
@@ -339,17 +1003,14 @@ int init_inverted_index() {
 
 void cleanup_inverted_index() {
     pthread_rwlock_destroy(&idx.lock);
-    for (size_t i = 0; i < idx.capacity; i++) {
-        if (idx.entries[i].deltas) {
-            free(idx.entries[i].deltas);
-        }
-    }
-    munmap(idx.entries, idx.capacity * sizeof(trigram_entry));
+    close_runs();
+    free(idx.runs);
+    idx.runs = NULL;
+    idx.runs_cap = 0;
+    arena_destroy(&idx.postings);
+    huge_unmap(idx.entries, idx.capacity * sizeof(trigram_entry));
+    idx.entries = NULL;
     ZSTD_freeCCtx(idx.zstd_cctx);
     ZSTD_freeDCtx(idx.zstd_dctx);
 }
 
-void extract_trigrams(const char *text, trigram_t *out, size_t *out_count, size_t max_out) {
-    // TODO: implement trigram extraction logic
-    *out_count = 0;
-}
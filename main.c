@@ -7,33 +7,230 @@
 #include <pwd.h>
 #include <grp.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 
 
 #define VERSION "1.0.0"
 
+/* Options without a short form */
+enum {
+    OPT_SIZE = 256,
+    OPT_NEWER,
+    OPT_OLDER,
+    OPT_TYPE,
+    OPT_OWNER,
+    OPT_THREADS
+};
+
 void print_usage(const char *prog_name) {
     printf("Usage: %s [OPTION]... PATTERN...\n", prog_name);
     printf("Quickly search for files by name.\n\n");
     printf("Options:\n");
     printf("  -d, --database=DBPATH     use DBPATH as database\n");
     printf("  -i, --ignore-case         ignore case distinctions\n");
+    printf("  -b, --basename            match only the file name, not its directories\n");
+    printf("  -A, --all                 only print files matching every PATTERN\n");
+    printf("  -N, --not=PATTERN         drop files matching PATTERN (repeatable)\n");
+    printf("  -S, --scope=DIR           only print files below DIR\n");
+    printf("      --size=[+-]SIZE       larger (+) or smaller (-) than SIZE, or exactly SIZE\n");
+    printf("      --newer=AGE|FILE      modified within AGE (30m, 12h, 7d, 2w) or after FILE\n");
+    printf("      --older=AGE|FILE      modified more than AGE ago or before FILE\n");
+    printf("      --type=TYPES          f for regular files, l for symlinks\n");
+    printf("      --owner=USER          owned by USER (name or uid)\n");
     printf("  -r, --regexp              pattern is a regular expression\n");
     printf("  -u, --update              update the database\n");
+    printf("  -z, --zstd-dict           with --update, compress with trained dictionaries\n");
+    printf("  -m, --memory-limit=SIZE   with --update, spill to temporary files past SIZE\n");
+    printf("  -P, --positions           with --update, store trigram positions in postings\n");
+    printf("  -F, --fm-index            with --update, also build an FM-index over all paths\n");
+    printf("  -B, --batch[=FORMAT]      read one query per line (FORMAT lines) or as LEN:BYTES\n");
+    printf("                            records (FORMAT length) from stdin; print TAG<tab>PATH\n");
+    printf("  -x, --explain             show the query plan and its estimated cost\n");
+    printf("      --threads=N           use N threads (default: one per online CPU)\n");
     printf("  -h, --help                display this help\n");
     printf("  -v, --version             display version information\n");
 }
 
+/* Parse a byte count with an optional K, M or G suffix */
+static bool parse_size(const char *arg, uint64_t *out) {
+    char *end;
+    unsigned long long n = strtoull(arg, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': n <<= 10; end++; break;
+        case 'm': case 'M': n <<= 20; end++; break;
+        case 'g': case 'G': n <<= 30; end++; break;
+    }
+    if (end == arg || *end != '\0' || !(*arg >= '0' && *arg <= '9')) return false;
+    *out = n;
+    return true;
+}
+
+/* --size: +SIZE is larger than SIZE, -SIZE smaller, SIZE exactly that */
+static bool parse_size_filter(const char *arg, meta_filter_t *f) {
+    char sign = (*arg == '+' || *arg == '-') ? *arg++ : 0;
+    uint64_t n;
+    if (!parse_size(arg, &n)) return false;
+    if (sign != '-') f->min_size = MAX(f->min_size, sign == '+' && n < UINT64_MAX ? n + 1 : n);
+    if (sign == '-' && n == 0) f->min_size = 1;  // Nothing is smaller than 0 bytes
+    if (sign != '+') f->max_size = MIN(f->max_size, sign == '-' && n > 0 ? n - 1 : n);
+    return true;
+}
+
+/* --newer, --older: an age in days or with an s, m, h, d or w suffix, or a file whose mtime is the bound */
+static bool parse_time_bound(const char *arg, int64_t *out) {
+    char *end;
+    long long n = strtoll(arg, &end, 10);
+    int64_t unit = 86400;
+    switch (*end) {
+        case 's': unit = 1; end++; break;
+        case 'm': unit = 60; end++; break;
+        case 'h': unit = 3600; end++; break;
+        case 'd': end++; break;
+        case 'w': unit = 7 * 86400; end++; break;
+    }
+    struct stat st;
+    if (end != arg && *end == '\0' && n >= 0 && n <= INT64_MAX / unit) *out = time(NULL) - n * unit;
+    else if (stat(arg, &st) == 0) *out = st.st_mtime;
+    else return false;
+    return true;
+}
+
+/* --type: f (regular file) and l (symlink), the only types indexed */
+static bool parse_types(const char *arg, meta_filter_t *f) {
+    for (; *arg; arg++) {
+        if (*arg == 'f') f->types |= 1u << (S_IFREG >> 12);
+        else if (*arg == 'l') f->types |= 1u << (S_IFLNK >> 12);
+        else if (*arg != ',') return false;
+    }
+    return f->types != 0;
+}
+
+static bool parse_owner(const char *arg, meta_filter_t *f) {
+    struct passwd *pw = getpwnam(arg);
+    char *end;
+    unsigned long uid = pw ? pw->pw_uid : strtoul(arg, &end, 10);
+    if (!pw && (end == arg || *end != '\0' || uid >= META_ANY_OWNER)) return false;
+    f->owner = uid;
+    return true;
+}
+
+/*
+ * Read batch queries from in: one per line, or "LEN:" followed by LEN
+ * bytes (then optional whitespace) when length_prefixed. Each query's tag
+ * is its record number, counting from 1; empty lines are skipped and not
+ * counted. A malformed record fails the whole batch with -EINVAL.
+ */
+static int read_batch(FILE *in, bool length_prefixed, batch_query_t **queries, uint32_t **tags,
+                      uint32_t *num_queries) {
+    batch_query_t *q = NULL;
+    uint32_t *t = NULL, n = 0, cap = 0, record = 0;
+    char *line = NULL, *text = NULL;
+    size_t line_cap = 0;
+    int ret = 0;
+
+    for (;;) {
+        if (length_prefixed) {
+            size_t len;
+            int header_end = 0;
+            int fields = fscanf(in, " %zu:%n", &len, &header_end);
+            if (fields == EOF && !ferror(in)) break;
+            if (fields != 1 || header_end == 0) {
+                ret = -EINVAL;
+                goto fail;
+            }
+            text = malloc(len + 1);
+            if (!text || fread(text, 1, len, in) != len) {
+                ret = text ? -EINVAL : -ENOMEM;
+                goto fail;
+            }
+            text[len] = '\0';
+        } else {
+            ssize_t len = getline(&line, &line_cap, in);
+            if (len < 0) break;
+            if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+            if (len == 0) continue;
+            text = strdup(line);
+            if (!text) {
+                ret = -ENOMEM;
+                goto fail;
+            }
+        }
+        record++;
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            batch_query_t *grown_q = realloc(q, cap * sizeof(batch_query_t));
+            if (grown_q) q = grown_q;
+            uint32_t *grown_t = realloc(t, cap * sizeof(uint32_t));
+            if (grown_t) t = grown_t;
+            if (!grown_q || !grown_t) {
+                ret = -ENOMEM;
+                goto fail;
+            }
+        }
+        q[n] = (batch_query_t){ .pattern = text };
+        t[n++] = record;
+        text = NULL;
+    }
+
+    free(line);
+    *queries = q;
+    *tags = t;
+    *num_queries = n;
+    return 0;
+
+fail:
+    free(text);
+    free(line);
+    for (uint32_t i = 0; i < n; i++) free((char*)q[i].pattern);
+    free(q);
+    free(t);
+    return ret;
+}
+
 int main(int argc, char *argv[]) {
-    char *db_path = NULL;
+    char *db_path = DEFAULT_DB_PATH;
     bool ignore_case = false;
+    bool basename_only = false;
+    const char *scope = NULL;
+    meta_filter_t filter;
+    meta_filter_init(&filter);
+    char scope_path[PATH_MAX];
     bool use_regex = false;
     bool update_db = false;
+    bool use_dicts = false;
+    uint64_t memory_limit = 0;
+    bool positional = false;
+    bool build_fm = false;
+    bool explain = false;
+    bool match_all = false;
+    bool batch = false;
+    bool length_prefixed = false;
+    const char *excludes[argc];
+    uint32_t num_excludes = 0;
     
     static struct option long_options[] = {
         {"database", required_argument, 0, 'd'},
         {"ignore-case", no_argument, 0, 'i'},
+        {"basename", no_argument, 0, 'b'},
+        {"all", no_argument, 0, 'A'},
+        {"not", required_argument, 0, 'N'},
+        {"scope", required_argument, 0, 'S'},
+        {"size", required_argument, 0, OPT_SIZE},
+        {"newer", required_argument, 0, OPT_NEWER},
+        {"older", required_argument, 0, OPT_OLDER},
+        {"type", required_argument, 0, OPT_TYPE},
+        {"owner", required_argument, 0, OPT_OWNER},
         {"regexp", no_argument, 0, 'r'},
         {"update", no_argument, 0, 'u'},
+        {"zstd-dict", no_argument, 0, 'z'},
+        {"memory-limit", required_argument, 0, 'm'},
+        {"positions", no_argument, 0, 'P'},
+        {"fm-index", no_argument, 0, 'F'},
+        {"explain", no_argument, 0, 'x'},
+        {"batch", optional_argument, 0, 'B'},
+        {"threads", required_argument, 0, OPT_THREADS},
         {"help", no_argument, 0, 'h'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0}
@@ -42,7 +239,7 @@ int main(int argc, char *argv[]) {
     int opt;
     int option_index = 0;
     
-    while ((opt = getopt_long(argc, argv, "d:iruhv", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:ibAN:S:ruzm:PFxB::hv", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'd':
                 db_path = optarg;
@@ -50,12 +247,79 @@ int main(int argc, char *argv[]) {
             case 'i':
                 ignore_case = true;
                 break;
+            case 'b':
+                basename_only = true;
+                break;
+            case 'A':
+                match_all = true;
+                break;
+            case 'N':
+                excludes[num_excludes++] = optarg;
+                break;
+            case 'S':
+                // Stored paths are canonical; a DIR that cannot be resolved is taken as written
+                scope = realpath(optarg, scope_path) ? scope_path : optarg;
+                break;
+            case OPT_SIZE:
+            case OPT_NEWER:
+            case OPT_OLDER:
+            case OPT_TYPE:
+            case OPT_OWNER: {
+                int64_t t = 0;
+                bool ok = opt == OPT_SIZE ? parse_size_filter(optarg, &filter)
+                        : opt == OPT_TYPE ? parse_types(optarg, &filter)
+                        : opt == OPT_OWNER ? parse_owner(optarg, &filter)
+                        : parse_time_bound(optarg, &t);
+                if (!ok) {
+                    fprintf(stderr, "Invalid --%s: %s\n", long_options[option_index].name, optarg);
+                    return 1;
+                }
+                if (opt == OPT_NEWER) filter.min_mtime = MAX(filter.min_mtime, t + 1);
+                if (opt == OPT_OLDER) filter.max_mtime = MIN(filter.max_mtime, t - 1);
+                filter.active = true;
+                break;
+            }
+            case OPT_THREADS: {
+                char *end;
+                long n = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || n < 1 || pool_init((int)n) != 0) {
+                    fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            }
             case 'r':
                 use_regex = true;
                 break;
             case 'u':
                 update_db = true;
                 break;
+            case 'z':
+                use_dicts = true;
+                break;
+            case 'm':
+                if (!parse_size(optarg, &memory_limit) || !memory_limit) {
+                    fprintf(stderr, "Invalid memory limit: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+                positional = true;
+                break;
+            case 'F':
+                build_fm = true;
+                break;
+            case 'x':
+                explain = true;
+                break;
+            case 'B':
+                batch = true;
+                if (optarg && strcmp(optarg, "length") == 0) length_prefixed = true;
+                else if (optarg && strcmp(optarg, "lines") != 0) {
+                    fprintf(stderr, "Invalid batch format: %s\n", optarg);
+                    return 1;
+                }
+                break;
             case 'h':
                 print_usage(argv[0]);
                 return 0;
@@ -78,30 +342,83 @@ int main(int argc, char *argv[]) {
     // Load database or update it if requested
     if (update_db) {
         printf("Updating database...\n");
-        qfind_build_index(index, "/");  // Start from root
+        index->use_dicts = use_dicts;
+        index->memory_limit = memory_limit;
+        index->positional = positional;
+        index->build_fm = build_fm;
+        int ret = qfind_update_database(index, "/", db_path);  // Start from root
+        qfind_destroy(index);
+        if (ret != 0) {
+            fprintf(stderr, "Failed to update %s: %s\n", db_path, strerror(-ret));
+            return 1;
+        }
         printf("Database updated.\n");
         return 0;
     }
     
     // Check if we have a pattern to search for
-    if (optind >= argc) {
+    if (optind >= argc && !batch && !filter.active) {
         fprintf(stderr, "No search pattern provided\n");
         print_usage(argv[0]);
         qfind_destroy(index);
         return 1;
     }
     
+    int ret = qfind_load_database(index, db_path);
+    if (ret != 0) {
+        fprintf(stderr, "Cannot load database %s: %s (run --update first)\n",
+                db_path, strerror(-ret));
+        qfind_destroy(index);
+        return 1;
+    }
+
     // Set up query context
     query_ctx_t query = {0};
-    query.query = argv[optind];
+    static const char *match_any[] = { "" };  // Attribute filters alone select every name
+    query.query = optind < argc ? argv[optind] : "";
+    query.patterns = optind < argc ? (const char**)&argv[optind] : match_any;
+    query.num_patterns = optind < argc ? argc - optind : 1;
+    query.excludes = excludes;
+    query.num_excludes = num_excludes;
+    query.match_all = match_all;
     query.case_sensitive = !ignore_case;
     query.regex_enabled = use_regex;
+    query.basename = basename_only;
+    query.scope = scope;
+    query.filter = filter;
     query.max_results = MAX_RESULTS;
     
     // Get user and group ID for permission checking
     query.user_id = getuid();
     query.group_id = getgid();
     
+    if (batch) {
+        batch_query_t *queries = NULL;
+        uint32_t *tags = NULL, n = 0;
+        ret = read_batch(stdin, length_prefixed, &queries, &tags, &n);
+        if (ret == 0) ret = qfind_search_batch(index, &query, queries, n);
+        if (ret != 0) fprintf(stderr, "Batch failed: %s\n", strerror(-ret));
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (ret == 0 && queries[i].error)
+                fprintf(stderr, "%u: %s\n", tags[i], strerror(-queries[i].error));
+            for (uint32_t j = 0; ret == 0 && j < queries[i].num_results; j++)
+                printf("%u\t%s\n", tags[i], index->file_metadata[queries[i].results[j]].path);
+            free(queries[i].results);
+            free((char*)queries[i].pattern);
+        }
+        free(queries);
+        free(tags);
+        qfind_destroy(index);
+        return ret == 0 ? 0 : 1;
+    }
+
+    if (explain) {
+        qfind_explain(index, &query, stdout);
+        qfind_destroy(index);
+        return 0;
+    }
+
     // Perform search
     int result_count = qfind_search(index, &query);
     
@@ -0,0 +1,185 @@
+#include "qfind.h"
+#include <errno.h>
+#include <grp.h>
+#include <pwd.h>
+
+#define PERM_MAX_CLASSES 16          // Cached visibility bitmaps per index
+#define PERM_MAX_GROUPS 256
+#define PERM_READ 04                 // Permission bits in the "other" position
+#define PERM_SEARCH 01
+
+/*
+ * Which files a user may see. As with locate, a name is visible when the
+ * user can read and search its directory and search every directory
+ * above it; the file's own mode does not matter. Directories are kept in
+ * walk order with their parent and the id run of their own files, so a
+ * single pass resolves every directory for a (uid, primary gid) class and
+ * fills its bitmap of visible files a run at a time. Bitmaps are cached
+ * per class until files are added, and queries test one bit per file.
+ */
+
+struct perm_class {
+    uid_t uid;
+    gid_t gid;
+    gid_t groups[PERM_MAX_GROUPS];   // Primary and supplementary groups of uid
+    int num_groups;
+    uint64_t *visible;
+    uint32_t num_files;              // Files covered by visible
+};
+
+/* Record a directory whose own files are appended next; caller holds index_lock */
+int perm_add_dir(qfind_index_t *index, uint32_t parent, uint32_t mode, uint32_t uid, uint32_t gid,
+                 uint32_t *dir) {
+    if (index->num_dirs == index->dirs_capacity) {
+        uint32_t cap = index->dirs_capacity ? index->dirs_capacity * 2 : 1024;
+        dir_perm_t *grown = realloc(index->dirs, cap * sizeof(dir_perm_t));
+        if (!grown) return -ENOMEM;
+        index->dirs = grown;
+        index->dirs_capacity = cap;
+    }
+    *dir = index->num_dirs;
+    index->dirs[index->num_dirs++] = (dir_perm_t){ parent, index->num_files, index->num_files, mode, uid, gid };
+    return 0;
+}
+
+void perm_free(qfind_index_t *index) {
+    for (uint32_t i = 0; index->perm_classes && i < PERM_MAX_CLASSES; i++) free(index->perm_classes[i].visible);
+    free(index->perm_classes);
+    free(index->dirs);
+    index->perm_classes = NULL;
+    index->dirs = NULL;
+    index->num_dirs = index->dirs_capacity = 0;
+}
+
+static void class_init(perm_class_t *c, uid_t uid, gid_t gid) {
+    c->uid = uid;
+    c->gid = gid;
+    c->groups[0] = gid;
+    c->num_groups = 1;
+
+    // Too many groups to list keeps just the primary one: fewer files visible, never more
+    struct passwd pw, *found = NULL;
+    char buf[4096];
+    int n = PERM_MAX_GROUPS;
+    if (getpwuid_r(uid, &pw, buf, sizeof(buf), &found) == 0 && found &&
+        getgrouplist(pw.pw_name, gid, c->groups, &n) >= 0)
+        c->num_groups = n;
+    else
+        c->groups[0] = gid;
+}
+
+static bool class_may(const perm_class_t *c, uint32_t mode, uint32_t uid, uint32_t gid, uint32_t want) {
+    if (uid == c->uid) return ((mode >> 6) & want) == want;
+    for (int i = 0; i < c->num_groups; i++) {
+        if (c->groups[i] == gid) return ((mode >> 3) & want) == want;
+    }
+    return (mode & want) == want;
+}
+
+/* A file added since the walk belongs to no run: check its directories on disk */
+static bool path_visible(const perm_class_t *c, const char *path) {
+    const char *last = strrchr(path, '/');
+    if (path[0] != '/' || !last) return false;
+
+    // "/" first, then one more component per step, down to the file's directory
+    char prefix[PATH_MAX] = "/";
+    size_t n = 1;
+    const char *p = path + 1;
+    for (;;) {
+        struct stat st;
+        bool parent = p > last;
+        if (stat(prefix, &st) != 0 ||
+            !class_may(c, st.st_mode, st.st_uid, st.st_gid, parent ? PERM_READ | PERM_SEARCH : PERM_SEARCH))
+            return false;
+        if (parent) return true;
+
+        const char *slash = strchr(p, '/');
+        if (n > 1) prefix[n++] = '/';
+        memcpy(prefix + n, p, slash - p);
+        n += slash - p;
+        prefix[n] = '\0';
+        p = slash + 1;
+    }
+}
+
+static void set_run(uint64_t *bits, uint32_t first, uint32_t end) {
+    for (uint32_t id = first; id < end && id % 64; id++) bits[id / 64] |= 1ULL << (id % 64);
+    first = MIN(end, (first + 63) & ~63u);
+    for (; first + 64 <= end; first += 64) bits[first / 64] = ~0ULL;
+    for (; first < end; first++) bits[first / 64] |= 1ULL << (first % 64);
+}
+
+static int class_build(const qfind_index_t *index, perm_class_t *c) {
+    uint64_t *bits = calloc((index->num_files + 63) / 64 + 1, sizeof(uint64_t));
+    uint8_t *search = malloc(index->num_dirs ? index->num_dirs : 1);
+    if (!bits || !search) {
+        free(bits);
+        free(search);
+        return -ENOMEM;
+    }
+
+    // Parents precede their subdirectories in walk order
+    for (uint32_t i = 0; i < index->num_dirs; i++) {
+        const dir_perm_t *d = &index->dirs[i];
+        bool reachable = d->parent == DIR_NONE || search[d->parent];
+        search[i] = reachable && class_may(c, d->mode, d->uid, d->gid, PERM_SEARCH);
+        if (search[i] && class_may(c, d->mode, d->uid, d->gid, PERM_READ))
+            set_run(bits, d->first, MIN(d->end, index->num_files));
+    }
+    free(search);
+
+    for (uint32_t id = index->num_walked; id < index->num_files; id++) {
+        const char *path = index->file_metadata[id].path;
+        if (path[0] && path_visible(c, path)) bits[id / 64] |= 1ULL << (id % 64);
+    }
+
+    free(c->visible);
+    c->visible = bits;
+    c->num_files = index->num_files;
+    return 0;
+}
+
+/*
+ * Bitmap of the files uid, with primary group gid, may see; NULL when it
+ * sees everything. Caller holds index_lock, which keeps the bitmap valid,
+ * and frees it when *owned (every cache slot was taken by other classes).
+ */
+int perm_visible(qfind_index_t *index, uid_t uid, gid_t gid, const uint64_t **visible, bool *owned) {
+    *visible = NULL;
+    *owned = false;
+    if (uid == 0) return 0;
+
+    pthread_mutex_lock(&index->perm_lock);
+    if (!index->perm_classes) index->perm_classes = calloc(PERM_MAX_CLASSES, sizeof(perm_class_t));
+    perm_class_t *c = NULL;
+    for (uint32_t i = 0; index->perm_classes && i < PERM_MAX_CLASSES && !c; i++) {
+        perm_class_t *slot = &index->perm_classes[i];
+        if (!slot->visible) {
+            class_init(slot, uid, gid);
+            c = slot;
+        } else if (slot->uid == uid && slot->gid == gid) {
+            c = slot;
+        }
+    }
+
+    int ret = 0;
+    if (c) {
+        // Bitmaps only go stale when files are added, under the write lock
+        if (!c->visible || c->num_files != index->num_files) ret = class_build(index, c);
+        if (ret == 0) *visible = c->visible;
+    }
+    pthread_mutex_unlock(&index->perm_lock);
+    if (c || ret != 0) return ret;
+
+    perm_class_t *once = malloc(sizeof(perm_class_t));
+    if (!once) return -ENOMEM;
+    class_init(once, uid, gid);
+    once->visible = NULL;
+    ret = class_build(index, once);
+    if (ret == 0) {
+        *visible = once->visible;
+        *owned = true;
+    }
+    free(once);
+    return ret;
+}
@@ -0,0 +1,280 @@
+#include "qfind.h"
+#include <math.h>
+
+/*
+ * Cost-based choice of execution strategy. Each applicable engine gets an
+ * estimate in microseconds from the query shape and index statistics:
+ * posting list lengths, files and name bytes indexed, FM-index occurrence
+ * counts and the bloom filter's false positive rate. The cheapest runs.
+ */
+
+/* Per-unit costs in nanoseconds on one core */
+#define COST_SCAN_BYTE 0.25          // AVX2 first/last-byte filter
+#define COST_REGEX_BYTE 20.0         // regexec() over a name
+#define COST_BITMAP_WORD 1.0
+#define COST_PROBE 50.0              // Bloom probe or dictionary bsearch
+#define COST_DECODE_ID 4.0           // zstd plus Golomb-Rice, per posting
+#define COST_VERIFY 100.0            // strstr() on one candidate path
+#define COST_EMIT 10.0
+#define COST_FM_STEP 40.0            // One backward-search step
+#define COST_FM_LOCATE 400.0         // LF walk to a suffix array sample
+#define COST_AC_BYTE 1.5             // Automaton step (Teddy-filtered sets pay less)
+#define COST_VARINT_ID 1.0           // Basename index posting
+#define COST_BASENAME 20.0           // Finding the last '/' of a name
+#define COST_SORT_STEP 5.0           // One comparison sorting candidate ids
+#define COST_COLUMN_ROW 0.5          // Attribute predicates on one row, AVX2
+#define BLOOM_MAX_FPR 0.5            // A fuller filter is not worth probing
+
+static const char *plan_names[PLAN_KINDS] = { "empty", "short", "trigram", "fm", "scan", "basename", "anchor", "filter" };
+
+/* Refill the bloom filter with every indexed trigram; caller holds index_lock for writing */
+void plan_prepare(qfind_index_t *index) {
+    ffbloom_clear(index->bloom);
+    for (uint32_t i = 0; i < index->num_entries; i++) {
+        trigram_t t = index->entries[i].trigram;
+        ffbloom_update_secondary(index->bloom, &t, sizeof(t));
+    }
+    index->bloom_items = index->num_entries;
+}
+
+static double scan_threads(const short_index_t *s, bool regex) {
+    if (s->names_size < (regex ? (64 << 10) : (1 << 20))) return 1;
+    return pool_threads();
+}
+
+/* Fraction of files containing byte c (or its other ASCII case) */
+static double byte_density(const short_index_t *s, unsigned char c, bool case_sensitive) {
+    const uint64_t *a = s->byte_bitmaps[c];
+    unsigned char other = fold_ascii(c) != c ? fold_ascii(c) : upper_ascii(c);
+    const uint64_t *b = (!case_sensitive && other != c) ? s->byte_bitmaps[other] : NULL;
+    uint64_t count = 0;
+    for (size_t w = 0; w < (s->num_files + 63) / 64; w++)
+        count += __builtin_popcountll((a ? a[w] : 0) | (b ? b[w] : 0));
+    return s->num_files ? (double)count / s->num_files : 0;
+}
+
+static void plan_trigrams(const qfind_index_t *index, const query_ctx_t *query, bool exact,
+                          query_plan_t *plan) {
+    static __thread trigram_t trigrams[MAX_QUERY_TRIGRAMS];
+    static __thread trigram_t kept[MAX_QUERY_TRIGRAMS];
+    size_t n;
+    extract_trigrams(query->query, trigrams, &n, MAX_QUERY_TRIGRAMS);
+
+    uint32_t distinct = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool seen = false;
+        for (uint32_t j = 0; j < distinct && !seen; j++) seen = trigrams[j] == trigrams[i];
+        if (!seen) trigrams[distinct++] = trigrams[i];
+    }
+    plan->num_trigrams = distinct;
+
+    // The bloom filter rules trigrams out without touching the dictionary pages
+    if (index->bloom_items && plan->bloom_fpr <= BLOOM_MAX_FPR) {
+        uint32_t found;
+        ffbloom_get_candidates(index->bloom, trigrams, distinct, kept, &found);
+        plan->bloom_rejected = distinct - found;
+        if (found < distinct) {
+            plan->cost[PLAN_EMPTY] = distinct * COST_PROBE / 1000;
+            plan->est_matches = 0;
+            return;
+        }
+    } else {
+        plan->bloom_fpr = 1.0;
+    }
+
+    double files = MAX(index->short_idx.num_files, 1);
+    double decode = 0, selectivity = 1;
+    plan->rarest = UINT32_MAX;
+    for (uint32_t i = 0; i < distinct; i++) {
+        const index_entry_t *entry = find_index_entry(index, trigrams[i]);
+        if (!entry) {
+            plan->cost[PLAN_EMPTY] = (i + 1) * COST_PROBE / 1000;
+            plan->est_matches = 0;
+            return;
+        }
+        decode += entry->num_files * COST_DECODE_ID;
+        selectivity *= entry->num_files / files;
+        plan->rarest = MIN(plan->rarest, entry->num_files);
+    }
+
+    // Trigrams of one word are far from independent; never guess below 1% of the rarest list
+    double candidates = MIN((double)plan->rarest, MAX(files * selectivity, plan->rarest / 100.0));
+    candidates *= plan->scope_fraction;
+    // Long rarest lists are intersected and verified in slices on every pool thread
+    double threads = plan->rarest >= TRIGRAM_PARALLEL_IDS ? pool_threads() : 1;
+    plan->cost[PLAN_TRIGRAM] = (distinct * COST_PROBE + decode +
+                                candidates * (exact ? COST_EMIT : COST_VERIFY) / threads) / 1000;
+    if (!index->fm) plan->est_matches = candidates;
+}
+
+/*
+ * Basename queries: a scan of the names or, for 3+ byte literals, the
+ * basename index. Lists there are plain varints, so decoding is cheap.
+ */
+static void plan_basename(const qfind_index_t *index, const query_ctx_t *query, query_plan_t *plan) {
+    static __thread trigram_t trigrams[MAX_QUERY_TRIGRAMS];
+    size_t n;
+    if (query->regex_enabled || !index->base_idx) return;
+    extract_trigrams(query->query, trigrams, &n, MAX_QUERY_TRIGRAMS);
+    if (n == 0) return;
+
+    uint32_t distinct = 0;
+    for (size_t i = 0; i < n; i++) {
+        bool seen = false;
+        for (uint32_t j = 0; j < distinct && !seen; j++) seen = trigrams[j] == trigrams[i];
+        if (!seen) trigrams[distinct++] = trigrams[i];
+    }
+
+    double decode = 0;
+    plan->num_trigrams = distinct;
+    plan->rarest = UINT32_MAX;
+    for (uint32_t i = 0; i < distinct; i++) {
+        uint32_t size = basename_index_list_size(index->base_idx, trigrams[i]);
+        if (size == 0) {
+            plan->cost[PLAN_EMPTY] = (i + 1) * COST_PROBE / 1000;
+            plan->est_matches = 0;
+            return;
+        }
+        decode += size * COST_VARINT_ID;
+        plan->rarest = MIN(plan->rarest, size);
+    }
+    plan->est_matches = plan->rarest;
+    plan->cost[PLAN_BASENAME] = (distinct * COST_PROBE + decode + plan->rarest * COST_VERIFY) / 1000;
+}
+
+/* Anchored regexes: two binary searches bound every candidate, checked by one comparison each */
+static void plan_anchor(const qfind_index_t *index, const query_ctx_t *query, query_plan_t *plan) {
+    anchor_query_t a;
+    const uint32_t *ids;
+    uint32_t n;
+    bool ascending;
+    if (!anchor_parse(query->query, true, &a) ||
+        !anchor_index_range(index, &a, query->basename, &ids, &n, &ascending)) return;
+
+    uint32_t indexed = anchor_index_num_files(index->anchors);
+    double probes = 2 * log2(MAX(indexed, 2));
+    double sort = ascending || n < 2 ? 0 : n * log2(n) * COST_SORT_STEP;
+    plan->cost[PLAN_ANCHOR] = (probes * COST_PROBE + sort + n * COST_EMIT +
+                               (index->num_files - indexed) * COST_VERIFY) / 1000;
+    plan->est_matches = n;
+}
+
+void plan_query(const qfind_index_t *index, const query_ctx_t *query, query_plan_t *plan) {
+    const short_index_t *s = &index->short_idx;
+    const char *q = query->query;
+    size_t len = strlen(q);
+    bool folded_exact = !query->case_sensitive || !has_ascii_letters(q);
+
+    memset(plan, 0, sizeof(*plan));
+    for (int k = 0; k < PLAN_KINDS; k++) plan->cost[k] = -1;
+    plan->bloom_fpr = ffbloom_fpr(index->bloom, index->bloom_items);
+    plan->est_matches = s->num_files;
+    plan->scope_fraction = 1;
+    plan->filter_fraction = 1;
+    id_range_t range = ID_RANGE_ALL;
+    if (query->scope && index->num_files > 0) {
+        range = index_scope_range(index, query->scope);
+        plan->scope_fraction = (double)(range.end - range.first + index->num_files - index->num_walked) /
+                               index->num_files;
+    }
+
+    // Always applicable, and the only choice for regexes and the empty pattern
+    double per_byte = query->regex_enabled ? COST_REGEX_BYTE : COST_SCAN_BYTE;
+    plan->cost[PLAN_SCAN] = (s->names_size * per_byte / scan_threads(s, query->regex_enabled) +
+                             (index->num_files - s->num_files) * COST_VERIFY) / 1000;
+
+    if (query->regex_enabled && index->anchors) plan_anchor(index, query, plan);
+
+    if (query->basename) {
+        // The other structures see whole paths
+        plan->cost[PLAN_SCAN] += s->num_files * COST_BASENAME / scan_threads(s, query->regex_enabled) / 1000;
+        plan_basename(index, query, plan);
+    } else if (!query->regex_enabled && len > 0) {
+        if (index->fm) {
+            uint64_t occurrences = fm_index_count(index->fm, q);
+            plan->cost[PLAN_FM] = (len * COST_FM_STEP + occurrences * COST_FM_LOCATE +
+                                   occurrences * (folded_exact ? COST_EMIT : COST_VERIFY)) / 1000;
+            plan->est_matches = MIN((double)occurrences, s->num_files);
+        }
+
+        if (len < TRIGRAM_SIZE) {
+            double candidates = s->num_files;
+            for (size_t i = 0; i < len; i++)
+                candidates *= byte_density(s, (unsigned char)q[i], query->case_sensitive);
+            double words = (s->num_files + 63) / 64.0;
+            double tail = len == 1 ? candidates * COST_EMIT
+                                   : MIN(candidates * COST_VERIFY, plan->cost[PLAN_SCAN] * 1000);
+            plan->cost[PLAN_SHORT] = (len * words * COST_BITMAP_WORD + tail) / 1000;
+            if (!index->fm) plan->est_matches = candidates;
+        } else if (index->num_entries > 0) {
+            plan_trigrams(index, query, index->positional && folded_exact, plan);
+        }
+    }
+
+    // Scans and bitmap walks only cover the scope's ids; the rest verify fewer candidates
+    if (plan->cost[PLAN_SCAN] >= 0) plan->cost[PLAN_SCAN] *= plan->scope_fraction;
+    if (plan->cost[PLAN_SHORT] >= 0) plan->cost[PLAN_SHORT] *= plan->scope_fraction;
+    plan->est_matches *= plan->scope_fraction;
+
+    // Attribute filters: sample their selectivity, then price checking the survivors' names
+    if (query->filter.active) {
+        plan->filter_fraction = meta_filter_sample(index, &query->filter, range);
+        double avg_name = s->num_files ? (double)s->names_size / s->num_files : 0;
+        double verify = query->regex_enabled ? avg_name * COST_REGEX_BYTE : COST_VERIFY;
+        if (query->basename) verify += COST_BASENAME;
+        double rows = index->num_files * plan->scope_fraction;
+        plan->cost[PLAN_FILTER] = rows * (COST_COLUMN_ROW + plan->filter_fraction * verify) / 1000;
+        plan->est_matches *= plan->filter_fraction;
+    }
+
+    plan->kind = PLAN_SCAN;
+    for (int k = 0; k < PLAN_KINDS; k++) {
+        if (plan->cost[k] >= 0 && plan->cost[k] < plan->cost[plan->kind]) plan->kind = k;
+    }
+}
+
+void plan_print(const qfind_index_t *index, const query_plan_t *plan, FILE *out) {
+    fprintf(out, "plan: %s (estimated %.1f us, ~%.0f matching files)\n",
+            plan_names[plan->kind], plan->cost[plan->kind], plan->est_matches);
+    for (int k = 0; k < PLAN_KINDS; k++) {
+        if (plan->cost[k] < 0) fprintf(out, "  %-8s n/a\n", plan_names[k]);
+        else fprintf(out, "  %-8s %.1f us%s\n", plan_names[k], plan->cost[k], k == (int)plan->kind ? "  *" : "");
+    }
+    if (plan->num_trigrams) {
+        fprintf(out, "trigrams: %u distinct", plan->num_trigrams);
+        if (plan->rarest && plan->rarest != UINT32_MAX) fprintf(out, ", rarest in %u files", plan->rarest);
+        fprintf(out, "\n");
+    }
+    if (plan->scope_fraction < 1.0)
+        fprintf(out, "scope: %.2f%% of files\n", plan->scope_fraction * 100);
+    if (plan->filter_fraction < 1.0)
+        fprintf(out, "filter: %.2f%% of sampled files pass\n", plan->filter_fraction * 100);
+    if (plan->num_trigrams && plan->bloom_fpr < 1.0)
+        fprintf(out, "bloom: %.4f%% false positives, %u trigrams rejected\n",
+                plan->bloom_fpr * 100, plan->bloom_rejected);
+    fprintf(out, "index: %u files, %zu name bytes, %u trigrams%s%s%s\n", index->num_files,
+            index->short_idx.names_size, index->num_entries, index->fm ? ", fm-index" : "",
+            index->base_idx ? ", basename index" : "", index->anchors ? ", anchor index" : "");
+}
+
+/*
+ * Whether one Aho-Corasick pass over every name (aho_corasick.c) beats
+ * planning and running each pattern of a multi-pattern query on its own.
+ */
+bool plan_prefers_literal_set(const qfind_index_t *index, const query_ctx_t *query) {
+    const short_index_t *s = &index->short_idx;
+    uint32_t n = query->num_patterns + query->num_excludes;
+    double separate = 0;
+    query_ctx_t q = *query;
+    query_plan_t plan;
+
+    for (uint32_t i = 0; i < n; i++) {
+        q.query = (char*)(i < query->num_patterns ? query->patterns[i] : query->excludes[i - query->num_patterns]);
+        plan_query(index, &q, &plan);
+        separate += plan.cost[plan.kind];
+    }
+    double per_byte = n <= 64 ? COST_SCAN_BYTE * 2 : COST_AC_BYTE;
+    double combined = (s->names_size * per_byte / scan_threads(s, false) +
+                       (index->num_files - s->num_files) * COST_VERIFY) / 1000;
+    return combined < separate;
+}
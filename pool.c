@@ -0,0 +1,208 @@
+#include "qfind.h"
+#include <errno.h>
+
+#define POOL_MAX_THREADS 256
+#define POOL_DEQUE_INIT 64           // Initial slots per deque, a power of two
+
+/*
+ * One process-wide pool of worker threads, started on first use with
+ * pool_init()'s size or one thread per online CPU. Each worker owns a
+ * deque: it pushes and pops its own tasks at the tail, newest first,
+ * while idle workers steal from the head of the others', so a task that
+ * fans out keeps its subtasks close and one long task never strands the
+ * work queued behind it. Threads outside the pool spread their tasks
+ * over the deques round-robin. A thread waiting for its tasks runs
+ * queued tasks meanwhile: nested fan-out cannot deadlock, and the caller
+ * is one of the pool_threads() that do the work.
+ */
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    _Atomic uint32_t pending;        // Tasks not yet finished; decremented under lock
+} pool_group_t;
+
+typedef struct {
+    pool_fn fn;
+    void *arg;
+    pool_group_t *group;
+} pool_task_t;
+
+typedef struct {
+    pthread_spinlock_t lock;
+    pool_task_t *tasks;              // Ring of cap slots; [head, tail) are queued
+    uint32_t cap;
+    uint32_t head;
+    uint32_t tail;
+} __attribute__((aligned(64))) pool_deque_t;
+
+static struct {
+    pthread_once_t once;
+    int requested;                   // pool_init() size, 0 for the default
+    bool running;                    // pool_start() has run
+    int num_deques;
+    int started;                     // Worker threads; deques [0, started) get tasks
+    pool_deque_t *deques;
+    pthread_mutex_t lock;            // Idle workers sleep on wake under lock
+    pthread_cond_t wake;
+    _Atomic uint32_t queued;
+    _Atomic uint32_t idle;
+    _Atomic uint32_t next;           // Deque for the next task from outside the pool
+} pool = { .once = PTHREAD_ONCE_INIT, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER };
+
+static __thread int self = -1;       // This worker's deque, -1 outside the pool
+
+static bool deque_push(pool_deque_t *d, pool_task_t task) {
+    pthread_spin_lock(&d->lock);
+    if (d->tail - d->head == d->cap) {
+        uint32_t cap = d->cap ? d->cap * 2 : POOL_DEQUE_INIT;
+        pool_task_t *grown = malloc(cap * sizeof(pool_task_t));
+        if (!grown) {
+            pthread_spin_unlock(&d->lock);
+            return false;
+        }
+        for (uint32_t i = d->head; i != d->tail; i++) grown[i - d->head] = d->tasks[i & (d->cap - 1)];
+        free(d->tasks);
+        d->tasks = grown;
+        d->tail -= d->head;
+        d->head = 0;
+        d->cap = cap;
+    }
+    d->tasks[d->tail++ & (d->cap - 1)] = task;
+    pthread_spin_unlock(&d->lock);
+    return true;
+}
+
+static bool deque_pop(pool_deque_t *d, bool steal, pool_task_t *task) {
+    pthread_spin_lock(&d->lock);
+    bool found = d->head != d->tail;
+    if (found) *task = steal ? d->tasks[d->head++ & (d->cap - 1)] : d->tasks[--d->tail & (d->cap - 1)];
+    pthread_spin_unlock(&d->lock);
+    return found;
+}
+
+/* Own newest task first, else the oldest of another deque */
+static bool find_task(pool_task_t *task) {
+    if (atomic_load(&pool.queued) == 0) return false;
+    if (self >= 0 && deque_pop(&pool.deques[self], false, task)) goto found;
+    int start = self >= 0 ? self + 1 : 0;
+    for (int i = 0; i < pool.num_deques; i++) {
+        if (deque_pop(&pool.deques[(start + i) % pool.num_deques], true, task)) goto found;
+    }
+    return false;
+found:
+    atomic_fetch_sub(&pool.queued, 1);
+    return true;
+}
+
+static void run_task(const pool_task_t *task) {
+    task->fn(task->arg);
+    pool_group_t *g = task->group;
+    pthread_mutex_lock(&g->lock);
+    if (atomic_fetch_sub(&g->pending, 1) == 1) pthread_cond_broadcast(&g->done);
+    pthread_mutex_unlock(&g->lock);
+}
+
+static void *worker_main(void *arg) {
+    self = (int)(intptr_t)arg;
+    for (;;) {
+        pool_task_t task;
+        if (find_task(&task)) {
+            run_task(&task);
+            continue;
+        }
+        // A submitter bumps queued before reading idle, so one of us sees the other
+        pthread_mutex_lock(&pool.lock);
+        atomic_fetch_add(&pool.idle, 1);
+        while (atomic_load(&pool.queued) == 0) pthread_cond_wait(&pool.wake, &pool.lock);
+        atomic_fetch_sub(&pool.idle, 1);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    return NULL;
+}
+
+static void pool_start(void) {
+    pool.running = true;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = pool.requested > 0 ? pool.requested : ncpu > 0 ? (int)ncpu : 1;
+    threads = MIN(threads, POOL_MAX_THREADS);
+    if (threads <= 1) return;
+
+    pool.deques = aligned_alloc(64, (threads - 1) * sizeof(pool_deque_t));
+    if (!pool.deques) {
+        syslog(LOG_WARNING, "No memory for the thread pool; running single-threaded");
+        return;
+    }
+    memset(pool.deques, 0, (threads - 1) * sizeof(pool_deque_t));
+    pool.num_deques = threads - 1;
+    for (int i = 0; i < pool.num_deques; i++) pthread_spin_init(&pool.deques[i].lock, PTHREAD_PROCESS_PRIVATE);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (; pool.started < pool.num_deques; pool.started++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, worker_main, (void*)(intptr_t)pool.started) != 0) {
+            syslog(LOG_WARNING, "Thread pool started with %d of %d workers", pool.started, pool.num_deques);
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+}
+
+/* Size the pool: threads in all, counting the caller; 0 for one per CPU. Only before first use */
+int pool_init(int threads) {
+    if (threads < 0 || threads > POOL_MAX_THREADS) return -EINVAL;
+    if (pool.running) return -EBUSY;
+    pool.requested = threads;
+    return 0;
+}
+
+/* Threads that work on a pool_for(), the caller included */
+int pool_threads(void) {
+    pthread_once(&pool.once, pool_start);
+    return pool.started + 1;
+}
+
+static void submit(pool_task_t task) {
+    int d = self >= 0 ? self : (int)(atomic_fetch_add(&pool.next, 1) % pool.started);
+    atomic_fetch_add(&pool.queued, 1);
+    if (!deque_push(&pool.deques[d], task)) {
+        atomic_fetch_sub(&pool.queued, 1);
+        run_task(&task);
+        return;
+    }
+    if (atomic_load(&pool.idle) > 0) {
+        pthread_mutex_lock(&pool.lock);
+        pthread_cond_signal(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+    }
+}
+
+/*
+ * Run fn on each of the n elements of size bytes at args, in parallel on
+ * the pool, and return once all are done. The caller runs the first one.
+ */
+void pool_for(pool_fn fn, void *args, size_t size, uint32_t n) {
+    pthread_once(&pool.once, pool_start);
+    if (pool.started == 0 || n <= 1) {
+        for (uint32_t i = 0; i < n; i++) fn((char*)args + i * size);
+        return;
+    }
+
+    pool_group_t g = { .pending = n };
+    pthread_mutex_init(&g.lock, NULL);
+    pthread_cond_init(&g.done, NULL);
+    for (uint32_t i = n - 1; i > 0; i--) submit((pool_task_t){ fn, (char*)args + i * size, &g });
+    run_task(&(pool_task_t){ fn, args, &g });
+
+    pool_task_t task;
+    while (atomic_load(&g.pending) > 0 && find_task(&task)) run_task(&task);
+
+    // The last task signals under the lock, so g stays alive until it lets go
+    pthread_mutex_lock(&g.lock);
+    while (atomic_load(&g.pending) > 0) pthread_cond_wait(&g.done, &g.lock);
+    pthread_mutex_unlock(&g.lock);
+    pthread_mutex_destroy(&g.lock);
+    pthread_cond_destroy(&g.done);
+}
@@ -14,10 +14,12 @@
 #define INITIAL_META_CAPACITY 1024
 #define META_GROW_FACTOR 2
 #define MAX_DIR_DEPTH 64
-#define TRIE_PATH_COMPRESS 0xFF
 #define MAX_CANDIDATES 100000
 #define SCORE_THRESHOLD 0.25f
-#define POSTING_CACHE_SIZE 1024
+#define POSTING_CACHE_SIZE 1024      // Decoded posting lists shared by queries
+#define POSTING_CACHE_BYTES (256UL << 20)
+#define RESULT_CACHE_SIZE 256        // Result sets of recent queries
+#define RESULT_CACHE_BYTES (16UL << 20)
 #define MAX_TRIGRAMS 1024 
 
 
@@ -26,18 +28,24 @@ typedef struct {
     float score;
 } scored_result_t;
 
+/* State threaded through one filesystem walk */
+typedef struct {
+    qfind_index_t *index;
+    qfind_db_t *prev;                // Previous database, NULL for a full scan
+    db_writer_t *writer;             // Database being written, NULL if not persisting
+    uint64_t dirs_reused;
+    uint64_t dirs_scanned;
+} build_ctx_t;
+
 int add_file_to_index(qfind_index_t *index, const char *path, file_id_t id);
-static int process_directory(qfind_index_t *index, const char *path, int depth);
-static void free_trie(trie_node_t *node);
-static int insert_path_to_trie(trie_node_t *root, const char *path, file_id_t id);
+static int process_directory(build_ctx_t *ctx, const char *path, const struct stat *dir_st, uint32_t parent,
+                             int depth);
 static int compare_scores(const void *a, const void *b);
 static void process_posting_list(qfind_index_t *index, index_entry_t *entry,
                                file_id_t **candidates, uint32_t *num_candidates);
 static float calculate_relevance_score(file_metadata_t *meta,
                                       trigram_t *query_trigrams,
                                       uint32_t trigram_count);
-static void search_trie(trie_node_t *node, const char *query, size_t pos,
-                       file_id_t *results, uint32_t *count, uint32_t max_results);
 
 qfind_index_t* qfind_init(void) {
     qfind_index_t *index = calloc(1, sizeof(qfind_index_t));
@@ -49,70 +57,128 @@ qfind_index_t* qfind_init(void) {
         return NULL;
     }
 
-    index->trie_root = calloc(1, sizeof(trie_node_t));
-    if (!index->trie_root) {
+    arena_init(&index->path_arena, 0);
+
+    if (io_context_init(&index->io, IO_RINGSIZE, false) != 0) {
         ffbloom_destroy(index->bloom);
         free(index);
         return NULL;
     }
 
-    if (io_context_init(&index->io, IO_RINGSIZE, false) != 0) {
+    if (init_inverted_index() != 0) {
+        io_context_destroy(&index->io);
         ffbloom_destroy(index->bloom);
-        free(index->trie_root);
         free(index);
         return NULL;
     }
 
     pthread_rwlock_init(&index->index_lock, NULL);
+    pthread_mutex_init(&index->perm_lock, NULL);
+    // Without the caches every query decodes and runs afresh
+    index->list_cache = shared_cache_create(POSTING_CACHE_SIZE, POSTING_CACHE_BYTES);
+    index->result_cache = shared_cache_create(RESULT_CACHE_SIZE, RESULT_CACHE_BYTES);
     index->meta_capacity = 0;
     index->num_files = 0;
     
     return index;
 }
 
+static void log_cache_stats(const char *name, shared_cache_t *c) {
+    cache_stats_t st;
+    shared_cache_stats(c, &st);
+    if (st.hits + st.misses == 0) return;
+    syslog(LOG_INFO, "%s cache: %lu hits, %lu misses (%.1f%% hit rate), %lu entries, %lu bytes",
+           name, st.hits, st.misses, 100.0 * st.hits / (st.hits + st.misses), st.entries, st.bytes);
+}
+
 void qfind_destroy(qfind_index_t *index) {
     if (!index) return;
 
+    log_cache_stats("Posting list", index->list_cache);
+    log_cache_stats("Result", index->result_cache);
+    shared_cache_destroy(index->list_cache);
+    shared_cache_destroy(index->result_cache);
+
     ffbloom_destroy(index->bloom);
     io_context_destroy(&index->io);
+    cleanup_inverted_index();
 
-    if (index->trie_root) {
-        free_trie(index->trie_root);
-    }
+    // Path bytes go with their arena, no per-file free
+    arena_destroy(&index->path_arena);
 
-    free(index->compressed_data);
+    // Mapped postings belong to the database mapping
+    if (!index->postings_mapped) {
+        free(index->compressed_data);
+        free(index->entries);
+    }
     free(index->file_metadata);
-    free(index->entries);
+    meta_columns_free(&index->cols);
+    perm_free(index);
+    short_index_free(&index->short_idx);
+    fm_index_free(index);
+    basename_index_free(index);
+    anchor_index_free(index);
+    posting_dict_release(index);
+    db_close(index->db);
     pthread_rwlock_destroy(&index->index_lock);
+    pthread_mutex_destroy(&index->perm_lock);
     free(index);
 }
 
-static void free_trie(trie_node_t *node) {
-    if (!node) return;
-    
-    for (int i = 0; i < 256; i++) {
-        if (node->children[i]) {
-            free_trie(node->children[i]);
-        }
+/* Append one file's metadata row without indexing it; caller holds index_lock */
+int index_append_metadata(qfind_index_t *index, const char *path, const db_entry_t *attr) {
+    if (index->num_files >= index->meta_capacity) {
+        size_t new_cap = index->meta_capacity ? 
+            index->meta_capacity * META_GROW_FACTOR : INITIAL_META_CAPACITY;
+        file_metadata_t *new_meta = realloc(index->file_metadata,
+                                          new_cap * sizeof(file_metadata_t));
+        if (!new_meta) return -ENOMEM;
+        index->file_metadata = new_meta;
+        if (meta_columns_reserve(&index->cols, new_cap) != 0) return -ENOMEM;
+        index->meta_capacity = new_cap;
     }
-    free(node);
+
+    file_metadata_t *meta = &index->file_metadata[index->num_files];
+    meta->path = arena_strdup(&index->path_arena, path);
+    if (!meta->path) return -ENOMEM;
+    meta->id = index->num_files;
+    meta_columns_set(&index->cols, index->num_files, attr);
+    index->num_files++;
+    index_changed(index, false);
+    return 0;
 }
 
-static int process_directory(qfind_index_t *index, const char *base_path, int depth) {
-    if (depth > MAX_DIR_DEPTH) {
-        syslog(LOG_WARNING, "Max directory depth exceeded: %s", base_path);
-        return -ELOOP;
-    }
+/* Append one file's metadata row and index its path; caller holds index_lock */
+int index_append_file(qfind_index_t *index, const char *path, const db_entry_t *attr) {
+    file_id_t id = index->num_files;
+    int ret = index_append_metadata(index, path, attr);
+    if (ret != 0) return ret;
+
+    // A path that could not be indexed drops its row and fails the whole build
+    ret = add_file_to_index(index, path, id);
+    if (ret != 0) index->num_files--;
+    return ret;
+}
+
+static int compare_db_entries(const void *a, const void *b) {
+    return strcmp(((const db_entry_t*)a)->name, ((const db_entry_t*)b)->name);
+}
 
+/* readdir + lstat a changed directory into name-sorted entries (names strdup'd) */
+static int scan_directory_entries(const char *base_path, db_entry_t **out, uint32_t *out_count) {
     DIR *dir = opendir(base_path);
     if (!dir) return -errno;
 
+    db_entry_t *entries = NULL;
+    uint32_t count = 0, capacity = 0;
     struct dirent *entry;
+
     while ((entry = readdir(dir)) != NULL) {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
 
         char full_path[PATH_MAX];
-        if (snprintf(full_path, sizeof(full_path), "%s/%s", base_path, entry->d_name) >= PATH_MAX) {
+        size_t name_len = strlen(entry->d_name);
+        if (db_join_path(full_path, sizeof(full_path), base_path, entry->d_name, name_len) < 0) {
             syslog(LOG_WARNING, "Path truncated: %s/%s", base_path, entry->d_name);
             continue;
         }
@@ -123,105 +189,281 @@ static int process_directory(qfind_index_t *index, const char *base_path, int de
             continue;
         }
 
-        if (S_ISDIR(st.st_mode)) {
-            int fd = open(full_path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
-            if (fd == -1) continue;
+        uint8_t type;
+        if (S_ISDIR(st.st_mode)) type = DB_ENTRY_DIR;
+        else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) type = DB_ENTRY_FILE;
+        else continue;
 
-            int ret = process_directory(index, full_path, depth + 1);
-            close(fd);
-            if (ret != 0) {
-                closedir(dir);
-                return ret;
-            }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            db_entry_t *grown = realloc(entries, capacity * sizeof(db_entry_t));
+            if (!grown) goto oom;
+            entries = grown;
         }
-        else if (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode)) {
-            pthread_rwlock_wrlock(&index->index_lock);
-
-            if (index->num_files >= index->meta_capacity) {
-                size_t new_cap = index->meta_capacity ? 
-                    index->meta_capacity * META_GROW_FACTOR : INITIAL_META_CAPACITY;
-                file_metadata_t *new_meta = realloc(index->file_metadata,
-                                                  new_cap * sizeof(file_metadata_t));
-                if (!new_meta) {
-                    pthread_rwlock_unlock(&index->index_lock);
-                    closedir(dir);
-                    return -ENOMEM;
-                }
-                index->file_metadata = new_meta;
-                index->meta_capacity = new_cap;
-            }
 
-            file_metadata_t *meta = &index->file_metadata[index->num_files];
-            strncpy(meta->path, full_path, PATH_MAX - 1);
-            meta->path[PATH_MAX - 1] = '\0';
-            meta->id = index->num_files;
-            meta->permissions = st.st_mode;
-            meta->modified = st.st_mtime;
+        char *name = strdup(entry->d_name);
+        if (!name) goto oom;
+        entries[count] = (db_entry_t){
+            .name = name,
+            .name_len = name_len,
+            .type = type
+        };
+        meta_entry_from_stat(&entries[count++], &st);
+    }
+    closedir(dir);
 
-            if (add_file_to_index(index, full_path, index->num_files) == 0) {
-                index->num_files++;
-            }
+    // Sorted entries make the database and the id order independent of readdir order
+    qsort(entries, count, sizeof(db_entry_t), compare_db_entries);
+    *out = entries;
+    *out_count = count;
+    return 0;
+
+oom:
+    closedir(dir);
+    for (uint32_t i = 0; i < count; i++) free((char*)entries[i].name);
+    free(entries);
+    return -ENOMEM;
+}
 
-            pthread_rwlock_unlock(&index->index_lock);
+/* Copy a previous database record's entries; names stay pointers into the mapping */
+static int reuse_directory_entries(db_dir_t *old, db_entry_t **out, uint32_t *out_count) {
+    db_entry_t *entries = malloc((old->num_entries ? old->num_entries : 1) * sizeof(db_entry_t));
+    if (!entries) return -ENOMEM;
+
+    uint32_t count = 0;
+    while (count < old->num_entries && db_dir_next_entry(old, &entries[count])) count++;
+
+    *out = entries;
+    *out_count = count;
+    return 0;
+}
+
+static int64_t stat_time_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/*
+ * Walk one directory. If the previous database has a record for it with the
+ * same mtime and ctime, its entry list and the files' attributes are reused
+ * without readdir/lstat, as mlocate does; subdirectories are still stat'ed
+ * to compare their own times.
+ * Files get ids in walk order, so every subtree covers a contiguous id range.
+ */
+static int process_directory(build_ctx_t *ctx, const char *base_path, const struct stat *dir_st, uint32_t parent,
+                             int depth) {
+    if (depth > MAX_DIR_DEPTH) {
+        syslog(LOG_WARNING, "Max directory depth exceeded: %s", base_path);
+        return 0;
+    }
+
+    db_entry_t *entries = NULL;
+    uint32_t num_entries = 0;
+    bool reused = false;
+    db_dir_t old;
+
+    if (ctx->prev && db_find_dir(ctx->prev, base_path, &old) &&
+        old.mtime_ns == stat_time_ns(&dir_st->st_mtim) &&
+        old.ctime_ns == stat_time_ns(&dir_st->st_ctim)) {
+        if (reuse_directory_entries(&old, &entries, &num_entries) != 0) return -ENOMEM;
+        reused = true;
+        ctx->dirs_reused++;
+    } else {
+        int ret = scan_directory_entries(base_path, &entries, &num_entries);
+        if (ret == -ENOMEM) return ret;
+        if (ret != 0) {
+            // Unreadable directories are skipped, not fatal
+            syslog(LOG_INFO, "Skipping %s: %s", base_path, strerror(-ret));
+            return 0;
         }
+        ctx->dirs_scanned++;
     }
 
-    closedir(dir);
-    return 0;
+    int ret = 0;
+    if (ctx->writer) ret = db_writer_add_dir(ctx->writer, base_path, dir_st, entries, num_entries);
+
+    uint32_t dir = DIR_NONE;
+    if (ret == 0) {
+        pthread_rwlock_wrlock(&ctx->index->index_lock);
+        ret = perm_add_dir(ctx->index, parent, dir_st->st_mode, dir_st->st_uid, dir_st->st_gid, &dir);
+        pthread_rwlock_unlock(&ctx->index->index_lock);
+    }
+
+    char full_path[PATH_MAX];
+    for (uint32_t i = 0; i < num_entries && ret == 0; i++) {
+        db_entry_t *e = &entries[i];
+        if (e->type != DB_ENTRY_FILE) continue;
+        if (db_join_path(full_path, sizeof(full_path), base_path, e->name, e->name_len) < 0) continue;
+
+        pthread_rwlock_wrlock(&ctx->index->index_lock);
+        ret = index_append_file(ctx->index, full_path, e);
+        pthread_rwlock_unlock(&ctx->index->index_lock);
+    }
+    if (ret == 0) ctx->index->dirs[dir].end = ctx->index->num_files;
+
+    for (uint32_t i = 0; i < num_entries && ret == 0; i++) {
+        db_entry_t *e = &entries[i];
+        if (e->type != DB_ENTRY_DIR) continue;
+        if (db_join_path(full_path, sizeof(full_path), base_path, e->name, e->name_len) < 0) continue;
+
+        struct stat st;
+        if (lstat(full_path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        ret = process_directory(ctx, full_path, &st, dir, depth + 1);
+    }
+
+    if (!reused) {
+        for (uint32_t i = 0; i < num_entries; i++) free((char*)entries[i].name);
+    }
+    free(entries);
+    return ret;
 }
 
-int qfind_build_index(qfind_index_t *index, const char *root_path) {
-    struct stat st;
-    if (lstat(root_path, &st) != 0 || !S_ISDIR(st.st_mode)) return -errno;
+/*
+ * Where path sorts in walk order relative to the subtree at dir (no
+ * trailing '/'): < 0 before it, 0 inside, > 0 after. Within a directory
+ * files come first, then subdirectories, each in strcmp() order of name.
+ */
+static int walk_compare(const char *path, const char *dir, size_t dir_len) {
+    size_t i = 0;
+    while (i < dir_len && path[i] == dir[i]) i++;
+    if (i == dir_len && path[i] == '/') return 0;
+
+    // They part inside one component of a common parent directory
+    size_t start = i;
+    while (start > 0 && dir[start - 1] != '/') start--;
+    if (!strchr(path + start, '/')) return -1;  // A file of the parent: before its subdirectories
+
+    for (size_t k = start;; k++) {
+        unsigned char x = path[k] == '/' ? 0 : path[k];
+        unsigned char y = k >= dir_len || dir[k] == '/' ? 0 : dir[k];
+        if (x != y) return x < y ? -1 : 1;
+        if (!x) return -1;
+    }
+}
 
-    index->file_metadata = malloc(INITIAL_META_CAPACITY * sizeof(file_metadata_t));
-    if (!index->file_metadata) return -ENOMEM;
+/* Walk-order position id's path; deleted rows take their successor's, NULL past the end */
+static const char *walk_key(const qfind_index_t *index, uint32_t id) {
+    for (; id < index->num_walked; id++) {
+        if (index->file_metadata[id].path[0]) return index->file_metadata[id].path;
+    }
+    return NULL;
+}
 
-    index->meta_capacity = INITIAL_META_CAPACITY;
-    index->num_files = 0;
+/*
+ * The ids of files under dir: a contiguous run of the walk-ordered ids,
+ * found by binary search. Files added since (ids >= num_walked) are not
+ * included; callers check them by path.
+ */
+id_range_t index_scope_range(const qfind_index_t *index, const char *dir) {
+    size_t len = strlen(dir);
+    while (len > 0 && dir[len - 1] == '/') len--;
+    if (len == 0) return (id_range_t){ 0, index->num_walked };
+
+    id_range_t range;
+    uint32_t lo = 0, hi = index->num_walked;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char *key = walk_key(index, mid);
+        if (key && walk_compare(key, dir, len) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    range.first = lo;
+    hi = index->num_walked;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const char *key = walk_key(index, mid);
+        if (key && walk_compare(key, dir, len) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+    range.end = lo;
+    return range;
+}
+
+/* One finalize step that builds a structure of its own from the walked files */
+typedef struct {
+    int (*build)(qfind_index_t *index);
+    qfind_index_t *index;
+    int ret;
+} build_task_t;
+
+static void run_build_task(void *arg) {
+    build_task_t *t = arg;
+    t->ret = t->build(t->index);
+}
+
+static int walk_and_finalize(build_ctx_t *ctx, const char *root_path) {
+    struct stat st;
+    if (lstat(root_path, &st) != 0) return -errno;
+    if (!S_ISDIR(st.st_mode)) return -ENOTDIR;
 
-    int ret = process_directory(index, root_path, 0);
+    int ret = process_directory(ctx, root_path, &st, DIR_NONE, 0);
     if (ret == 0) {
-        pthread_rwlock_wrlock(&index->index_lock);
-        ret = compress_posting_lists(index);
-        pthread_rwlock_unlock(&index->index_lock);
+        pthread_rwlock_wrlock(&ctx->index->index_lock);
+        ret = compress_posting_lists(ctx->index);
+        if (ret == 0) ret = short_index_build(ctx->index);
+        if (ret == 0) plan_prepare(ctx->index);
+        ctx->index->num_walked = ctx->index->num_files;
+        // Independent of each other, so they run as pool tasks side by side
+        build_task_t tasks[] = {
+            { basename_index_build, ctx->index, 0 },
+            { anchor_index_build, ctx->index, 0 },
+            { fm_index_build, ctx->index, 0 }
+        };
+        uint32_t n = ctx->index->build_fm ? 3 : 2;
+        if (ret == 0) pool_for(run_build_task, tasks, sizeof(build_task_t), n);
+        for (uint32_t i = 0; ret == 0 && i < n; i++) ret = tasks[i].ret;
+        pthread_rwlock_unlock(&ctx->index->index_lock);
     }
     return ret;
 }
 
-static int insert_path_to_trie(trie_node_t *root, const char *path, file_id_t id) {
-    trie_node_t *current = root;
-    const char *p = path;
-
-    while (*p) {
-        if (*p == *(p+1)) {
-            uint8_t count = 1;
-            while (*p == *(p+count) && count < UINT8_MAX) count++;
-            
-            if (!current->children[TRIE_PATH_COMPRESS]) {
-                current->children[TRIE_PATH_COMPRESS] = calloc(1, sizeof(trie_node_t));
-                if (!current->children[TRIE_PATH_COMPRESS]) return -1;
-                current->children[TRIE_PATH_COMPRESS]->key = TRIE_PATH_COMPRESS;
-            }
-            current = current->children[TRIE_PATH_COMPRESS];
-            current->count = count;
-            p += count;
-        }
-        else {
-            unsigned char c = *p;
-            if (!current->children[c]) {
-                current->children[c] = calloc(1, sizeof(trie_node_t));
-                if (!current->children[c]) return -1;
-                current->children[c]->key = c;
-            }
-            current = current->children[c];
-            p++;
-        }
+int qfind_build_index(qfind_index_t *index, const char *root_path) {
+    build_ctx_t ctx = { .index = index };
+    return walk_and_finalize(&ctx, root_path);
+}
+
+/*
+ * Rebuild the database at db_path, reusing the previous one for every
+ * directory whose mtime/ctime did not change. The new database replaces
+ * the old one atomically on success.
+ */
+int qfind_update_database(qfind_index_t *index, const char *root_path, const char *db_path) {
+    build_ctx_t ctx = { .index = index };
+
+    ctx.prev = db_open(db_path);
+    ctx.writer = db_writer_create(db_path, index->use_dicts ? DB_WRITE_PATH_DICT : 0);
+    if (!ctx.writer) {
+        int err = errno;
+        syslog(LOG_ERR, "Cannot create database %s: %s", db_path, strerror(err));
+        db_close(ctx.prev);
+        return -err;
     }
 
-    current->is_end = true;
-    current->file_id = id;
-    return 0;
+    int ret = walk_and_finalize(&ctx, root_path);
+
+    // Reused entries point into the old mapping, so it is closed last
+    if (ret == 0) ret = db_writer_add_postings(ctx.writer, index);
+    if (ret == 0 && index->fm) {
+        size_t fm_size;
+        const void *fm_blob = fm_index_blob(index->fm, &fm_size);
+        ret = db_writer_add_section(ctx.writer, DB_SECTION_FM_INDEX, fm_blob, fm_size);
+    }
+    if (ret == 0 && index->base_idx) {
+        size_t base_size;
+        const void *base_blob = basename_index_blob(index->base_idx, &base_size);
+        ret = db_writer_add_section(ctx.writer, DB_SECTION_BASENAMES, base_blob, base_size);
+    }
+    if (ret == 0 && index->anchors) {
+        size_t anchor_size;
+        const void *anchor_blob = anchor_index_blob(index->anchors, &anchor_size);
+        ret = db_writer_add_section(ctx.writer, DB_SECTION_ANCHORS, anchor_blob, anchor_size);
+    }
+    if (ret == 0) ret = db_writer_commit(ctx.writer);
+    else db_writer_abort(ctx.writer);
+    db_close(ctx.prev);
+
+    syslog(LOG_INFO, "Database update: %lu directories rescanned, %lu reused",
+           (unsigned long)ctx.dirs_scanned, (unsigned long)ctx.dirs_reused);
+    return ret;
 }
 
 static int compare_scores(const void *a, const void *b) {
@@ -230,15 +472,16 @@ static int compare_scores(const void *a, const void *b) {
 
 static void process_posting_list(qfind_index_t *index, index_entry_t *entry,
                                file_id_t **candidates, uint32_t *num_candidates) {
-    uint8_t *compressed = (uint8_t*)index->compressed_data + entry->offset;
     uint8_t *decompressed = mmap(NULL, entry->num_files * sizeof(file_id_t),
-                                PROT_READ, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+                                PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
     if (decompressed == MAP_FAILED) return;
     
-    size_t decomp_size = ZSTD_decompress(decompressed,
-                                        entry->num_files * sizeof(file_id_t),
-                                        compressed, entry->size);
-    if (ZSTD_isError(decomp_size)) {
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    size_t decomp_size = dctx ? posting_decompress(index, dctx, entry, decompressed,
+                                                   entry->num_files * sizeof(file_id_t))
+                              : (size_t)-1;
+    ZSTD_freeDCtx(dctx);
+    if (!dctx || ZSTD_isError(decomp_size)) {
         munmap(decompressed, entry->num_files * sizeof(file_id_t));
         return;
     }
@@ -285,37 +528,3 @@ static float calculate_relevance_score(file_metadata_t *meta,
     
     return score / sqrtf(path_len);
 }
-
-static void search_trie(trie_node_t *node, const char *query, size_t pos,
-                       file_id_t *results, uint32_t *count, uint32_t max_results) {
-    if (!node || *count >= max_results) return;
-
-    if (node->key == TRIE_PATH_COMPRESS) {
-        size_t remaining = node->count;
-        const char *q = query + pos;
-        
-        while (remaining > 0 && *q == *(q-1)) {
-            remaining--;
-            q++;
-        }
-        
-        if (remaining == 0) {
-            pos += node->count;
-        } else {
-            return;
-        }
-    } else if (node->key != 0) {
-        if (pos >= strlen(query) || node->key != query[pos]) return;
-        pos++;
-    }
-
-    if (node->is_end && pos == strlen(query)) {
-        results[(*count)++] = node->file_id;
-    }
-
-    for (int i = 0; i < 256; i++) {
-        if (node->children[i]) {
-            search_trie(node->children[i], query, pos, results, count, max_results);
-        }
-    }
-}
@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <liburing.h>
+#include <zstd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -26,21 +28,33 @@
 #define BLOOM_SEC_SIZE (1 << 24)     // 16MB secondary bloom filter
 #define MAX_HASH_FUNCS 8             // Number of hash functions for Bloom filter
 #define TRIGRAM_SIZE 3               // Size of n-grams in bytes
+#define MAX_QUERY_TRIGRAMS PATH_MAX  // Trigrams considered per query
 #define BATCH_SIZE 128               // I/O batch size
-#define WORKER_THREADS 16            // Number of parallel worker threads
 #define INDEX_BLOCK_SIZE (1 << 16)   // 64KB blocks for inverted index
 #define MAX_RESULTS 10000            // Maximum results to return
+#define TRIGRAM_PARALLEL_IDS (1 << 16) // Rarest lists this long are intersected in parallel slices
 #define IO_RINGSIZE 1024             // Size of io_uring queue
 #define POLLIN 0x001  // From sys/poll.h
 #define MAX_REG_BUFFERS 1024
 #define CQE_BATCH_SIZE 32
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
 
 
 
 typedef uint64_t file_id_t;
 typedef uint32_t trigram_t;
 
+typedef struct qfind_db qfind_db_t;
+typedef struct db_writer db_writer_t;
+typedef struct fm_index fm_index_t;
+typedef struct basename_index basename_index_t;
+typedef struct anchor_index anchor_index_t;
+typedef struct ac_automaton ac_automaton_t;
+typedef struct perm_class perm_class_t;
+typedef struct shared_cache shared_cache_t;
+typedef void (*pool_fn)(void *arg);
+
 /* Opaque Bloom filter type */
 struct ffbloom_s;  // Forward declaration
 typedef struct ffbloom_s *ffbloom_t;
@@ -49,50 +63,95 @@ typedef struct ffbloom_s *ffbloom_t;
 typedef struct {
     trigram_t trigram;               // The 3-byte sequence
     uint32_t num_files;              // Number of files containing this trigram
-    uint32_t offset;                 // Offset to compressed posting list
+    uint64_t offset;                 // Offset to compressed posting list
     uint32_t size;                   // Size of compressed posting list
+    uint32_t reserved;               // Zero; the struct is the POST record, no hidden padding
 } index_entry_t;
 
+/*
+ * Encoded posting list, the content of each zstd frame:
+ *   uint8 k | uint8 flags | uint32 num_ids | Golomb-Rice id deltas (MSB first)
+ *   [POSTING_POSITIONAL: per id, varint count and varint position deltas]
+ */
+#define POSTING_HEADER_SIZE 6
+#define POSTING_POSITIONAL 0x1
+
 /* Posting List Entry */
 typedef struct {
     file_id_t file_id;               // File identifier
     uint16_t positions[];            // Variable-length array of positions
 } posting_t;
 
-/* Suffix Trie Node for short queries */
-
-// typedef struct trie_node {
-//     char key;
-//     bool is_end;
-//     file_id_t file_id;
-//     struct trie_node *children[256];
-//     uint32_t num_children;
-//     uint32_t count;  // Add this line
-// } trie_node_t;
-
 typedef struct posting_buffer {
     uint32_t *deltas;
     size_t capacity;
     size_t count;
 } posting_buffer_t;
 
-typedef struct trie_node {
-    unsigned char key;
-    bool is_end;
-    file_id_t file_id;
-    struct trie_node *children[256];
-    uint32_t num_children;
-    uint32_t count;
-} trie_node_t;
-
-/* File Metadata */
+/* Bump allocator over huge-page chunks, released all at once (arena.c) */
+typedef struct arena_chunk arena_chunk_t;
+typedef struct {
+    arena_chunk_t *chunks;
+    uint8_t *cur;
+    uint8_t *end;
+    size_t chunk_size;
+    size_t mapped;                   // Bytes mapped across all chunks
+} arena_t;
+
+/* File Metadata; the file's attributes are in meta_columns_t under the same id */
 typedef struct {
     file_id_t id;                    // Unique file identifier
-    char path[PATH_MAX];             // Absolute file path
-    uint32_t permissions;            // File permissions
-    time_t modified;                 // Last modified timestamp
+    char *path;                      // Absolute file path, in the index's path arena
 } file_metadata_t;
 
+/* Per-file attributes stored column-wise, indexed by file id (columns.c) */
+typedef struct {
+    uint64_t *size;
+    int64_t *mtime;                  // Seconds
+    uint32_t *mode;                  // st_mode: file type and permission bits
+    uint32_t *uid;
+    uint32_t *gid;
+    uint64_t *ino;
+} meta_columns_t;
+
+/* Attribute predicates of a query; inactive unless some option set them */
+typedef struct {
+    uint64_t min_size, max_size;     // Inclusive bounds in bytes
+    int64_t min_mtime, max_mtime;    // Inclusive bounds in seconds
+    uint32_t types;                  // Bit (mode & S_IFMT) >> 12 per accepted type, 0 for any
+    uint32_t owner;                  // META_ANY_OWNER for any
+    bool active;
+} meta_filter_t;
+
+#define META_ANY_OWNER UINT32_MAX
+
+/* A value held by a shared_cache_t, freed by release after its last reference (cache.c) */
+typedef struct cache_obj {
+    _Atomic uint32_t refs;
+    size_t bytes;                    // Charged against the cache's budget
+    void (*release)(struct cache_obj *obj);
+    struct cache_obj *next;          // Eviction chain, owned by the cache
+} cache_obj_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t entries;
+    uint64_t bytes;
+} cache_stats_t;
+
+/* A walked directory and the run of ids of its own files (perm.c) */
+typedef struct {
+    uint32_t parent;                 // Index of the parent directory, DIR_NONE for the root
+    uint32_t first;                  // Its files are ids [first, end)
+    uint32_t end;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+} dir_perm_t;
+
+#define DIR_NONE UINT32_MAX
+
 /* io_uring Context */
 typedef struct io_cqe {
     uint64_t user_data;
@@ -118,17 +177,99 @@ typedef struct {
 
 
 
+/* Packed names and per-byte file bitmaps for 1-2 byte patterns (short_query.c) */
+typedef struct {
+    char *names;                     // Every path, NUL-terminated, in id order
+    size_t names_size;
+    uint64_t *name_offsets;          // num_files + 1 offsets into names
+    uint64_t *byte_bitmaps[256];     // Files containing each raw byte, NULL if none do
+    uint32_t num_files;              // Files covered by the last build
+} short_index_t;
+
+/* Query execution strategies, chosen per query by cost (plan.c) */
+typedef enum {
+    PLAN_EMPTY,                      // Bloom filter or trigram dictionary proves no match
+    PLAN_SHORT,                      // Byte bitmaps for 1-2 byte patterns
+    PLAN_TRIGRAM,                    // Posting list intersection
+    PLAN_FM,                         // FM-index backward search
+    PLAN_SCAN,                       // Parallel scan of every name
+    PLAN_BASENAME,                   // Basename trigram lists (basename queries only)
+    PLAN_ANCHOR,                     // Sorted path or suffix order for anchored queries
+    PLAN_FILTER,                     // Attribute column scan, then the name check
+    PLAN_KINDS
+} plan_kind_t;
+
+typedef struct {
+    plan_kind_t kind;                // Cheapest applicable strategy
+    double cost[PLAN_KINDS];         // Estimated microseconds, < 0 when not applicable
+    double est_matches;              // Estimated matching files
+    uint32_t num_trigrams;           // Distinct query trigrams
+    uint32_t rarest;                 // Files in the shortest posting list
+    uint32_t bloom_rejected;         // Query trigrams the bloom filter ruled out
+    double bloom_fpr;                // Bloom false positive rate, 1 when not consulted
+    double scope_fraction;           // Share of the files under query->scope, 1 without one
+    double filter_fraction;          // Sampled share passing query->filter, 1 without one
+} query_plan_t;
+
+/* File ids [first, end) */
+typedef struct {
+    uint32_t first;
+    uint32_t end;
+} id_range_t;
+
+#define ID_RANGE_ALL ((id_range_t){ 0, UINT32_MAX })
+
+/* Growable id array filled by the query engines */
+typedef struct {
+    file_id_t *ids;
+    uint32_t n;
+    uint32_t cap;
+} id_list_t;
+
+/* A compiled literal set selecting names (aho_corasick.c) */
+typedef struct {
+    const ac_automaton_t *ac;
+    uint32_t num_positive;           // Literals [0, num_positive) select, the rest exclude
+    bool match_all;                  // Every positive literal must occur, not just one
+} ac_select_t;
+
 /* Main Index Structure */
 typedef struct {
-    ffbloom_t bloom;                 // Feed-forward Bloom filter
+    ffbloom_t bloom;                 // Feed-forward Bloom filter of indexed trigrams
+    uint64_t bloom_items;            // Trigrams added by the last plan_prepare()
     index_entry_t *entries;          // Array of index entries
     uint32_t num_entries;            // Number of index entries
     void *compressed_data;           // Compressed posting lists
     size_t compressed_size;          // Size of compressed data in bytes
+    bool postings_mapped;            // entries/compressed_data point into db
+    bool use_dicts;                  // Train zstd dictionaries at build time
+    size_t memory_limit;             // Build budget in bytes; 0 keeps everything in RAM
+    bool positional;                 // Postings carry trigram offsets within the path
+    void *posting_dict;              // Trained posting dictionary bytes
+    size_t posting_dict_size;
+    bool posting_dict_owned;
+    ZSTD_CDict *posting_cdict;
+    ZSTD_DDict *posting_ddict;
+    qfind_db_t *db;                  // Mapped database backing the index, if loaded
     size_t meta_capacity;
-    trie_node_t *trie_root;          // Root of the suffix trie
+    arena_t path_arena;              // file_metadata_t path bytes
     file_metadata_t *file_metadata;  // Array of file metadata
+    meta_columns_t cols;             // Attributes, meta_capacity rows per column
+    dir_perm_t *dirs;                // Walked directories in walk order
+    uint32_t num_dirs;
+    uint32_t dirs_capacity;
+    perm_class_t *perm_classes;      // Cached visibility bitmaps per user class
+    pthread_mutex_t perm_lock;
+    shared_cache_t *list_cache;      // Decoded posting lists by trigram, shared by queries
+    shared_cache_t *result_cache;    // Query results by normalized query and epoch
+    _Atomic uint64_t epoch;          // Bumped by index_changed()
+    short_index_t short_idx;         // Short-pattern structures, rebuilt at finalize
+    bool build_fm;                   // Build an FM-index at finalize
+    fm_index_t *fm;                  // FM-index over short_idx names, NULL if not built
+    basename_index_t *base_idx;      // Trigram index over basenames, NULL if not built
+    anchor_index_t *anchors;         // Sorted orders for anchored queries, NULL if not built
     uint32_t num_files;              // Number of files in the index
+    uint32_t num_walked;             // Files [0, num_walked) have ids in walk order
     io_context_t io;                 // I/O context for async operations
     pthread_rwlock_t index_lock;     // Read-write lock for index access
 } qfind_index_t;
@@ -136,8 +277,16 @@ typedef struct {
 /* Query Context */
 typedef struct {
     char *query;                     // Search query string
+    const char **patterns;           // Multi-pattern query; query is ignored when set
+    uint32_t num_patterns;
+    const char **excludes;           // Files matching any of these are dropped
+    uint32_t num_excludes;
+    bool match_all;                  // Require every pattern rather than any
     bool case_sensitive;             // Whether search is case sensitive
     bool regex_enabled;              // Whether regex matching is enabled
+    bool basename;                   // Match against the last path component only
+    const char *scope;               // Only files under this directory, if set
+    meta_filter_t filter;            // Size, age, type and owner predicates
     file_id_t *results;              // Result buffer
     uint32_t num_results;            // Number of results found
     uint32_t max_results;            // Maximum results to return
@@ -145,19 +294,45 @@ typedef struct {
     gid_t group_id;                  // Group ID for permission filtering
 } query_ctx_t;
 
+/* A pattern anchored at the start and/or end of the path (anchor.c) */
+typedef struct {
+    char literal[PATH_MAX];          // Unescaped text between the anchors
+    size_t len;
+    bool prefix;                     // Path starts with literal
+    bool suffix;                     // Path ends with literal; both: equals it
+} anchor_query_t;
 
+/* One query of a batch and, after qfind_search_batch(), its results */
+typedef struct {
+    const char *pattern;
+    file_id_t *results;
+    uint32_t num_results;
+    int error;
+} batch_query_t;
+
+typedef enum {
+    LSM_ADD,
+    LSM_DEL,
+    LSM_RENAME                       // Index path (and descendants) under their new names
+} lsm_op_t;
+
+/* Update record carved from an lsm_batch_t ring; state and size lead so pads can reuse them */
 typedef struct lsm_node {
+    _Atomic uint32_t state;          // LSM_NODE_* publication state
+    uint32_t size;                   // Record bytes including header, 8-byte aligned
     file_id_t id;
-    char *path;
-    bool is_add;
-    struct lsm_node *next;
+    lsm_op_t op;
+    uint16_t path_len;
+    char path[];
 } lsm_node_t;
 
+/* Bounded multi-producer, single-consumer byte ring of lsm_node_t records */
 typedef struct lsm_batch {
-    lsm_node_t *head;
-    lsm_node_t *tail;
-    size_t count;
-    pthread_spinlock_t lock;
+    _Atomic uint64_t head;           // Next byte to reserve (producers, CAS)
+    _Atomic uint64_t tail;           // Next byte to consume (consumer only)
+    _Atomic size_t count;            // Published, unconsumed records
+    uint8_t *ring;
+    size_t capacity;                 // Bytes, power of two
 } lsm_batch_t;
 
 
@@ -165,6 +340,68 @@ typedef struct lsm_batch {
 
 #define INVALID_FILE_ID ((file_id_t)-1)
 
+/* Trigrams and queries are matched ASCII case-insensitively */
+static inline unsigned char fold_ascii(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline unsigned char upper_ascii(unsigned char c) {
+    return (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+}
+
+/* Case-folded matches are only exact for a case-sensitive query without letters */
+static inline bool has_ascii_letters(const char *s) {
+    for (; *s; s++) {
+        if ((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z')) return true;
+    }
+    return false;
+}
+
+/* On-disk database */
+#define DEFAULT_DB_PATH "/var/lib/qfind/qfind.db"
+#define DB_MAGIC 0x42444651          // "QFDB"
+#define DB_VERSION 5
+#define DB_SECTION_DIRS 0x53524944   // "DIRS"
+#define DB_SECTION_DIRS_ZSTD 0x5A524944  // "DIRZ": DIRS as dictionary-compressed blocks
+#define DB_SECTION_PATH_DICT 0x43494450  // "PDIC"
+#define DB_SECTION_POSTINGS 0x54534F50   // "POST"
+#define DB_SECTION_POSTING_DICT 0x43494458  // "XDIC"
+#define DB_SECTION_FM_INDEX 0x58494D46  // "FMIX"
+#define DB_SECTION_BASENAMES 0x45534142  // "BASE"
+#define DB_SECTION_ANCHORS 0x48434E41  // "ANCH"
+
+#define DB_WRITE_PATH_DICT 0x1       // db_writer_create(): train a path dictionary
+
+#define DB_ENTRY_FILE 0
+#define DB_ENTRY_DIR 1
+
+
+/* Directory entry as stored in (or about to be written to) a database */
+typedef struct {
+    const char *name;                // Not NUL-terminated when read from a database
+    uint16_t name_len;
+    uint8_t type;                    // DB_ENTRY_*
+    uint32_t mode;
+    int64_t mtime;
+    uint64_t size;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t ino;
+} db_entry_t;
+
+/* Directory record of a mapped database, iterated with db_dir_next_entry() */
+typedef struct {
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint32_t mode;                   // The directory's own mode and owner
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t num_entries;
+    uint32_t remaining;
+    const uint8_t *cursor;
+    const uint8_t *end;
+} db_dir_t;
+
 
 
 /* Function Prototypes */
@@ -172,14 +409,100 @@ qfind_index_t* qfind_init(void);
 void qfind_destroy(qfind_index_t *index);
 
 int qfind_build_index(qfind_index_t *index, const char *root_path);
+int qfind_update_database(qfind_index_t *index, const char *root_path, const char *db_path);
+int qfind_load_database(qfind_index_t *index, const char *db_path);
+id_range_t index_scope_range(const qfind_index_t *index, const char *dir);
+int index_append_file(qfind_index_t *index, const char *path, const db_entry_t *attr);
+int index_append_metadata(qfind_index_t *index, const char *path, const db_entry_t *attr);
 int qfind_update_index(qfind_index_t *index, const char *path, bool is_add);
 int qfind_commit_updates(qfind_index_t *index);
 int add_file_to_index(qfind_index_t *index, const char *path, file_id_t file_id);
 int compress_posting_lists(qfind_index_t *index);
+int posting_dict_attach(qfind_index_t *index, void *dict, size_t dict_size, bool owned);
+void posting_dict_release(qfind_index_t *index);
+size_t posting_decompress(const qfind_index_t *index, ZSTD_DCtx *dctx,
+                          const index_entry_t *entry, void *dst, size_t dst_cap);
 void remove_from_index(const qfind_index_t *index, file_id_t id);
 int stop_realtime_updates();
+int init_inverted_index(void);
+void cleanup_inverted_index(void);
 
 int qfind_search(qfind_index_t *index, query_ctx_t *query);
+int qfind_explain(qfind_index_t *index, const query_ctx_t *query, FILE *out);
+int qfind_search_batch(qfind_index_t *index, const query_ctx_t *proto, batch_query_t *queries, uint32_t n);
+const index_entry_t *find_index_entry(const qfind_index_t *index, trigram_t trigram);
+int posting_list_slots(const qfind_index_t *index, ZSTD_DCtx *dctx, const index_entry_t *entry,
+                       uint32_t **out, size_t *num_slots);
+void plan_prepare(qfind_index_t *index);
+void plan_query(const qfind_index_t *index, const query_ctx_t *query, query_plan_t *plan);
+void plan_print(const qfind_index_t *index, const query_plan_t *plan, FILE *out);
+bool plan_prefers_literal_set(const qfind_index_t *index, const query_ctx_t *query);
+int short_index_build(qfind_index_t *index);
+void short_index_free(short_index_t *s);
+int short_query_search(const qfind_index_t *index, id_range_t range, const char *pattern,
+                       bool case_sensitive, file_id_t **ids, uint32_t *num_ids);
+typedef int (*scan_range_fn)(const short_index_t *s, uint32_t first, uint32_t end, void *arg, id_list_t *hits);
+int scan_parallel(const short_index_t *s, id_range_t range, size_t serial_bytes, scan_range_fn fn, void *arg,
+                  file_id_t **ids, uint32_t *num_ids);
+int scan_names(const short_index_t *s, id_range_t range, const char *pattern, bool case_sensitive,
+               bool regex, file_id_t **ids, uint32_t *num_ids);
+int id_list_push(id_list_t *l, file_id_t id);
+ac_automaton_t *ac_build(const char **literals, uint32_t n, bool case_sensitive);
+void ac_free(ac_automaton_t *ac);
+bool ac_select(const ac_select_t *sel, const char *name);
+int ac_scan_names(const short_index_t *s, id_range_t range, const ac_select_t *sel,
+                  file_id_t **ids, uint32_t *num_ids);
+int fm_index_build(qfind_index_t *index);
+int fm_index_attach(qfind_index_t *index, const void *blob, size_t size, bool owned);
+void fm_index_free(qfind_index_t *index);
+const void *fm_index_blob(const fm_index_t *fm, size_t *size);
+uint32_t fm_index_num_docs(const fm_index_t *fm);
+uint64_t fm_index_count(const fm_index_t *fm, const char *pattern);
+int fm_index_search(const fm_index_t *fm, const char *pattern, file_id_t **ids, uint32_t *num_ids);
+int basename_index_build(qfind_index_t *index);
+int basename_index_attach(qfind_index_t *index, const void *blob, size_t size, bool owned);
+void basename_index_free(qfind_index_t *index);
+const void *basename_index_blob(const basename_index_t *bi, size_t *size);
+uint32_t basename_index_num_files(const basename_index_t *bi);
+uint32_t basename_index_list_size(const basename_index_t *bi, trigram_t trigram);
+int basename_index_search(const basename_index_t *bi, const char *pattern, file_id_t **ids, uint32_t *num_ids);
+int basename_scan(const short_index_t *s, id_range_t range, const char *pattern, bool case_sensitive,
+                  bool regex, file_id_t **ids, uint32_t *num_ids);
+const char *path_basename(const char *path);
+int meta_columns_reserve(meta_columns_t *c, size_t capacity);
+void meta_columns_set(meta_columns_t *c, uint32_t id, const db_entry_t *attr);
+void meta_columns_free(meta_columns_t *c);
+void meta_entry_from_stat(db_entry_t *attr, const struct stat *st);
+void meta_filter_init(meta_filter_t *f);
+bool meta_filter_match(const meta_columns_t *c, const meta_filter_t *f, uint32_t id);
+double meta_filter_sample(const qfind_index_t *index, const meta_filter_t *f, id_range_t range);
+int perm_add_dir(qfind_index_t *index, uint32_t parent, uint32_t mode, uint32_t uid, uint32_t gid,
+                 uint32_t *dir);
+int perm_visible(qfind_index_t *index, uid_t uid, gid_t gid, const uint64_t **visible, bool *owned);
+void perm_free(qfind_index_t *index);
+shared_cache_t *shared_cache_create(uint32_t max_entries, size_t max_bytes);
+void shared_cache_destroy(shared_cache_t *c);
+cache_obj_t *shared_cache_get(shared_cache_t *c, uint64_t key);
+void shared_cache_put(shared_cache_t *c, uint64_t key, cache_obj_t *obj);
+void shared_cache_clear(shared_cache_t *c);
+void shared_cache_stats(shared_cache_t *c, cache_stats_t *stats);
+void cache_obj_unref(cache_obj_t *obj);
+void index_changed(qfind_index_t *index, bool postings);
+int pool_init(int threads);
+int pool_threads(void);
+void pool_for(pool_fn fn, void *args, size_t size, uint32_t n);
+int meta_filter_scan(const qfind_index_t *index, const meta_filter_t *f, id_range_t range,
+                     file_id_t **ids, uint32_t *num_ids);
+bool anchor_parse(const char *pattern, bool regex, anchor_query_t *a);
+void anchor_to_regex(const anchor_query_t *a, char *out, size_t out_len);
+bool anchor_matches(const anchor_query_t *a, const char *path, bool case_sensitive, bool basename);
+int anchor_index_build(qfind_index_t *index);
+int anchor_index_attach(qfind_index_t *index, const void *blob, size_t size, bool owned);
+void anchor_index_free(qfind_index_t *index);
+const void *anchor_index_blob(const anchor_index_t *ai, size_t *size);
+uint32_t anchor_index_num_files(const anchor_index_t *ai);
+bool anchor_index_range(const qfind_index_t *index, const anchor_query_t *a, bool basename,
+                        const uint32_t **ids, uint32_t *num_ids, bool *ascending);
 int qfind_get_results(query_ctx_t *query, file_metadata_t *results, uint32_t *num_results);
 
 /* Bloom filter operations */
@@ -189,12 +512,37 @@ void ffbloom_add(ffbloom_t bloom, const void *data, size_t len);
 bool ffbloom_check(ffbloom_t bloom, const void *data, size_t len);
 void ffbloom_update_secondary(ffbloom_t bloom, const void *data, size_t len);
 void ffbloom_get_candidates(const ffbloom_t bloom, trigram_t *patterns, uint32_t num_patterns, trigram_t *output, uint32_t *num_found);
-
+void ffbloom_clear(ffbloom_t bloom);
+double ffbloom_fpr(const ffbloom_t bloom, uint64_t num_items);
+
+
+/* Database operations */
+qfind_db_t *db_open(const char *path);
+void db_close(qfind_db_t *db);
+bool db_find_dir(qfind_db_t *db, const char *path, db_dir_t *dir);
+bool db_dir_next_entry(db_dir_t *dir, db_entry_t *entry);
+const void *db_section(const qfind_db_t *db, uint32_t tag, size_t *size);
+db_writer_t *db_writer_create(const char *path, uint32_t flags);
+int db_writer_add_dir(db_writer_t *w, const char *path, const struct stat *st,
+                      const db_entry_t *entries, uint32_t num_entries);
+int db_writer_add_section(db_writer_t *w, uint32_t tag, const void *data, size_t size);
+int db_writer_add_postings(db_writer_t *w, const qfind_index_t *index);
+int db_writer_commit(db_writer_t *w);
+void db_writer_abort(db_writer_t *w);
+int db_join_path(char *out, size_t out_len, const char *dir, const char *name, size_t name_len);
 
 /* Trigram operations */
 uint32_t hash_trigram(trigram_t trigram, uint8_t func_idx);
 void extract_trigrams(const char *text, trigram_t *out, size_t *out_count, size_t max_out);
 
+/* Arena allocation */
+void *huge_map(size_t size);
+void huge_unmap(void *p, size_t size);
+void arena_init(arena_t *a, size_t chunk_size);
+void *arena_alloc(arena_t *a, size_t size, size_t align);
+char *arena_strdup(arena_t *a, const char *s);
+void arena_destroy(arena_t *a);
+
 /* I/O operations */
 int io_context_init(io_context_t *ctx, int queue_size, bool use_sqpoll);
 int io_context_destroy(io_context_t *ctx);
@@ -207,7 +555,6 @@ const char *io_strerror(int error);
 
 /* Utility functions */
 void tokenize_path(const char *path, char **tokens, uint32_t *count);
-bool check_file_permission( const file_metadata_t *meta, uid_t user_id, gid_t group_id);
 
  int add_watch_recursive(const char *path);
 
@@ -0,0 +1,205 @@
+#include "qfind.h"
+#include <errno.h>
+#include <regex.h>
+#include <immintrin.h>
+
+#define SCAN_PARALLEL_BYTES (1 << 20)       // Smaller literal scans run on one thread
+#define SCAN_REGEX_PARALLEL_BYTES (64 << 10)  // regexec() costs far more per byte
+#define SCAN_PARTS_PER_THREAD 4             // Spare parts for idle threads to steal
+
+/*
+ * Brute-force scan of the packed name arena (short_index_t.names), the
+ * engine of last resort when no index structure can narrow a query. The
+ * arena is split by volume across cores. Literals are found with an AVX2
+ * filter on their first and last byte, 32 positions per step, and each
+ * candidate is verified in place; regexes run regexec() on every name.
+ */
+
+int id_list_push(id_list_t *l, file_id_t id) {
+    if (l->n == l->cap) {
+        uint32_t cap = l->cap ? l->cap * 2 : 256;
+        file_id_t *grown = realloc(l->ids, cap * sizeof(file_id_t));
+        if (!grown) return -ENOMEM;
+        l->ids = grown;
+        l->cap = cap;
+    }
+    l->ids[l->n++] = id;
+    return 0;
+}
+
+/* One thread's share of a scan: files [first, end) */
+typedef struct {
+    const short_index_t *s;
+    scan_range_fn fn;
+    void *arg;
+    uint32_t first;
+    uint32_t end;
+    id_list_t hits;
+    int error;
+} scan_part_t;
+
+/* What scan_names() looks for */
+typedef struct {
+    const unsigned char *pat;
+    size_t len;
+    bool case_sensitive;
+    bool regex;
+} scan_query_t;
+
+static bool literal_at(const unsigned char *p, const unsigned char *pat, size_t len, bool case_sensitive) {
+    if (case_sensitive) return memcmp(p, pat, len) == 0;
+    for (size_t i = 0; i < len; i++) {
+        if (fold_ascii(p[i]) != fold_ascii(pat[i])) return false;
+    }
+    return true;
+}
+
+static bool name_has_literal(const unsigned char *name, const unsigned char *pat, size_t len,
+                             bool case_sensitive) {
+    size_t name_len = strlen((const char*)name);
+    for (size_t i = 0; i + len <= name_len; i++) {
+        if (literal_at(name + i, pat, len, case_sensitive)) return true;
+    }
+    return false;
+}
+
+/* glibc serializes regexec() on a shared regex_t, so each part compiles its own */
+static int regex_range(const short_index_t *s, uint32_t first, uint32_t end, void *arg, id_list_t *hits) {
+    const scan_query_t *q = arg;
+    regex_t re;
+    int flags = REG_EXTENDED | REG_NOSUB | (q->case_sensitive ? 0 : REG_ICASE);
+    if (regcomp(&re, (const char*)q->pat, flags) != 0) return -EINVAL;
+
+    int ret = 0;
+    for (uint32_t id = first; id < end && ret == 0; id++) {
+        if (regexec(&re, s->names + s->name_offsets[id], 0, NULL, 0) == 0) ret = id_list_push(hits, id);
+    }
+    regfree(&re);
+    return ret;
+}
+
+static int literal_range(const short_index_t *s, uint32_t first, uint32_t end_id, void *arg, id_list_t *hits) {
+    const scan_query_t *q = arg;
+    if (q->regex) return regex_range(s, first, end_id, arg, hits);
+
+    const unsigned char *names = (const unsigned char*)s->names;
+    const unsigned char *pat = q->pat;
+    size_t len = q->len;
+    uint32_t id = first;
+
+    // The empty literal is in every name
+    if (len == 0) {
+        int ret = 0;
+        for (; id < end_id && ret == 0; id++) ret = id_list_push(hits, id);
+        return ret;
+    }
+
+#ifdef __AVX2__
+    size_t end = s->name_offsets[end_id];
+    size_t i = s->name_offsets[id];
+
+    // Both ASCII cases of the first and last byte when folding
+    unsigned char f = pat[0], l = pat[len - 1];
+    const __m256i vf0 = _mm256_set1_epi8(q->case_sensitive ? f : fold_ascii(f));
+    const __m256i vf1 = _mm256_set1_epi8(q->case_sensitive ? f : upper_ascii(f));
+    const __m256i vl0 = _mm256_set1_epi8(q->case_sensitive ? l : fold_ascii(l));
+    const __m256i vl1 = _mm256_set1_epi8(q->case_sensitive ? l : upper_ascii(l));
+
+    while (i + len - 1 + 32 <= end) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(names + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(names + i + len - 1));
+        __m256i mf = _mm256_or_si256(_mm256_cmpeq_epi8(a, vf0), _mm256_cmpeq_epi8(a, vf1));
+        __m256i ml = _mm256_or_si256(_mm256_cmpeq_epi8(b, vl0), _mm256_cmpeq_epi8(b, vl1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(mf, ml));
+
+        bool jumped = false;
+        for (; mask; mask &= mask - 1) {
+            size_t pos = i + __builtin_ctz(mask);
+            // The pattern has no NUL, so a verified match never crosses names
+            if (!literal_at(names + pos, pat, len, q->case_sensitive)) continue;
+
+            while (s->name_offsets[id + 1] <= pos) id++;
+            if (id_list_push(hits, id) != 0) return -ENOMEM;
+            i = s->name_offsets[++id];
+            if (id >= end_id) return 0;
+            jumped = true;
+            break;
+        }
+        if (!jumped) i += 32;
+    }
+
+    while (id < end_id && s->name_offsets[id + 1] <= i) id++;
+#endif
+
+    // Tail (and non-AVX2 builds): one name at a time
+    for (; id < end_id; id++) {
+        if (!name_has_literal(names + s->name_offsets[id], pat, len, q->case_sensitive)) continue;
+        if (id_list_push(hits, id) != 0) return -ENOMEM;
+    }
+    return 0;
+}
+
+static void scan_worker(void *arg) {
+    scan_part_t *t = arg;
+    t->error = t->fn(t->s, t->first, t->end, t->arg, &t->hits);
+}
+
+/*
+ * Split the names of range by volume into contiguous id ranges, run fn
+ * over each as a pool task (one part below serial_bytes), and concatenate
+ * the hits. fn must report ids of its range in ascending order. There are
+ * a few more parts than threads, so a thread that finishes early steals
+ * the rest of the work instead of idling behind a slow part.
+ */
+int scan_parallel(const short_index_t *s, id_range_t range, size_t serial_bytes, scan_range_fn fn, void *arg,
+                  file_id_t **ids, uint32_t *num_ids) {
+    *ids = NULL;
+    *num_ids = 0;
+    uint32_t first = MIN(range.first, s->num_files), end = MIN(range.end, s->num_files);
+    if (first >= end) return 0;
+
+    size_t base = s->name_offsets[first], bytes = s->name_offsets[end] - base;
+    int nthreads = bytes < serial_bytes || pool_threads() == 1 ? 1 : pool_threads() * SCAN_PARTS_PER_THREAD;
+    scan_part_t *parts = calloc(nthreads, sizeof(scan_part_t));
+    if (!parts) return -ENOMEM;
+
+    uint32_t id = first;
+    for (int t = 0; t < nthreads; t++) {
+        size_t target = base + bytes / nthreads * (t + 1);
+        parts[t] = (scan_part_t){ .s = s, .fn = fn, .arg = arg, .first = id };
+        while (id < end && (s->name_offsets[id] < target || t == nthreads - 1)) id++;
+        parts[t].end = id;
+    }
+
+    pool_for(scan_worker, parts, sizeof(scan_part_t), nthreads);
+
+    // Parts are in id order, so concatenating keeps the result sorted
+    id_list_t out = {0};
+    int ret = 0;
+    for (int t = 0; t < nthreads; t++) {
+        if (parts[t].error) ret = parts[t].error;
+        for (uint32_t i = 0; ret == 0 && i < parts[t].hits.n; i++) ret = id_list_push(&out, parts[t].hits.ids[i]);
+        free(parts[t].hits.ids);
+    }
+    free(parts);
+    if (ret != 0) {
+        free(out.ids);
+        return ret;
+    }
+    *ids = out.ids;
+    *num_ids = out.n;
+    return 0;
+}
+
+/*
+ * Ids, ascending, of files in range of the name arena whose path contains
+ * pattern (ASCII case-folded unless case_sensitive) or, with regex,
+ * matches it as a POSIX extended expression. Files appended after the
+ * last short_index_build() are not covered; callers check the rest themselves.
+ */
+int scan_names(const short_index_t *s, id_range_t range, const char *pattern, bool case_sensitive,
+               bool regex, file_id_t **ids, uint32_t *num_ids) {
+    scan_query_t q = { (const unsigned char*)pattern, regex ? 0 : strlen(pattern), case_sensitive, regex };
+    return scan_parallel(s, range, regex ? SCAN_REGEX_PARALLEL_BYTES : SCAN_PARALLEL_BYTES,
+                         literal_range, &q, ids, num_ids);
+}
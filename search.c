@@ -1,225 +1,1326 @@
+#define _GNU_SOURCE
 #include "qfind.h"
 #include <pthread.h>
 #include <sys/sysinfo.h>
 #include <zstd.h>
 #include <fnmatch.h>
+#include <regex.h>
+#include <errno.h>
+#include <xxhash.h>
 
-#define MAX_TRIGRAMS 1024
-#define RESULTS_PER_THREAD 512
-#define DECOMPRESS_BUF_SIZE (1 << 20) // 1MB
+#define GALLOP_RATIO 32              // Probe by binary search past this size skew
+#define BATCH_CACHE_LISTS 256        // Decoded lists a batch worker keeps within one group
+#define AC_MIN_LITERALS 4            // Larger literal sets are matched by one automaton pass
+#define SLICES_PER_THREAD 4          // Spare trigram slices for idle threads to steal
+#define SLICE_CHECK_EVERY 256        // Candidates verified between early-stop checks
 
+/* A decoded posting list; positions only for POSTING_POSITIONAL lists */
+typedef struct {
+    cache_obj_t obj;                 // Shared with other queries through index->list_cache
+    const index_entry_t *entry;
+    uint32_t *ids;
+    uint32_t num_ids;
+    uint32_t *pos_index;             // ids[i]'s positions: positions[pos_index[i] .. pos_index[i + 1])
+    uint16_t *positions;
+    bool positional;
+} posting_list_t;
+
+/* Lists referenced by one query, shared by all of its patterns */
+typedef struct {
+    posting_list_t **lists;
+    uint32_t n;
+    uint32_t cap;
+} posting_cache_t;
+
+/* Per-query state shared by the execution strategies */
 typedef struct {
     qfind_index_t *index;
     query_ctx_t *query;
-    trigram_t *trigrams;
-    uint32_t trigram_count;
-    uint32_t start_idx;
-    uint32_t end_idx;
-    file_id_t *local_results;
-    uint32_t local_result_count;
-    pthread_mutex_t *result_mutex;
+    const char *pattern;             // Pattern being executed
+    regex_t regex;
+    bool regex_ready;
     ZSTD_DCtx *dctx;
-} search_thread_data_t;
+    posting_cache_t cache;
+    id_list_t *collect;              // Set: matches are gathered here instead of emitted
+    id_range_t scope;                // Walk-ordered ids under query->scope, or every id
+    const char *scope_dir;           // query->scope without trailing '/', NULL when unscoped
+    size_t scope_len;
+    const uint64_t *visible;         // Files the querying user may see, NULL for all
+    bool visible_owned;
+    int error;
+} search_ctx_t;
 
-// Golomb-Rice decoding parameters
+/* MSB-first reader over a Golomb-Rice stream; bits are left-aligned in the window */
 typedef struct {
-    uint8_t k;
-    uint32_t mask;
-    uint32_t current;
-    const uint8_t *input;
-    size_t remaining;
+    const uint8_t *start;
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t bits;
+    unsigned nbits;
+    unsigned pad;                    // Zero bytes supplied past the end
 } gr_decoder_t;
 
-static void gr_decoder_init(gr_decoder_t *dec, uint8_t k, const uint8_t *data, size_t size) {
-    dec->k = k;
-    dec->mask = (1U << k) - 1;
-    dec->input = data;
-    dec->remaining = size;
-    dec->current = 0;
+static void gr_fill(gr_decoder_t *dec) {
+    while (dec->nbits <= 56) {
+        uint64_t byte = 0;
+        if (dec->p < dec->end) byte = *dec->p++;
+        else dec->pad++;
+        dec->bits |= byte << (56 - dec->nbits);
+        dec->nbits += 8;
+    }
+}
+
+static void gr_consume(gr_decoder_t *dec, unsigned n) {
+    dec->bits = n < 64 ? dec->bits << n : 0;
+    dec->nbits -= n;
+}
+
+static void gr_decoder_init(gr_decoder_t *dec, const uint8_t *data, size_t size) {
+    memset(dec, 0, sizeof(*dec));
+    dec->start = dec->p = data;
+    dec->end = data + size;
 }
 
-static int gr_decode_next(gr_decoder_t *dec) {
+static bool gr_decode_next(gr_decoder_t *dec, uint8_t k, uint32_t *value) {
     uint32_t q = 0;
-    
-    // Decode unary quotient
-    while (dec->remaining > 0 && *dec->input == 0xFF) {
-        q += 8;
-        dec->input++;
-        dec->remaining--;
-    }
-    
-    if (dec->remaining == 0) return -1;
-    
-    uint8_t val = *dec->input++;
-    dec->remaining--;
-    
-    while (val & 0x80) {
-        q++;
-        val <<= 1;
-    }
-    
-    // Decode binary remainder
-    uint32_t r = val >> (8 - dec->k);
-    uint32_t read_bits = dec->k;
-    
-    while (read_bits > 8) {
-        if (dec->remaining == 0) return -1;
-        r = (r << 8) | *dec->input++;
-        dec->remaining--;
-        read_bits -= 8;
-    }
-    
-    return (q << dec->k) | (r & dec->mask);
-}
-
-static bool file_matches_all_trigrams(qfind_index_t *index, file_id_t file_id, 
-                                    trigram_t *trigrams, uint32_t trigram_count) {
-    // Check bloom filter first
-    for (uint32_t i = 0; i < trigram_count; i++) {
-        if (!ffbloom_check(index->bloom, &trigrams[i], sizeof(trigram_t))) {
-            return false;
-        }
-    }
-    return true;
-}
-
-static void search_trie(trie_node_t *node, const char *query, size_t pos,
-                       file_id_t *results, uint32_t *count, uint32_t max_results) {
-    if (!node) return;
-
-    // Handle path compression
-    if (node->key == 0xFF && node->count > 1) {
-        if (query[pos] == query[pos+1]) {
-            size_t run_length = 1;
-            while (pos + run_length < strlen(query) && 
-                   query[pos] == query[pos + run_length] && 
-                   run_length < node->count) {
-                run_length++;
+
+    // Unary quotient: count one-bits up to the terminating zero
+    for (;;) {
+        gr_fill(dec);
+        if (dec->pad > 8) return false;
+        unsigned ones = ~dec->bits ? __builtin_clzll(~dec->bits) : 64;
+        if (ones < dec->nbits) {
+            q += ones;
+            gr_consume(dec, ones + 1);
+            break;
+        }
+        q += dec->nbits;
+        gr_consume(dec, dec->nbits);
+    }
+
+    gr_fill(dec);
+    uint32_t r = k ? dec->bits >> (64 - k) : 0;
+    gr_consume(dec, k);
+    *value = (q << k) | r;
+    return dec->pad <= 8;
+}
+
+/* First byte after the bits consumed so far */
+static const uint8_t *gr_byte_end(const gr_decoder_t *dec) {
+    size_t consumed = (size_t)(dec->p - dec->start + dec->pad) * 8 - dec->nbits;
+    return dec->start + (consumed + 7) / 8;
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint32_t *value) {
+    uint32_t v = 0;
+    for (unsigned shift = 0; *p < end && shift < 35; shift += 7) {
+        uint8_t byte = *(*p)++;
+        v |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void posting_list_free(posting_list_t *list) {
+    free(list->ids);
+    free(list->pos_index);
+    free(list->positions);
+    memset(list, 0, sizeof(*list));
+}
+
+/* Decompress and decode one posting list; see POSTING_HEADER_SIZE for the format */
+static int decode_posting_list(const qfind_index_t *index, ZSTD_DCtx *dctx,
+                               const index_entry_t *entry, posting_list_t *list) {
+    const uint8_t *src = (const uint8_t*)index->compressed_data + entry->offset;
+    unsigned long long raw_size = ZSTD_getFrameContentSize(src, entry->size);
+    if (raw_size == ZSTD_CONTENTSIZE_UNKNOWN || raw_size == ZSTD_CONTENTSIZE_ERROR ||
+        raw_size < POSTING_HEADER_SIZE) return -EINVAL;
+
+    uint8_t *raw = malloc(raw_size);
+    if (!raw) return -ENOMEM;
+    size_t n = posting_decompress(index, dctx, entry, raw, raw_size);
+    if (ZSTD_isError(n) || n != raw_size) {
+        syslog(LOG_ERR, "Decompression error: %s", ZSTD_isError(n) ? ZSTD_getErrorName(n) : "short frame");
+        free(raw);
+        return -EIO;
+    }
+
+    memset(list, 0, sizeof(*list));
+    list->entry = entry;
+    uint8_t k = raw[0];
+    list->positional = raw[1] & POSTING_POSITIONAL;
+    memcpy(&list->num_ids, raw + 2, sizeof(uint32_t));
+    list->ids = malloc((list->num_ids ? list->num_ids : 1) * sizeof(uint32_t));
+    int ret = list->ids ? 0 : -ENOMEM;
+
+    gr_decoder_t gr;
+    gr_decoder_init(&gr, raw + POSTING_HEADER_SIZE, raw_size - POSTING_HEADER_SIZE);
+    uint32_t id = 0;
+    for (uint32_t i = 0; ret == 0 && i < list->num_ids; i++) {
+        uint32_t delta;
+        if (!gr_decode_next(&gr, k, &delta)) {
+            ret = -EINVAL;
+            break;
+        }
+        id += delta;
+        list->ids[i] = id;
+    }
+
+    if (ret == 0 && list->positional) {
+        const uint8_t *p = gr_byte_end(&gr), *end = raw + raw_size;
+        size_t cap = list->num_ids * 2 + 16, count = 0;
+        list->pos_index = malloc((list->num_ids + 1) * sizeof(uint32_t));
+        list->positions = malloc(cap * sizeof(uint16_t));
+        if (!list->pos_index || !list->positions) ret = -ENOMEM;
+
+        for (uint32_t i = 0; ret == 0 && i < list->num_ids; i++) {
+            uint32_t npos, pos = 0, delta;
+            list->pos_index[i] = count;
+            if (!get_varint(&p, end, &npos)) {
+                ret = -EINVAL;
+                break;
             }
-            
-            if (run_length == node->count) {
-                pos += node->count;
-            } else {
-                return;
+            if (count + npos > cap) {
+                cap = MAX(cap * 2, count + npos);
+                uint16_t *grown = realloc(list->positions, cap * sizeof(uint16_t));
+                if (!grown) {
+                    ret = -ENOMEM;
+                    break;
+                }
+                list->positions = grown;
+            }
+            for (uint32_t j = 0; j < npos; j++) {
+                if (!get_varint(&p, end, &delta)) {
+                    ret = -EINVAL;
+                    break;
+                }
+                pos += delta;
+                list->positions[count++] = pos;
             }
-        } else {
-            return;
         }
-    } else if (node->key != 0xFF) {
-        if (pos >= strlen(query) || (node->key != query[pos])) {
-            return;
+        if (ret == 0) list->pos_index[list->num_ids] = count;
+    }
+
+    free(raw);
+    if (ret != 0) posting_list_free(list);
+    return ret;
+}
+
+static int compare_entry_trigram(const void *key, const void *elem) {
+    trigram_t t = *(const trigram_t*)key, e = ((const index_entry_t*)elem)->trigram;
+    return (t > e) - (t < e);
+}
+
+/* Binary search of the trigram-sorted entries */
+const index_entry_t *find_index_entry(const qfind_index_t *index, trigram_t trigram) {
+    return bsearch(&trigram, index->entries, index->num_entries,
+                   sizeof(index_entry_t), compare_entry_trigram);
+}
+
+/*
+ * Decode entry's list back into build slots: ids, or id/position pairs
+ * for a positional index. *out is malloc'd, *num_slots uint32s long.
+ */
+int posting_list_slots(const qfind_index_t *index, ZSTD_DCtx *dctx, const index_entry_t *entry,
+                       uint32_t **out, size_t *num_slots) {
+    posting_list_t list;
+    int ret = decode_posting_list(index, dctx, entry, &list);
+    if (ret != 0) return ret;
+    if (list.positional != index->positional) {
+        posting_list_free(&list);
+        return -EINVAL;
+    }
+
+    size_t slots = list.positional ? (size_t)list.pos_index[list.num_ids] * 2 : list.num_ids;
+    uint32_t *v = malloc((slots ? slots : 1) * sizeof(uint32_t));
+    if (!v) {
+        posting_list_free(&list);
+        return -ENOMEM;
+    }
+
+    size_t n = 0;
+    for (uint32_t i = 0; i < list.num_ids; i++) {
+        if (!list.positional) {
+            v[n++] = list.ids[i];
+            continue;
+        }
+        for (uint32_t p = list.pos_index[i]; p < list.pos_index[i + 1]; p++) {
+            v[n++] = list.ids[i];
+            v[n++] = list.positions[p];
         }
-        pos++;
     }
+    posting_list_free(&list);
+    *out = v;
+    *num_slots = n;
+    return 0;
+}
+
+static void list_release(cache_obj_t *obj) {
+    posting_list_t *list = (posting_list_t*)obj;
+    posting_list_free(list);
+    free(list);
+}
+
+static size_t list_bytes(const posting_list_t *list) {
+    size_t bytes = sizeof(posting_list_t) + (size_t)list->num_ids * sizeof(uint32_t);
+    if (list->positional)
+        bytes += (list->num_ids + 1) * sizeof(uint32_t) + list->pos_index[list->num_ids] * sizeof(uint16_t);
+    return bytes;
+}
 
-    if (pos == strlen(query) && node->is_end) {
-        if (*count < max_results) {
-            results[(*count)++] = node->file_id;
+/*
+ * The decoded list for entry: from this query's lists, else from the
+ * index-wide cache, else decoded and offered to that cache. Every list is
+ * a single frame, so the trigram alone is the key.
+ */
+static int cache_get(search_ctx_t *ctx, const index_entry_t *entry, posting_list_t **out) {
+    posting_cache_t *c = &ctx->cache;
+    for (uint32_t i = 0; i < c->n; i++) {
+        if (c->lists[i]->entry == entry) {
+            *out = c->lists[i];
+            return 0;
         }
-        return;
     }
 
-    for (int i = 0; i < 256; i++) {
-        if (node->children[i]) {
-            search_trie(node->children[i], query, pos, results, count, max_results);
+    if (c->n == c->cap) {
+        uint32_t cap = c->cap ? c->cap * 2 : 16;
+        posting_list_t **grown = realloc(c->lists, cap * sizeof(posting_list_t*));
+        if (!grown) return -ENOMEM;
+        c->lists = grown;
+        c->cap = cap;
+    }
+    posting_list_t *list = (posting_list_t*)shared_cache_get(ctx->index->list_cache, entry->trigram);
+    if (!list) {
+        list = malloc(sizeof(posting_list_t));
+        if (!list) return -ENOMEM;
+        int ret = decode_posting_list(ctx->index, ctx->dctx, entry, list);
+        if (ret != 0) {
+            free(list);
+            return ret;
         }
+        list->obj = (cache_obj_t){ .refs = 1, .bytes = list_bytes(list), .release = list_release };
+        shared_cache_put(ctx->index->list_cache, entry->trigram, &list->obj);
     }
+    c->lists[c->n++] = list;
+    *out = list;
+    return 0;
 }
 
-static void* search_worker(void *arg) {
-    search_thread_data_t *data = (search_thread_data_t*)arg;
-    uint8_t *decompress_buf = malloc(DECOMPRESS_BUF_SIZE);
-    file_id_t *seen = calloc(data->index->num_files, sizeof(bool));
+static void cache_free(posting_cache_t *c) {
+    for (uint32_t i = 0; i < c->n; i++) cache_obj_unref(&c->lists[i]->obj);
+    free(c->lists);
+    memset(c, 0, sizeof(*c));
+}
 
-    for (uint32_t i = data->start_idx; i < data->end_idx && i < data->index->num_entries; i++) {
-        index_entry_t *entry = &data->index->entries[i];
-        bool trigram_in_query = false;
-        
-        for (uint32_t j = 0; j < data->trigram_count; j++) {
-            if (entry->trigram == data->trigrams[j]) {
-                trigram_in_query = true;
-                break;
+/* One bit of the user's visibility bitmap (perm.c) replaces a permission check per result */
+static inline bool is_visible(const search_ctx_t *ctx, file_id_t id) {
+    return !ctx->visible || (ctx->visible[id / 64] >> (id % 64) & 1);
+}
+
+/* Resolve query->scope to its run of walk-ordered ids; caller holds index_lock */
+static void scope_init(search_ctx_t *ctx, const query_ctx_t *query) {
+    ctx->scope = ID_RANGE_ALL;
+    ctx->scope_dir = NULL;
+    if (!query->scope) return;
+    ctx->scope = index_scope_range(ctx->index, query->scope);
+    ctx->scope_dir = query->scope;
+    ctx->scope_len = strlen(query->scope);
+    while (ctx->scope_len > 0 && query->scope[ctx->scope_len - 1] == '/') ctx->scope_len--;
+}
+
+/* Files added since the walk are not in the scope's id run; their path decides */
+static bool in_scope(const search_ctx_t *ctx, file_id_t id) {
+    if (!ctx->scope_dir || (id >= ctx->scope.first && id < ctx->scope.end)) return true;
+    if (id < ctx->index->num_walked) return false;
+    const char *path = ctx->index->file_metadata[id].path;
+    return strncmp(path, ctx->scope_dir, ctx->scope_len) == 0 && path[ctx->scope_len] == '/';
+}
+
+/* First id a scan engine has not covered, when its scan covered ids below covered */
+static uint32_t unscanned_from(const search_ctx_t *ctx, uint32_t covered) {
+    return ctx->scope_dir ? MIN(covered, ctx->index->num_walked) : covered;
+}
+
+/* Verify a path against the pattern as the user wrote it */
+static bool path_matches(const search_ctx_t *ctx, const char *path) {
+    if (ctx->query->basename) path = path_basename(path);
+    if (ctx->regex_ready) return regexec(&ctx->regex, path, 0, NULL, 0) == 0;
+    if (ctx->query->case_sensitive) return strstr(path, ctx->pattern) != NULL;
+    return strcasestr(path, ctx->pattern) != NULL;
+}
+
+/* Whether a verified match is delivered; collected ids are only checked for scope */
+static bool result_eligible(const search_ctx_t *ctx, file_id_t id) {
+    if (!in_scope(ctx, id)) return false;
+    if (ctx->collect) return true;
+
+    const file_metadata_t *meta = &ctx->index->file_metadata[id];
+    if (meta->path[0] == '\0') return false;  // Deleted
+    if (!meta_filter_match(&ctx->index->cols, &ctx->query->filter, id)) return false;
+    return is_visible(ctx, id);
+}
+
+/* Deliver one verified match; false once the result buffer is full */
+static bool emit_result(search_ctx_t *ctx, file_id_t id) {
+    if (!result_eligible(ctx, id)) return true;
+    if (ctx->collect) {
+        if (id_list_push(ctx->collect, id) == 0) return true;
+        ctx->error = -ENOMEM;
+        return false;
+    }
+
+    query_ctx_t *query = ctx->query;
+    if (query->num_results >= query->max_results) return false;
+    query->results[query->num_results++] = id;
+    return query->num_results < query->max_results;
+}
+
+/*
+ * Match every file's path directly; the fallback when no index structure
+ * applies. Indexed names are scanned in parallel (scan.c), files added
+ * since the last finalize one by one.
+ */
+static int scan_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    file_id_t *ids;
+    uint32_t n;
+    bool cs = ctx->query->case_sensitive;
+    int ret = ctx->query->basename
+        ? basename_scan(&index->short_idx, ctx->scope, ctx->pattern, cs, ctx->regex_ready, &ids, &n)
+        : scan_names(&index->short_idx, ctx->scope, ctx->pattern, cs, ctx->regex_ready, &ids, &n);
+    if (ret != 0) return ret;
+
+    bool more = true;
+    for (uint32_t i = 0; i < n && more; i++) {
+        if (ids[i] < index->num_files) more = emit_result(ctx, ids[i]);
+    }
+    free(ids);
+
+    for (uint32_t id = unscanned_from(ctx, index->short_idx.num_files); more && id < index->num_files; id++) {
+        if (path_matches(ctx, index->file_metadata[id].path)) more = emit_result(ctx, id);
+    }
+    return 0;
+}
+
+/* 1-2 byte patterns: byte bitmaps or an arena scan, plus files added since */
+static int short_search(search_ctx_t *ctx) {
+    file_id_t *ids;
+    uint32_t n;
+    int ret = short_query_search(ctx->index, ctx->scope, ctx->pattern, ctx->query->case_sensitive, &ids, &n);
+    if (ret != 0) return ret;
+
+    bool more = true;
+    for (uint32_t i = 0; i < n && more; i++) more = emit_result(ctx, ids[i]);
+    free(ids);
+
+    uint32_t first = unscanned_from(ctx, ctx->index->short_idx.num_files);
+    for (uint32_t id = first; more && id < ctx->index->num_files; id++) {
+        if (path_matches(ctx, ctx->index->file_metadata[id].path)) more = emit_result(ctx, id);
+    }
+    return 0;
+}
+
+/* One query trigram occurrence and the decoded list it must appear in */
+typedef struct {
+    posting_list_t *list;
+    uint32_t offset;                 // Byte offset of the trigram within the query
+} trigram_constraint_t;
+
+static int compare_constraints(const void *a, const void *b) {
+    const trigram_constraint_t *x = a, *y = b;
+    uint32_t nx = x->list->num_ids, ny = y->list->num_ids;
+    if (nx != ny) return (nx > ny) - (nx < ny);
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+/* Index of the first ids[i] >= id at or after lo */
+static uint32_t lower_bound(const uint32_t *ids, uint32_t lo, uint32_t n, uint32_t id) {
+    uint32_t hi = n;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ids[mid] < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * Candidate set during intersection. For positional lists each candidate
+ * also carries the query start offsets still consistent with every
+ * constraint applied so far, stored CSR-style in starts[].
+ */
+typedef struct {
+    uint32_t *ids;
+    uint32_t n;
+    uint32_t *start_index;           // n + 1 entries, positional only
+    uint16_t *starts;
+    bool positional;
+} candidates_t;
+
+static void candidates_free(candidates_t *c) {
+    free(c->ids);
+    free(c->start_index);
+    free(c->starts);
+}
+
+/*
+ * Seed the candidates from the rarest list (or a slice of its ids and
+ * pos_index, sharing its positions), keeping only ids inside the
+ * scope: the run [first, end) plus ids from tail on, which were added
+ * after the walk and are checked by path.
+ */
+static int candidates_init(candidates_t *c, const trigram_constraint_t *con, id_range_t scope, uint32_t tail) {
+    const posting_list_t *list = con->list;
+    uint32_t seg[2][2];
+    seg[0][0] = lower_bound(list->ids, 0, list->num_ids, scope.first);
+    seg[0][1] = lower_bound(list->ids, seg[0][0], list->num_ids, scope.end);
+    seg[1][0] = lower_bound(list->ids, seg[0][1], list->num_ids, MAX(scope.end, tail));
+    seg[1][1] = list->num_ids;
+
+    memset(c, 0, sizeof(*c));
+    c->positional = list->positional;
+    c->ids = malloc((list->num_ids ? list->num_ids : 1) * sizeof(uint32_t));
+    if (!c->ids) return -ENOMEM;
+
+    if (!c->positional) {
+        for (int s = 0; s < 2; s++) {
+            memcpy(c->ids + c->n, list->ids + seg[s][0], (seg[s][1] - seg[s][0]) * sizeof(uint32_t));
+            c->n += seg[s][1] - seg[s][0];
+        }
+        return 0;
+    }
+
+    uint32_t total = list->pos_index[list->num_ids] - list->pos_index[0];
+    c->start_index = malloc((list->num_ids + 1) * sizeof(uint32_t));
+    c->starts = malloc((total ? total : 1) * sizeof(uint16_t));
+    if (!c->start_index || !c->starts) return -ENOMEM;
+
+    uint32_t count = 0;
+    for (int s = 0; s < 2; s++) {
+        for (uint32_t i = seg[s][0]; i < seg[s][1]; i++) {
+            uint32_t first = count;
+            for (uint32_t j = list->pos_index[i]; j < list->pos_index[i + 1]; j++) {
+                if (list->positions[j] >= con->offset) c->starts[count++] = list->positions[j] - con->offset;
             }
+            if (count == first) continue;
+            c->start_index[c->n] = first;
+            c->ids[c->n++] = list->ids[i];
         }
-        if (!trigram_in_query) continue;
+    }
+    c->start_index[c->n] = count;
+    return 0;
+}
+
+/* Drop candidates the querying user cannot see, before any list is intersected with them */
+static void candidates_visible(candidates_t *c, const search_ctx_t *ctx) {
+    uint32_t kept = 0, kept_starts = 0;
+    for (uint32_t i = 0; i < c->n; i++) {
+        uint32_t id = c->ids[i];
+        if (id >= ctx->index->num_files || !is_visible(ctx, id)) continue;
+        if (c->positional) {
+            uint32_t a = c->start_index[i], a_end = c->start_index[i + 1];
+            memmove(c->starts + kept_starts, c->starts + a, (a_end - a) * sizeof(uint16_t));
+            c->start_index[kept] = kept_starts;
+            kept_starts += a_end - a;
+        }
+        c->ids[kept++] = id;
+    }
+    c->n = kept;
+    if (c->positional) c->start_index[kept] = kept_starts;
+}
+
+/*
+ * Keep candidates present in the constraint's list; positional candidates
+ * additionally need a start offset at which this trigram sits at
+ * start + offset. Compacts in place.
+ */
+static void candidates_intersect(candidates_t *c, const trigram_constraint_t *con) {
+    const posting_list_t *list = con->list;
+    bool gallop = (uint64_t)c->n * GALLOP_RATIO < list->num_ids;
+    uint32_t kept = 0, kept_starts = 0;
+    uint32_t j = c->n ? lower_bound(list->ids, 0, list->num_ids, c->ids[0]) : 0;
+
+    for (uint32_t i = 0; i < c->n && j < list->num_ids; i++) {
+        uint32_t id = c->ids[i];
+        if (gallop) j = lower_bound(list->ids, j, list->num_ids, id);
+        else while (j < list->num_ids && list->ids[j] < id) j++;
+        if (j == list->num_ids || list->ids[j] != id) continue;
 
-        // Decompress the posting list
-        size_t decomp_size = ZSTD_decompressDCtx(data->dctx, decompress_buf, DECOMPRESS_BUF_SIZE,
-                                                data->index->compressed_data + entry->offset,
-                                                entry->size);
-        if (ZSTD_isError(decomp_size)) {
-            syslog(LOG_ERR, "Decompression error: %s", ZSTD_getErrorName(decomp_size));
+        if (!c->positional) {
+            c->ids[kept++] = id;
             continue;
         }
 
-        gr_decoder_t gr;
-        gr_decoder_init(&gr, 4, decompress_buf, decomp_size); // k=4 optimized empirically
-        uint32_t prev_id = 0;
-
-        while (1) {
-            int delta = gr_decode_next(&gr);
-            if (delta < 0) break;
-            
-            uint32_t file_id = prev_id + delta;
-            prev_id = file_id;
-
-            if (file_id >= data->index->num_files) break;
-            if (seen[file_id]) continue;
-            
-            seen[file_id] = true;
-
-            if (file_matches_all_trigrams(data->index, file_id, 
-                                         data->trigrams, data->trigram_count)) {
-                file_metadata_t *meta = &data->index->file_metadata[file_id];
-                if (check_file_permission(meta, data->query->user_id, 
-                                        data->query->group_id)) {
-                    if (data->local_result_count < RESULTS_PER_THREAD) {
-                        data->local_results[data->local_result_count++] = file_id;
-                    }
-                }
+        // Merge the candidate's start offsets with this list's shifted positions
+        uint32_t first = kept_starts;
+        uint32_t a = c->start_index[i], a_end = c->start_index[i + 1];
+        uint32_t b = list->pos_index[j], b_end = list->pos_index[j + 1];
+        while (a < a_end && b < b_end) {
+            int shifted = (int)list->positions[b] - (int)con->offset;
+            if (shifted < (int)c->starts[a]) b++;
+            else if (shifted > (int)c->starts[a]) a++;
+            else {
+                c->starts[kept_starts++] = c->starts[a];
+                a++;
+                b++;
             }
         }
+        if (kept_starts == first) continue;
+        c->start_index[kept] = first;
+        c->ids[kept++] = id;
     }
 
-    // Merge results
-    pthread_mutex_lock(data->result_mutex);
-    for (uint32_t i = 0; i < data->local_result_count; i++) {
-        if (data->query->num_results >= data->query->max_results) break;
-        
-        bool exists = false;
-        for (uint32_t j = 0; j < data->query->num_results; j++) {
-            if (data->query->results[j] == data->local_results[i]) {
-                exists = true;
-                break;
+    c->n = kept;
+    if (c->positional) c->start_index[kept] = kept_starts;
+}
+
+/* One id range of a large trigram query, intersected and verified as a pool task */
+typedef struct {
+    const search_ctx_t *ctx;
+    const trigram_constraint_t *constraints;
+    size_t num_constraints;
+    uint32_t first;                  // Slice [first, end) of the rarest list
+    uint32_t end;
+    uint32_t tail;
+    bool exact;
+    uint32_t slice;
+    _Atomic uint32_t *found;         // Matches so far, per slice
+    uint32_t wanted;                 // Matches the query can still take
+    id_list_t hits;
+    int error;
+} trigram_slice_t;
+
+/* Earlier slices and this one already hold every match the query can take */
+static bool slice_done(const trigram_slice_t *t) {
+    uint64_t found = 0;
+    for (uint32_t i = 0; i <= t->slice; i++) found += atomic_load_explicit(&t->found[i], memory_order_relaxed);
+    return found >= t->wanted;
+}
+
+static void run_trigram_slice(void *arg) {
+    trigram_slice_t *t = arg;
+    const search_ctx_t *ctx = t->ctx;
+    const trigram_constraint_t *con = t->constraints;
+    posting_list_t part = *con[0].list;
+    part.ids += t->first;
+    part.num_ids = t->end - t->first;
+    if (part.positional) part.pos_index += t->first;
+    trigram_constraint_t seed = { &part, con[0].offset };
+
+    candidates_t cand;
+    t->error = candidates_init(&cand, &seed, ctx->scope, t->tail);
+    if (t->error == 0 && ctx->visible) candidates_visible(&cand, ctx);
+    for (size_t i = 1; t->error == 0 && i < t->num_constraints && cand.n > 0; i++) {
+        if (!cand.positional && con[i].list == con[i - 1].list) continue;
+        candidates_intersect(&cand, &con[i]);
+    }
+
+    for (uint32_t i = 0; t->error == 0 && i < cand.n; i++) {
+        if (i % SLICE_CHECK_EVERY == 0 && slice_done(t)) break;
+        file_id_t id = cand.ids[i];
+        if (id >= ctx->index->num_files || !result_eligible(ctx, id)) continue;
+        if (!t->exact && !path_matches(ctx, ctx->index->file_metadata[id].path)) continue;
+        t->error = id_list_push(&t->hits, id);
+        if (t->error == 0) atomic_fetch_add_explicit(&t->found[t->slice], 1, memory_order_relaxed);
+    }
+    candidates_free(&cand);
+}
+
+/*
+ * trigram_search() for a long rarest list: its ids are cut into slices,
+ * each intersected with the other lists and verified by its own pool
+ * task, and the matches are emitted slice by slice, in id order. A slice
+ * stops early once it and the slices before it hold all the results the
+ * query can still take.
+ */
+static int trigram_search_sliced(search_ctx_t *ctx, const trigram_constraint_t *con, size_t n,
+                                 uint32_t tail, bool exact) {
+    const posting_list_t *rarest = con[0].list;
+    uint32_t first = lower_bound(rarest->ids, 0, rarest->num_ids, ctx->scope.first);
+    uint32_t len = rarest->num_ids - first;
+    uint32_t nslices = MIN((uint32_t)pool_threads() * SLICES_PER_THREAD, MAX(len / SLICE_CHECK_EVERY, 1));
+    trigram_slice_t *slices = calloc(nslices, sizeof(trigram_slice_t));
+    _Atomic uint32_t *found = calloc(nslices, sizeof(*found));
+    if (!slices || !found) {
+        free(slices);
+        free((void*)found);
+        return -ENOMEM;
+    }
+
+    query_ctx_t *query = ctx->query;
+    uint32_t wanted = ctx->collect ? UINT32_MAX : query->max_results - MIN(query->num_results, query->max_results);
+    for (uint32_t s = 0; s < nslices; s++) {
+        slices[s] = (trigram_slice_t){
+            .ctx = ctx, .constraints = con, .num_constraints = n,
+            .first = first + (uint32_t)((uint64_t)len * s / nslices),
+            .end = first + (uint32_t)((uint64_t)len * (s + 1) / nslices),
+            .tail = tail, .exact = exact, .slice = s, .found = found, .wanted = wanted
+        };
+    }
+    pool_for(run_trigram_slice, slices, sizeof(trigram_slice_t), nslices);
+
+    int ret = 0;
+    bool more = true;
+    for (uint32_t s = 0; s < nslices; s++) {
+        if (slices[s].error) ret = slices[s].error;
+        for (uint32_t i = 0; ret == 0 && more && i < slices[s].hits.n; i++) more = emit_result(ctx, slices[s].hits.ids[i]);
+        free(slices[s].hits.ids);
+    }
+    free(slices);
+    free((void*)found);
+    return ret;
+}
+
+/*
+ * Intersect the posting lists of every query trigram, rarest first. With
+ * positional postings the trigrams must also sit at their query offsets
+ * relative to one common start, which proves a case-folded substring
+ * match; paths are then only read when case still has to be checked.
+ */
+static int trigram_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    static __thread trigram_t trigrams[MAX_QUERY_TRIGRAMS];
+    size_t num_trigrams;
+    extract_trigrams(ctx->pattern, trigrams, &num_trigrams, MAX_QUERY_TRIGRAMS);
+
+    trigram_constraint_t *constraints = calloc(num_trigrams, sizeof(trigram_constraint_t));
+    candidates_t cand = {0};
+    int ret = constraints ? 0 : -ENOMEM;
+
+    // Each distinct trigram is decoded once per query; every occurrence becomes a constraint
+    for (size_t i = 0; ret == 0 && i < num_trigrams; i++) {
+        const index_entry_t *entry = find_index_entry(index, trigrams[i]);
+        if (!entry) goto out;  // A trigram no path has: nothing can match
+        ret = cache_get(ctx, entry, &constraints[i].list);
+        constraints[i].offset = i;
+    }
+    if (ret != 0) goto out;
+
+    qsort(constraints, num_trigrams, sizeof(trigram_constraint_t), compare_constraints);
+    uint32_t tail = ctx->scope_dir ? index->num_walked : UINT32_MAX;
+    bool exact = constraints[0].list->positional &&
+                 (!ctx->query->case_sensitive || !has_ascii_letters(ctx->pattern));
+    if (constraints[0].list->num_ids >= TRIGRAM_PARALLEL_IDS && pool_threads() > 1) {
+        ret = trigram_search_sliced(ctx, constraints, num_trigrams, tail, exact);
+        goto out;
+    }
+
+    ret = candidates_init(&cand, &constraints[0], ctx->scope, tail);
+    if (ret == 0 && ctx->visible) candidates_visible(&cand, ctx);
+    for (size_t i = 1; ret == 0 && i < num_trigrams && cand.n > 0; i++) {
+        // Without positions repeated trigrams add nothing
+        if (!cand.positional && constraints[i].list == constraints[i - 1].list) continue;
+        candidates_intersect(&cand, &constraints[i]);
+    }
+    if (ret != 0) goto out;
+
+    for (uint32_t i = 0; i < cand.n; i++) {
+        file_id_t id = cand.ids[i];
+        if (id >= index->num_files) continue;
+        if (!exact && !path_matches(ctx, index->file_metadata[id].path)) continue;
+        if (!emit_result(ctx, id)) break;
+    }
+
+out:
+    free(constraints);
+    candidates_free(&cand);
+    return ret;
+}
+
+/*
+ * FM-index backward search: occurrences are counted in O(pattern) and
+ * located directly, with no lists to intersect. Matches are exact up to
+ * ASCII case, so paths are only read to check case.
+ */
+static int fm_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    file_id_t *ids;
+    uint32_t n;
+    int ret = fm_index_search(index->fm, ctx->pattern, &ids, &n);
+    if (ret != 0) return ret;
+
+    bool exact = !ctx->query->case_sensitive || !has_ascii_letters(ctx->pattern);
+    bool more = true;
+    for (uint32_t i = 0; i < n && more; i++) {
+        if (ids[i] >= index->num_files) continue;
+        if (!exact && !path_matches(ctx, index->file_metadata[ids[i]].path)) continue;
+        more = emit_result(ctx, ids[i]);
+    }
+    free(ids);
+
+    for (uint32_t id = fm_index_num_docs(index->fm); more && id < index->num_files; id++) {
+        if (path_matches(ctx, index->file_metadata[id].path)) more = emit_result(ctx, id);
+    }
+    return 0;
+}
+
+/*
+ * Basename index lookup. Its lists hold files whose last component has
+ * every trigram of the pattern; each candidate's basename is verified.
+ */
+static int basename_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    file_id_t *ids;
+    uint32_t n;
+    int ret = basename_index_search(index->base_idx, ctx->pattern, &ids, &n);
+    if (ret != 0) return ret;
+
+    bool more = true;
+    for (uint32_t i = 0; i < n && more; i++) {
+        if (ids[i] >= index->num_files) continue;
+        if (path_matches(ctx, index->file_metadata[ids[i]].path)) more = emit_result(ctx, ids[i]);
+    }
+    free(ids);
+
+    for (uint32_t id = basename_index_num_files(index->base_idx); more && id < index->num_files; id++) {
+        if (path_matches(ctx, index->file_metadata[id].path)) more = emit_result(ctx, id);
+    }
+    return 0;
+}
+
+static int compare_file_ids(const void *a, const void *b) {
+    file_id_t x = *(const file_id_t*)a, y = *(const file_id_t*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Anchored prefix/suffix queries: binary search of the sorted path or
+ * reversed-basename order, or the extension map, bounds every match in
+ * one run, and each is checked with a single comparison.
+ */
+static int anchor_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    query_ctx_t *query = ctx->query;
+    anchor_query_t a;
+    const uint32_t *range;
+    uint32_t n;
+    bool ascending;
+    if (!anchor_parse(ctx->pattern, true, &a) ||
+        !anchor_index_range(index, &a, query->basename, &range, &n, &ascending)) return -EINVAL;
+
+    file_id_t *ids = malloc((n ? n : 1) * sizeof(file_id_t));
+    if (!ids) return -ENOMEM;
+    for (uint32_t i = 0; i < n; i++) ids[i] = range[i];
+    if (!ascending) qsort(ids, n, sizeof(file_id_t), compare_file_ids);
+
+    bool more = true;
+    for (uint32_t i = 0; i < n && more; i++) {
+        if (ids[i] >= index->num_files) continue;
+        if (anchor_matches(&a, index->file_metadata[ids[i]].path, query->case_sensitive, query->basename))
+            more = emit_result(ctx, ids[i]);
+    }
+    free(ids);
+
+    for (uint32_t id = anchor_index_num_files(index->anchors); more && id < index->num_files; id++) {
+        if (path_matches(ctx, index->file_metadata[id].path)) more = emit_result(ctx, id);
+    }
+    return 0;
+}
+
+/*
+ * Attributes first: the columns yield the files passing query->filter,
+ * and only their paths are matched. Wins when the filter is much more
+ * selective than the pattern, as in "*.core over 1G".
+ */
+static int filter_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    uint32_t n = index->num_files;
+    id_range_t parts[2] = {
+        { MIN(ctx->scope.first, n), MIN(ctx->scope.end, n) },
+        { unscanned_from(ctx, n), n }
+    };
+
+    bool more = true;
+    for (int p = 0; p < 2 && more; p++) {
+        file_id_t *ids;
+        uint32_t num_ids;
+        int ret = meta_filter_scan(index, &ctx->query->filter, parts[p], &ids, &num_ids);
+        if (ret != 0) return ret;
+        for (uint32_t i = 0; i < num_ids && more; i++) {
+            if (path_matches(ctx, index->file_metadata[ids[i]].path)) more = emit_result(ctx, ids[i]);
+        }
+        free(ids);
+    }
+    return 0;
+}
+
+/*
+ * Literal globs: "*LIT*" runs as the literal LIT, while "*LIT" and "LIT*"
+ * run as the equivalent anchored regex, so every engine agrees on them.
+ */
+static const char *prepare_pattern(query_ctx_t *q, const char *pattern, char *buf, size_t buf_len) {
+    anchor_query_t a;
+    if (q->regex_enabled || !anchor_parse(pattern, false, &a)) return pattern;
+    if (a.prefix || a.suffix) {
+        anchor_to_regex(&a, buf, buf_len);
+        q->regex_enabled = true;
+    } else {
+        memcpy(buf, a.literal, a.len + 1);
+    }
+    return buf;
+}
+
+/* Plan and execute one pattern, emitting (or collecting) its matches */
+static int run_pattern(search_ctx_t *ctx, const char *pattern) {
+    char rewritten[2 * PATH_MAX + 3];
+    query_ctx_t q = *ctx->query;
+    pattern = prepare_pattern(&q, pattern, rewritten, sizeof(rewritten));
+    q.query = (char*)pattern;
+    ctx->pattern = pattern;
+
+    if (q.regex_enabled) {
+        int flags = REG_EXTENDED | REG_NOSUB | (q.case_sensitive ? 0 : REG_ICASE);
+        if (regcomp(&ctx->regex, pattern, flags) != 0) return -EINVAL;
+        ctx->regex_ready = true;
+    }
+
+    query_plan_t plan;
+    plan_query(ctx->index, &q, &plan);
+    int ret = 0;
+    switch (plan.kind) {
+        case PLAN_EMPTY: break;
+        case PLAN_SHORT: ret = short_search(ctx); break;
+        case PLAN_TRIGRAM: ret = trigram_search(ctx); break;
+        case PLAN_FM: ret = fm_search(ctx); break;
+        case PLAN_BASENAME: ret = basename_search(ctx); break;
+        case PLAN_ANCHOR: ret = anchor_search(ctx); break;
+        case PLAN_FILTER: ret = filter_search(ctx); break;
+        default: ret = scan_search(ctx); break;
+    }
+
+    if (ctx->regex_ready) regfree(&ctx->regex);
+    ctx->regex_ready = false;
+    return ret ? ret : ctx->error;
+}
+
+/* Every file matching pattern, ascending */
+static int collect_pattern(search_ctx_t *ctx, const char *pattern, id_list_t *out) {
+    memset(out, 0, sizeof(*out));
+    ctx->collect = out;
+    int ret = run_pattern(ctx, pattern);
+    ctx->collect = NULL;
+    return ret;
+}
+
+/* a op b on ascending id lists, into a; op: '&' keeps both, '|' either, '-' a only */
+static int combine_ids(id_list_t *a, const id_list_t *b, char op) {
+    id_list_t out = {0};
+    uint32_t i = 0, j = 0;
+    int ret = 0;
+    while (ret == 0 && (i < a->n || j < b->n)) {
+        bool in_a = i < a->n && (j >= b->n || a->ids[i] <= b->ids[j]);
+        bool in_b = j < b->n && (i >= a->n || b->ids[j] <= a->ids[i]);
+        file_id_t id = in_a ? a->ids[i] : b->ids[j];
+        bool keep = op == '&' ? (in_a && in_b) : op == '|' ? true : (in_a && !in_b);
+        if (keep) ret = id_list_push(&out, id);
+        i += in_a;
+        j += in_b;
+    }
+    free(a->ids);
+    *a = out;
+    return ret;
+}
+
+/*
+ * Many literals at once: one Aho-Corasick pass over every name selects
+ * the files, instead of one plan per pattern and strstr() per literal.
+ */
+static int literal_set_search(search_ctx_t *ctx) {
+    qfind_index_t *index = ctx->index;
+    query_ctx_t *query = ctx->query;
+    uint32_t n = query->num_patterns + query->num_excludes;
+    const char *literals[n];
+    for (uint32_t i = 0; i < query->num_patterns; i++) literals[i] = query->patterns[i];
+    for (uint32_t i = 0; i < query->num_excludes; i++) literals[query->num_patterns + i] = query->excludes[i];
+
+    ac_automaton_t *ac = ac_build(literals, n, query->case_sensitive);
+    if (!ac) return -ENOMEM;
+    ac_select_t sel = { ac, query->num_patterns, query->match_all };
+
+    file_id_t *ids;
+    uint32_t num_ids;
+    int ret = ac_scan_names(&index->short_idx, ctx->scope, &sel, &ids, &num_ids);
+    if (ret == 0) {
+        bool more = true;
+        for (uint32_t i = 0; i < num_ids && more; i++) {
+            if (ids[i] < index->num_files) more = emit_result(ctx, ids[i]);
+        }
+        free(ids);
+        for (uint32_t id = unscanned_from(ctx, index->short_idx.num_files); more && id < index->num_files; id++) {
+            if (ac_select(&sel, index->file_metadata[id].path)) more = emit_result(ctx, id);
+        }
+    }
+    ac_free(ac);
+    return ret;
+}
+
+/* Empty patterns and globs are not plain literals */
+static bool has_special_pattern(const char **patterns, uint32_t n) {
+    anchor_query_t a;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!patterns[i][0] || anchor_parse(patterns[i], false, &a)) return true;
+    }
+    return false;
+}
+
+/*
+ * Several patterns combined: every pattern (match_all) or any of them,
+ * minus files matching an exclude pattern. Each pattern yields its full
+ * id set from its own plan; posting lists shared between patterns come
+ * from the query's cache, so they are decoded only once.
+ */
+static int multi_search(search_ctx_t *ctx) {
+    query_ctx_t *query = ctx->query;
+    id_list_t acc = {0}, set;
+    int ret = 0;
+
+    if (!query->regex_enabled && !query->basename &&
+        query->num_patterns + query->num_excludes > AC_MIN_LITERALS &&
+        !has_special_pattern(query->patterns, query->num_patterns) &&
+        !has_special_pattern(query->excludes, query->num_excludes) &&
+        plan_prefers_literal_set(ctx->index, query))
+        return literal_set_search(ctx);
+
+    for (uint32_t i = 0; ret == 0 && i < query->num_patterns; i++) {
+        ret = collect_pattern(ctx, query->patterns[i], &set);
+        if (ret == 0) {
+            if (i == 0) {
+                acc = set;
+                set.ids = NULL;
+            } else {
+                ret = combine_ids(&acc, &set, query->match_all ? '&' : '|');
             }
         }
-        
-        if (!exists) {
-            data->query->results[data->query->num_results++] = data->local_results[i];
+        free(set.ids);
+        if (query->match_all && acc.n == 0) break;  // Nothing left to narrow
+    }
+    for (uint32_t i = 0; ret == 0 && acc.n > 0 && i < query->num_excludes; i++) {
+        ret = collect_pattern(ctx, query->excludes[i], &set);
+        if (ret == 0) ret = combine_ids(&acc, &set, '-');
+        free(set.ids);
+    }
+
+    for (uint32_t i = 0; ret == 0 && i < acc.n; i++) {
+        if (!emit_result(ctx, acc.ids[i])) break;
+    }
+    free(acc.ids);
+    return ret;
+}
+
+/* Results of one query as kept in index->result_cache, with the key they were stored under */
+typedef struct {
+    cache_obj_t obj;
+    char *key;
+    size_t key_len;
+    uint32_t num_results;
+    file_id_t results[];
+} cached_result_t;
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool failed;
+} key_builder_t;
+
+static void key_add(key_builder_t *k, const void *data, size_t len) {
+    if (k->failed) return;
+    if (k->len + len > k->cap) {
+        size_t cap = MAX(k->cap * 2, k->len + len + 256);
+        char *grown = realloc(k->buf, cap);
+        if (!grown) {
+            k->failed = true;
+            return;
         }
+        k->buf = grown;
+        k->cap = cap;
     }
-    pthread_mutex_unlock(data->result_mutex);
+    memcpy(k->buf + k->len, data, len);
+    k->len += len;
+}
 
-    free(decompress_buf);
-    free(seen);
-    pthread_exit(NULL);
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const*)a, *(char *const*)b);
 }
 
-bool check_file_permission(const file_metadata_t *meta, uid_t user_id, gid_t group_id) {
-    if (user_id == 0) return true; // Root access
-    
-    mode_t mode = meta->permissions;
-    uid_t file_uid = meta->permissions >> 16;
-    gid_t file_gid = (meta->permissions >> 8) & 0xFF;
+/* Patterns sorted, and folded when matched ASCII case-insensitively: neither changes the result set */
+static void key_add_patterns(key_builder_t *k, const char *const *patterns, uint32_t n, bool fold) {
+    char **copies = calloc(n ? n : 1, sizeof(char*));
+    if (!copies) k->failed = true;
+    for (uint32_t i = 0; !k->failed && i < n; i++) {
+        copies[i] = strdup(patterns[i]);
+        if (!copies[i]) k->failed = true;
+        for (char *p = copies[i]; fold && p && *p; p++) *p = fold_ascii(*p);
+    }
+    if (!k->failed) qsort(copies, n, sizeof(char*), compare_strings);
+    key_add(k, &n, sizeof(n));
+    for (uint32_t i = 0; copies && i < n; i++) {
+        if (copies[i]) key_add(k, copies[i], strlen(copies[i]) + 1);
+        free(copies[i]);
+    }
+    free(copies);
+}
 
-    if ((mode & S_IROTH)) return true;
-    if ((file_uid == user_id) && (mode & S_IRUSR)) return true;
-    if ((file_gid == group_id) && (mode & S_IRGRP)) return true;
-    
-    return false;
+/*
+ * Everything that decides a query's results, in canonical form, after the
+ * index epoch: keys built before a change to the index never match again.
+ * NULL when out of memory, which only skips the cache.
+ */
+static char *result_key(const qfind_index_t *index, const query_ctx_t *q, size_t *len) {
+    key_builder_t k = {0};
+    const meta_filter_t *f = &q->filter;
+    uint64_t epoch = atomic_load(&index->epoch);
+    uint8_t flags = q->match_all | q->case_sensitive << 1 | q->regex_enabled << 2 | q->basename << 3 |
+                    f->active << 4;
+    key_add(&k, &epoch, sizeof(epoch));
+    key_add(&k, &flags, sizeof(flags));
+    key_add(&k, &q->max_results, sizeof(q->max_results));
+    key_add(&k, &q->user_id, sizeof(q->user_id));
+    key_add(&k, &q->group_id, sizeof(q->group_id));
+    if (f->active) {
+        key_add(&k, &f->min_size, sizeof(f->min_size));
+        key_add(&k, &f->max_size, sizeof(f->max_size));
+        key_add(&k, &f->min_mtime, sizeof(f->min_mtime));
+        key_add(&k, &f->max_mtime, sizeof(f->max_mtime));
+        key_add(&k, &f->types, sizeof(f->types));
+        key_add(&k, &f->owner, sizeof(f->owner));
+    }
+    const char *scope = q->scope ? q->scope : "";
+    key_add(&k, scope, strlen(scope) + 1);
+
+    bool fold = !q->case_sensitive && !q->regex_enabled;
+    const char *single = q->query ? q->query : "";
+    if (q->num_patterns) key_add_patterns(&k, q->patterns, q->num_patterns, fold);
+    else key_add_patterns(&k, &single, 1, fold);
+    key_add_patterns(&k, q->excludes, q->num_excludes, fold);
+
+    if (k.failed) {
+        free(k.buf);
+        return NULL;
+    }
+    *len = k.len;
+    return k.buf;
+}
+
+/* Fill query's results from the cache; false on a miss */
+static bool result_lookup(qfind_index_t *index, const char *key, size_t len, query_ctx_t *query) {
+    cached_result_t *r = (cached_result_t*)shared_cache_get(index->result_cache, XXH3_64bits(key, len));
+    if (!r) return false;
+    bool hit = r->key_len == len && memcmp(r->key, key, len) == 0;
+    if (hit) {
+        memcpy(query->results, r->results, r->num_results * sizeof(file_id_t));
+        query->num_results = r->num_results;
+    }
+    cache_obj_unref(&r->obj);
+    return hit;
+}
+
+static void result_release(cache_obj_t *obj) {
+    free(obj);
+}
+
+static void result_store(qfind_index_t *index, const char *key, size_t len, const query_ctx_t *query) {
+    size_t ids = query->num_results * sizeof(file_id_t);
+    cached_result_t *r = malloc(sizeof(cached_result_t) + ids + len);
+    if (!r) return;
+    r->obj = (cache_obj_t){ .refs = 1, .bytes = sizeof(cached_result_t) + ids + len, .release = result_release };
+    r->key = (char*)r->results + ids;
+    r->key_len = len;
+    r->num_results = query->num_results;
+    memcpy(r->results, query->results, ids);
+    memcpy(r->key, key, len);
+    shared_cache_put(index->result_cache, XXH3_64bits(key, len), &r->obj);
+    cache_obj_unref(&r->obj);
 }
 
 int qfind_search(qfind_index_t *index, query_ctx_t *query) {
-    // TODO: implement search logic
+    search_ctx_t ctx = { .index = index, .query = query };
+
+    query->num_results = 0;
+    query->results = malloc((query->max_results ? query->max_results : 1) * sizeof(file_id_t));
+    if (!query->results) return -ENOMEM;
+
+    ctx.dctx = ZSTD_createDCtx();
+    if (!ctx.dctx) return -ENOMEM;
+
+    pthread_rwlock_rdlock(&index->index_lock);
+    size_t key_len = 0;
+    char *key = result_key(index, query, &key_len);
+    int ret = 0;
+    if (!key || !result_lookup(index, key, key_len, query)) {
+        scope_init(&ctx, query);
+        ret = perm_visible(index, query->user_id, query->group_id, &ctx.visible, &ctx.visible_owned);
+        if (ret == 0 && (query->num_patterns > 1 || query->num_excludes > 0)) ret = multi_search(&ctx);
+        else if (ret == 0) ret = run_pattern(&ctx, query->num_patterns ? query->patterns[0] : query->query);
+        if (ctx.visible_owned) free((void*)ctx.visible);
+        if (ret >= 0 && key) result_store(index, key, key_len, query);
+    }
+    pthread_rwlock_unlock(&index->index_lock);
+    free(key);
+
+    cache_free(&ctx.cache);
+    ZSTD_freeDCtx(ctx.dctx);
+    return ret < 0 ? ret : (int)query->num_results;
+}
+
+/* A batch query and the key it is grouped by */
+typedef struct {
+    batch_query_t *query;
+    trigram_t key;                   // Trigram with the longest posting list, 0 for none
+} batch_item_t;
+
+static int compare_batch_items(const void *a, const void *b) {
+    const batch_item_t *x = a, *y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/* The trigram whose list is costliest to decode; queries sharing it share the decode */
+static trigram_t batch_key(const qfind_index_t *index, const char *pattern) {
+    static __thread trigram_t trigrams[MAX_QUERY_TRIGRAMS];
+    size_t n;
+    extract_trigrams(pattern, trigrams, &n, MAX_QUERY_TRIGRAMS);
+
+    trigram_t key = 0;
+    uint32_t longest = 0;
+    for (size_t i = 0; i < n; i++) {
+        const index_entry_t *entry = find_index_entry(index, trigrams[i]);
+        if (entry && entry->num_files > longest) {
+            longest = entry->num_files;
+            key = trigrams[i];
+        }
+    }
+    return key;
+}
+
+typedef struct {
+    qfind_index_t *index;
+    const query_ctx_t *proto;
+    batch_item_t *items;
+    const uint64_t *visible;
+    uint32_t first;
+    uint32_t end;
+} batch_worker_t;
+
+static void batch_worker(void *arg) {
+    batch_worker_t *w = arg;
+    search_ctx_t ctx = { .index = w->index, .visible = w->visible };
+    ctx.dctx = ZSTD_createDCtx();
+    scope_init(&ctx, w->proto);
+
+    for (uint32_t i = w->first; i < w->end; i++) {
+        batch_query_t *bq = w->items[i].query;
+        if (!ctx.dctx) {
+            bq->error = -ENOMEM;
+            continue;
+        }
+        // A new group starts with a cold cache
+        if (i > w->first && (w->items[i].key != w->items[i - 1].key || ctx.cache.n > BATCH_CACHE_LISTS))
+            cache_free(&ctx.cache);
+
+        query_ctx_t q = *w->proto;
+        q.query = (char*)bq->pattern;
+        q.num_patterns = q.num_excludes = 0;
+        q.num_results = 0;
+        q.results = malloc((q.max_results ? q.max_results : 1) * sizeof(file_id_t));
+        if (!q.results) {
+            bq->error = -ENOMEM;
+            continue;
+        }
+        ctx.query = &q;
+        ctx.error = 0;
+        bq->error = run_pattern(&ctx, bq->pattern);
+        bq->results = q.results;
+        bq->num_results = q.num_results;
+    }
+
+    cache_free(&ctx.cache);
+    ZSTD_freeDCtx(ctx.dctx);
+}
+
+/*
+ * Run many single-pattern queries with the options of proto. Queries are
+ * grouped by their costliest trigram, and the groups are split into one
+ * pool task per thread. Within a group each shared list is decoded once. Each query's
+ * results (or error) are stored in its batch_query_t; free them with free().
+ */
+int qfind_search_batch(qfind_index_t *index, const query_ctx_t *proto, batch_query_t *queries, uint32_t n) {
+    int nthreads = MIN((uint32_t)pool_threads(), MAX(n, 1));
+    batch_item_t *items = malloc((n ? n : 1) * sizeof(batch_item_t));
+    batch_worker_t *workers = malloc(nthreads * sizeof(batch_worker_t));
+    if (!items || !workers) {
+        free(items);
+        free(workers);
+        return -ENOMEM;
+    }
+
+    pthread_rwlock_rdlock(&index->index_lock);
+    const uint64_t *visible;
+    bool visible_owned;
+    int ret = perm_visible(index, proto->user_id, proto->group_id, &visible, &visible_owned);
+    if (ret != 0) {
+        pthread_rwlock_unlock(&index->index_lock);
+        free(items);
+        free(workers);
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        queries[i].results = NULL;
+        queries[i].num_results = 0;
+        queries[i].error = 0;
+        items[i].query = &queries[i];
+        items[i].key = proto->regex_enabled || proto->basename ? 0 : batch_key(index, queries[i].pattern);
+    }
+    qsort(items, n, sizeof(batch_item_t), compare_batch_items);
+
+
+    // Even shares, each boundary moved forward to the end of a group where one is near
+    uint32_t first = 0;
+    for (int t = 0; t < nthreads; t++) {
+        uint32_t end = t == nthreads - 1 ? n : MAX(first, (uint32_t)((uint64_t)n * (t + 1) / nthreads));
+        uint32_t limit = MIN(n, end + n / nthreads / 2);
+        while (end > 0 && end < limit && items[end].key == items[end - 1].key) end++;
+        workers[t] = (batch_worker_t){ index, proto, items, visible, first, end };
+        first = end;
+    }
+
+    pool_for(batch_worker, workers, sizeof(batch_worker_t), nthreads);
+    if (visible_owned) free((void*)visible);
+    pthread_rwlock_unlock(&index->index_lock);
+
+    free(items);
+    free(workers);
+    return 0;
+}
+
+/* Print the plan qfind_search() would run for each pattern, without running it */
+int qfind_explain(qfind_index_t *index, const query_ctx_t *query, FILE *out) {
+    uint32_t n = query->num_patterns + query->num_excludes;
+    char rewritten[2 * PATH_MAX + 3];
+    query_plan_t plan;
+
+    pthread_rwlock_rdlock(&index->index_lock);
+    if (query->num_patterns <= 1 && query->num_excludes == 0) {
+        query_ctx_t q = *query;
+        if (query->num_patterns) q.query = (char*)query->patterns[0];
+        q.query = (char*)prepare_pattern(&q, q.query, rewritten, sizeof(rewritten));
+        plan_query(index, &q, &plan);
+        plan_print(index, &plan, out);
+    } else {
+        for (uint32_t i = 0; i < n; i++) {
+            bool exclude = i >= query->num_patterns;
+            query_ctx_t q = *query;
+            q.query = (char*)(exclude ? query->excludes[i - query->num_patterns] : query->patterns[i]);
+            fprintf(out, "%s%s pattern \"%s\":\n", i ? "\n" : "",
+                    exclude ? "NOT" : query->match_all ? "AND" : "OR", q.query);
+            q.query = (char*)prepare_pattern(&q, q.query, rewritten, sizeof(rewritten));
+            plan_query(index, &q, &plan);
+            plan_print(index, &plan, out);
+        }
+    }
+    pthread_rwlock_unlock(&index->index_lock);
     return 0;
 }
@@ -0,0 +1,150 @@
+#include "qfind.h"
+#include <errno.h>
+
+#define SHORT_VERIFY_RATIO 16        // Verify candidates one by one below 1/16 density
+
+/*
+ * Patterns shorter than a trigram. Every path is packed, NUL-terminated,
+ * into one name arena in id order, and each raw byte value that occurs has
+ * a bitmap of the files containing it. One byte is a bitmap walk; two
+ * bytes AND their bitmaps and either verify the few candidates or, when
+ * the AND is dense, scan the arena on all cores (scan.c).
+ */
+
+static inline size_t bitmap_words(uint32_t num_files) {
+    return (num_files + 63) / 64;
+}
+
+void short_index_free(short_index_t *s) {
+    free(s->names);
+    free(s->name_offsets);
+    for (int c = 0; c < 256; c++) free(s->byte_bitmaps[c]);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Rebuild from the current metadata; caller holds index_lock for writing */
+int short_index_build(qfind_index_t *index) {
+    short_index_t *s = &index->short_idx;
+    short_index_free(s);
+
+    uint32_t n = index->num_files;
+    size_t total = 0;
+    for (uint32_t id = 0; id < n; id++) total += strlen(index->file_metadata[id].path) + 1;
+
+    s->names = malloc(total ? total : 1);
+    s->name_offsets = malloc(((size_t)n + 1) * sizeof(uint64_t));
+    if (!s->names || !s->name_offsets) goto oom;
+
+    size_t words = bitmap_words(n);
+    size_t off = 0;
+    for (uint32_t id = 0; id < n; id++) {
+        const unsigned char *p = (const unsigned char*)index->file_metadata[id].path;
+        s->name_offsets[id] = off;
+        for (; *p; p++) {
+            if (!s->byte_bitmaps[*p]) {
+                s->byte_bitmaps[*p] = calloc(words, sizeof(uint64_t));
+                if (!s->byte_bitmaps[*p]) goto oom;
+            }
+            s->byte_bitmaps[*p][id / 64] |= 1ULL << (id % 64);
+            s->names[off++] = *p;
+        }
+        s->names[off++] = '\0';
+    }
+    s->name_offsets[n] = off;
+    s->names_size = off;
+    s->num_files = n;
+    return 0;
+
+oom:
+    short_index_free(s);
+    syslog(LOG_CRIT, "Out of memory building the short-query index");
+    return -ENOMEM;
+}
+
+/* Words [w0, w1) of the bitmap of files containing byte c, or either ASCII case of it */
+static void byte_set(const short_index_t *s, unsigned char c, bool case_sensitive, size_t w0, size_t w1,
+                     uint64_t *out) {
+    const uint64_t *a = s->byte_bitmaps[c];
+    unsigned char other = fold_ascii(c) != c ? fold_ascii(c) : upper_ascii(c);
+    const uint64_t *b = (!case_sensitive && other != c) ? s->byte_bitmaps[other] : NULL;
+
+    for (size_t w = w0; w < w1; w++) out[w] = (a ? a[w] : 0) | (b ? b[w] : 0);
+}
+
+static bool bigram_at(const unsigned char *p, const unsigned char *pat, bool case_sensitive) {
+    if (case_sensitive) return p[0] == pat[0] && p[1] == pat[1];
+    return fold_ascii(p[0]) == fold_ascii(pat[0]) && fold_ascii(p[1]) == fold_ascii(pat[1]);
+}
+
+static bool name_has_bigram(const char *name, const unsigned char *pat, bool case_sensitive) {
+    for (const unsigned char *p = (const unsigned char*)name; p[0] && p[1]; p++) {
+        if (bigram_at(p, pat, case_sensitive)) return true;
+    }
+    return false;
+}
+
+/*
+ * Ids, ascending, of indexed files in range whose path contains the 1- or
+ * 2-byte pattern. Files appended after the last short_index_build() are
+ * not covered; callers check ids >= short_idx.num_files themselves.
+ */
+int short_query_search(const qfind_index_t *index, id_range_t range, const char *pattern,
+                       bool case_sensitive, file_id_t **ids, uint32_t *num_ids) {
+    const short_index_t *s = &index->short_idx;
+    const unsigned char *pat = (const unsigned char*)pattern;
+    size_t len = strlen(pattern);
+    size_t words = bitmap_words(s->num_files);
+    uint32_t first = MIN(range.first, s->num_files), end = MIN(range.end, s->num_files);
+    id_list_t out = {0};
+    int ret = 0;
+
+    *ids = NULL;
+    *num_ids = 0;
+    if (len == 0 || len > 2 || first >= end) return len > 2 ? -EINVAL : 0;
+
+    uint64_t *set = malloc(words * sizeof(uint64_t));
+    uint64_t *second = len == 2 ? malloc(words * sizeof(uint64_t)) : NULL;
+    if (!set || (len == 2 && !second)) {
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    // Only the words covering range are filled
+    size_t w0 = first / 64, w1 = bitmap_words(end);
+    byte_set(s, pat[0], case_sensitive, w0, w1, set);
+    uint64_t count = 0;
+    if (len == 2) {
+        byte_set(s, pat[1], case_sensitive, w0, w1, second);
+        for (size_t w = w0; w < w1; w++) {
+            set[w] &= second[w];
+            count += __builtin_popcountll(set[w]);
+        }
+        // Dense candidate sets are cheaper to find by scanning every name
+        if (count * SHORT_VERIFY_RATIO >= end - first) {
+            free(set);
+            free(second);
+            return scan_names(s, range, pattern, case_sensitive, false, ids, num_ids);
+        }
+    }
+
+    for (size_t w = w0; w < w1 && ret == 0; w++) {
+        for (uint64_t bits = set[w]; bits && ret == 0; bits &= bits - 1) {
+            uint32_t id = w * 64 + __builtin_ctzll(bits);
+            if (id < first || id >= end) continue;
+            if (len == 2 && !name_has_bigram(s->names + s->name_offsets[id], pat, case_sensitive))
+                continue;
+            ret = id_list_push(&out, id);
+        }
+    }
+
+out:
+    free(set);
+    free(second);
+    if (ret != 0) {
+        free(out.ids);
+        return ret;
+    }
+    *ids = out.ids;
+    *num_ids = out.n;
+    return 0;
+}